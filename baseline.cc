@@ -0,0 +1,350 @@
+#include "baseline.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+
+#include "fmt/format.h"
+
+namespace {
+  std::string_view
+  trim(std::string_view s)
+  {
+    auto const first = s.find_first_not_of(' ');
+    if (first == std::string_view::npos)
+      return {};
+    return s.substr(first, s.find_last_not_of(' ') - first + 1);
+  }
+
+  // The cells of a table row; the empty ones before the first '|' and after
+  // the last are dropped.
+  std::vector<std::string_view>
+  split_row(std::string_view line)
+  {
+    std::vector<std::string_view> cells;
+    line.remove_prefix(1);
+    while (!line.empty()) {
+      auto const bar = line.find('|');
+      cells.push_back(trim(line.substr(0, bar)));
+      if (bar == std::string_view::npos)
+        break;
+      line.remove_prefix(bar + 1);
+    }
+    return cells;
+  }
+
+  // A number as nanobench prints it, with thousands separators and perhaps
+  // a trailing '%'.
+  std::optional<double>
+  parse_number(std::string_view cell)
+  {
+    std::string digits;
+    std::ranges::copy_if(cell, std::back_inserter(digits), [](char c) {
+      return c != ',' && c != '%';
+    });
+    double value = 0.0;
+    auto const end = digits.data() + digits.size();
+    auto const [p, ec] = std::from_chars(digits.data(), end, value);
+    if (ec != std::errc() || p != end || digits.empty())
+      return std::nullopt;
+    return value;
+  }
+
+  double
+  median(std::vector<double> v)
+  {
+    std::ranges::sort(v);
+    return v.size() % 2 == 1 ? v[v.size() / 2] :
+                               (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+  }
+
+  // The column of each quantity of a table, and the unit of the
+  // benchmarks, from its header.
+  struct table_columns {
+    std::string unit;
+    std::size_t ns_per_op = 0;
+    std::optional<std::size_t> error;
+    std::optional<std::size_t> instructions;
+    std::optional<std::size_t> branches;
+    std::optional<std::size_t> miss_percent;
+  };
+
+  // nanobench names the columns per iteration after the unit of the bench:
+  // ns/op by default, ns/value with .unit("value").
+  std::optional<table_columns>
+  parse_header(std::vector<std::string_view> const& cells)
+  {
+    auto const column =
+      [&](std::string_view title) -> std::optional<std::size_t> {
+      auto const it = std::ranges::find(cells, title);
+      if (it == cells.end())
+        return std::nullopt;
+      return it - cells.begin();
+    };
+    auto const ns = std::ranges::find_if(cells, [](std::string_view c) {
+      return c.starts_with("ns/") && c.size() > 3;
+    });
+    if (ns == cells.end())
+      return std::nullopt;
+    std::string const unit(ns->substr(3));
+    return table_columns{unit,
+                         static_cast<std::size_t>(ns - cells.begin()),
+                         column("err%"),
+                         column("ins/" + unit),
+                         column("bra/" + unit),
+                         column("miss%")};
+  }
+
+  // The name is in backquotes in the last cell, which may be followed by
+  // nanobench's warning about unstable results.
+  std::optional<benchmark_entry>
+  parse_entry(std::vector<std::string_view> const& cells,
+              table_columns const& columns)
+  {
+    if (cells.empty())
+      return std::nullopt;
+    std::string_view const last = cells.back();
+    auto const open = last.find('`');
+    auto const close = last.find('`', open + 1);
+    if (open == std::string_view::npos || close == std::string_view::npos)
+      return std::nullopt;
+    auto const number =
+      [&](std::optional<std::size_t> column) -> std::optional<double> {
+      if (!column || *column >= cells.size())
+        return std::nullopt;
+      return parse_number(cells[*column]);
+    };
+    auto const ns = number(columns.ns_per_op);
+    if (!ns)
+      return std::nullopt;
+    benchmark_entry e;
+    e.name = last.substr(open + 1, close - open - 1);
+    e.unit = columns.unit;
+    e.ns_per_op = *ns;
+    e.noise = number(columns.error).value_or(0.0) / 100.0;
+    e.instructions = number(columns.instructions);
+    auto const branches = number(columns.branches);
+    auto const miss_percent = number(columns.miss_percent);
+    if (branches && miss_percent)
+      e.branch_misses = *branches * *miss_percent / 100.0;
+    return e;
+  }
+
+  std::optional<double>
+  relative_change(std::optional<double> baseline,
+                  std::optional<double> current)
+  {
+    if (!baseline || !current || *baseline <= 0.0)
+      return std::nullopt;
+    return *current / *baseline - 1.0;
+  }
+
+  std::string
+  format_change(std::optional<double> change)
+  {
+    return change ? fmt::format("{:+.1f}%", 100.0 * *change) : "-";
+  }
+
+  char const*
+  verdict_name(verdict v)
+  {
+    switch (v) {
+      case verdict::improved:
+        return "improved";
+      case verdict::regressed:
+        return "REGRESSED";
+      default:
+        return "";
+    }
+  }
+}
+
+std::vector<benchmark_entry>
+read_benchmark_table(std::string const& filename)
+{
+  std::ifstream in(filename);
+  if (!in)
+    throw std::runtime_error("can not open " + filename);
+  auto result = parse_benchmark_tables(in);
+  if (in.bad())
+    throw std::runtime_error("error reading " + filename);
+  return result;
+}
+
+std::vector<benchmark_entry>
+parse_benchmark_tables(std::istream& in)
+{
+  std::vector<benchmark_entry> entries;
+  std::optional<table_columns> columns;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] != '|') {
+      columns.reset();
+      continue;
+    }
+    auto const cells = split_row(line);
+    if (auto const header = parse_header(cells))
+      columns = header;
+    else if (columns) {
+      if (auto const e = parse_entry(cells, *columns))
+        entries.push_back(*e);
+    }
+  }
+  return combine_repeats(entries);
+}
+
+std::vector<benchmark_entry>
+combine_repeats(std::vector<benchmark_entry> const& entries)
+{
+  std::vector<std::string> order;
+  std::map<std::string, std::vector<benchmark_entry const*>> repeats;
+  for (auto const& e : entries) {
+    auto& r = repeats[e.name];
+    if (r.empty())
+      order.push_back(e.name);
+    r.push_back(&e);
+  }
+
+  std::vector<benchmark_entry> result;
+  for (auto const& name : order) {
+    auto const& r = repeats[name];
+    if (r.size() == 1) {
+      result.push_back(*r.front());
+      continue;
+    }
+    auto const values = [&](auto member) {
+      std::vector<double> v;
+      for (auto const* e : r) {
+        v.push_back(e->*member);
+      }
+      return v;
+    };
+    // The median of a counter, if every repeat has it.
+    auto const counter =
+      [&](std::optional<double> benchmark_entry::*member)
+      -> std::optional<double> {
+      std::vector<double> v;
+      for (auto const* e : r) {
+        if (!(e->*member))
+          return std::nullopt;
+        v.push_back(*(e->*member));
+      }
+      return median(v);
+    };
+    benchmark_entry e;
+    e.name = name;
+    e.unit = r.front()->unit;
+    e.ns_per_op = median(values(&benchmark_entry::ns_per_op));
+    std::vector<double> deviations;
+    for (double ns : values(&benchmark_entry::ns_per_op)) {
+      deviations.push_back(std::abs(ns - e.ns_per_op) / e.ns_per_op);
+    }
+    e.noise = std::max(median(values(&benchmark_entry::noise)),
+                       median(deviations));
+    e.instructions = counter(&benchmark_entry::instructions);
+    e.branch_misses = counter(&benchmark_entry::branch_misses);
+    result.push_back(e);
+  }
+  return result;
+}
+
+std::vector<benchmark_comparison>
+compare(std::vector<benchmark_entry> const& baseline,
+        std::vector<benchmark_entry> const& current,
+        comparison_options const& options)
+{
+  std::map<std::string_view, benchmark_entry const*> by_name;
+  for (auto const& e : baseline) {
+    by_name.emplace(e.name, &e);
+  }
+  std::vector<benchmark_comparison> result;
+  for (auto const& e : current) {
+    auto const it = by_name.find(e.name);
+    if (it == by_name.end() || it->second->unit != e.unit ||
+        it->second->ns_per_op <= 0.0)
+      continue;
+    benchmark_entry const& b = *it->second;
+    benchmark_comparison c;
+    c.name = e.name;
+    c.baseline = b;
+    c.current = e;
+    c.time_change = e.ns_per_op / b.ns_per_op - 1.0;
+    c.instructions_change = relative_change(b.instructions, e.instructions);
+    c.branch_misses_change =
+      relative_change(b.branch_misses, e.branch_misses);
+    // Without noise (err% is printed rounded to 0.0%), only the threshold
+    // applies.
+    double const noise = std::hypot(b.noise, e.noise);
+    if (noise > 0.0)
+      c.z = c.time_change / noise;
+    else if (c.time_change != 0.0)
+      c.z = std::copysign(std::numeric_limits<double>::infinity(),
+                          c.time_change);
+    if (std::abs(c.time_change) >= options.threshold &&
+        std::abs(c.z) >= options.sigmas)
+      c.result = c.time_change > 0.0 ? verdict::regressed : verdict::improved;
+    result.push_back(c);
+  }
+  return result;
+}
+
+std::string
+describe(std::vector<benchmark_comparison> const& comparisons)
+{
+  fmt::memory_buffer out;
+  auto it = std::back_inserter(out);
+  fmt::format_to(it,
+                 "| {:>12} | {:>12} | {:>8} | {:>7} | {:>8} | {:>9} | "
+                 "{:>9} | {:>8} | {}\n",
+                 "base ns",
+                 "ns",
+                 "change",
+                 "noise",
+                 "ins",
+                 "misses",
+                 "",
+                 "per",
+                 "benchmark");
+  fmt::format_to(it,
+                 "|-------------:|-------------:|---------:|--------:|"
+                 "---------:|----------:|----------:|---------:|:---\n");
+  std::size_t improved = 0;
+  std::size_t regressed = 0;
+  for (auto const& c : comparisons) {
+    improved += c.result == verdict::improved;
+    regressed += c.result == verdict::regressed;
+    fmt::format_to(
+      it,
+      "| {:>12.2f} | {:>12.2f} | {:>8} | {:>6.1f}% | {:>8} | {:>9} | "
+      "{:>9} | {:>8} | `{}`\n",
+      c.baseline.ns_per_op,
+      c.current.ns_per_op,
+      format_change(c.time_change),
+      100.0 * std::hypot(c.baseline.noise, c.current.noise),
+      format_change(c.instructions_change),
+      format_change(c.branch_misses_change),
+      verdict_name(c.result),
+      c.current.unit,
+      c.name);
+  }
+  fmt::format_to(it,
+                 "{} benchmarks compared: {} improved, {} regressed\n",
+                 comparisons.size(),
+                 improved,
+                 regressed);
+  return fmt::to_string(out);
+}
+
+std::size_t
+count_regressions(std::vector<benchmark_comparison> const& comparisons)
+{
+  return std::ranges::count(
+    comparisons, verdict::regressed, &benchmark_comparison::result);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Comparison of benchmark results with a stored baseline, such as
+// gcc-12-skylake.txt: the markdown tables nanobench prints.
+//
+// Each benchmark is reduced to its median ns/op, instructions/op and branch
+// misses/op (per unit, for benches with a nanobench .unit()), and to the
+// noise of its time: nanobench's err%, the median absolute percent error of
+// ns/op over the epochs of the run. When a benchmark appears several times
+// (as with simphotons_choices -r), the median of the repeats is used, and
+// the noise is the larger of their median err% and the median absolute
+// percent error across the repeats.
+//
+// A change in time is significant when it is larger than both the threshold
+// and 'sigmas' times the combined noise of the two runs,
+// sqrt(noise_baseline^2 + noise_current^2), so that a noisy benchmark needs
+// a larger change to be flagged. Instructions and branch misses are
+// reported, but not tested: they change with the code, not with the noise.
+
+struct benchmark_entry {
+  std::string name;
+  // What an op is: nanobench's unit, "op" unless the bench sets one. The
+  // quantities below are per op.
+  std::string unit = "op";
+  double ns_per_op = 0.0;
+  // Relative noise of ns_per_op (0.01 is 1%).
+  double noise = 0.0;
+  // Absent when the run had no performance counters.
+  std::optional<double> instructions;
+  std::optional<double> branch_misses;
+};
+
+// Read the benchmarks of every nanobench table in a file; other lines are
+// skipped. Repeated benchmarks are combined, in the order of their first
+// appearance. Throws std::runtime_error if the file can not be read.
+std::vector<benchmark_entry> read_benchmark_table(std::string const& filename);
+std::vector<benchmark_entry> parse_benchmark_tables(std::istream& in);
+
+// Combine the repeats of each benchmark, as described above.
+std::vector<benchmark_entry> combine_repeats(
+  std::vector<benchmark_entry> const& entries);
+
+struct comparison_options {
+  double threshold = 0.05; // the smallest relative change in time flagged
+  double sigmas = 3.0;
+};
+
+enum class verdict { unchanged, improved, regressed };
+
+struct benchmark_comparison {
+  std::string name;
+  benchmark_entry baseline;
+  benchmark_entry current;
+  // Relative changes, current / baseline - 1.
+  double time_change = 0.0;
+  std::optional<double> instructions_change;
+  std::optional<double> branch_misses_change;
+  // The time change in units of the combined noise.
+  double z = 0.0;
+  verdict result = verdict::unchanged;
+};
+
+// The benchmarks present in both with the same unit, in the order of
+// 'current'.
+std::vector<benchmark_comparison> compare(
+  std::vector<benchmark_entry> const& baseline,
+  std::vector<benchmark_entry> const& current,
+  comparison_options const& options);
+
+// A markdown table of the comparisons (the times, and the changes in time,
+// instructions/op and branch misses/op), followed by a one-line count of the
+// improvements and regressions.
+std::string describe(std::vector<benchmark_comparison> const& comparisons);
+
+std::size_t count_regressions(
+  std::vector<benchmark_comparison> const& comparisons);
+
+// The entry of one nanobench result (an ankerl::nanobench::Result); a
+// template so that this header does not depend on nanobench.
+template <typename Result>
+benchmark_entry entry_of(Result const& r);
+
+////////////////////////////////////////////
+// Implementation
+
+template <typename Result>
+benchmark_entry
+entry_of(Result const& r)
+{
+  using measure = typename Result::Measure;
+  double const batch = r.config().mBatch;
+  benchmark_entry e;
+  e.name = r.config().mBenchmarkName;
+  e.unit = r.config().mUnit;
+  e.ns_per_op = r.median(measure::elapsed) / batch * 1e9;
+  e.noise = r.medianAbsolutePercentError(measure::elapsed);
+  if (r.has(measure::instructions))
+    e.instructions = r.median(measure::instructions) / batch;
+  if (r.has(measure::branchmisses))
+    e.branch_misses = r.median(measure::branchmisses) / batch;
+  return e;
+}
@@ -0,0 +1,126 @@
+// Check the reading of nanobench tables and the comparison of benchmark
+// runs (see baseline.hh) on sample tables: the default unit with
+// performance counters, a bench with its own unit, a table without
+// counters (as on macOS), repeated benchmarks and nanobench's warning about
+// unstable results.
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+#include "baseline.hh"
+
+namespace {
+  // A run of simphotons_choices -r 2, and of philox_t, with other output
+  // between the tables.
+  char const* const baseline_text =
+    "cpu dispatch: x86-64-v3 (AVX2+FMA)\n"
+    "|               ns/op |                op/s |    err% |          ins/op "
+    "|          cyc/op |    IPC |         bra/op |   miss% |     total | "
+    "simphotons choices\n"
+    "|--------------------:|--------------------:|--------:|----------------:"
+    "|----------------:|-------:|---------------:|--------:|----------:|:----\n"
+    "|           53,156.26 |           18,812.46 |    0.2% |      202,472.05 "
+    "|      111,261.82 |  1.820 |      72,492.05 |    0.6% |     64.12 | "
+    "`sum_map_10000`\n"
+    "|            1,754.10 |          570,092.72 |    0.2% |       17,536.00 "
+    "|        3,674.45 |  4.772 |       2,507.00 |    0.0% |      2.11 | "
+    "`sum_aosv_10000`\n"
+    "|           53,256.26 |           18,812.46 |    0.4% |      202,472.05 "
+    "|      111,261.82 |  1.820 |      72,492.05 |    0.6% |     64.12 | "
+    "`sum_map_10000`\n"
+    "\n"
+    "|            ns/value |             value/s |    err% |       ins/value "
+    "|       cyc/value |    IPC |      bra/value |   miss% |     total | "
+    "synthetic nphots\n"
+    "|--------------------:|--------------------:|--------:|----------------:"
+    "|----------------:|-------:|---------------:|--------:|----------:|:----\n"
+    "|                2.50 |      400,000,000.00 |    1.0% |           20.00 "
+    "|            8.00 |  2.500 |           2.00 |    5.0% |      0.10 | "
+    "`philox_serial`\n";
+
+  char const* const current_text =
+    "|               ns/op |                op/s |    err% |     total | "
+    "simphotons choices\n"
+    "|--------------------:|--------------------:|--------:|----------:|:---\n"
+    "|           60,000.00 |           16,666.67 |    0.3% |     70.00 | "
+    "`sum_map_10000`\n"
+    "|            1,500.00 |          666,666.67 |    6.0% |      2.00 | "
+    ":wavy_dash: `sum_aosv_10000` (Unstable with ~1.0 iters. Increase "
+    "`minEpochIterations` to e.g. 10)\n"
+    "\n"
+    "|            ns/value |             value/s |    err% |       ins/value "
+    "|       cyc/value |    IPC |      bra/value |   miss% |     total | "
+    "synthetic nphots\n"
+    "|--------------------:|--------------------:|--------:|----------------:"
+    "|----------------:|-------:|---------------:|--------:|----------:|:----\n"
+    "|                2.00 |      500,000,000.00 |    0.5% |           16.00 "
+    "|            6.40 |  2.500 |           2.00 |    2.5% |      0.08 | "
+    "`philox_serial`\n";
+
+  std::vector<benchmark_entry>
+  parse(char const* text)
+  {
+    std::istringstream in(text);
+    return parse_benchmark_tables(in);
+  }
+
+  bool
+  near(double a, double b)
+  {
+    return std::abs(a - b) <= 1e-9 * std::abs(b);
+  }
+}
+
+int
+main()
+{
+  auto const baseline = parse(baseline_text);
+  auto const current = parse(current_text);
+
+  // The two runs of sum_map_10000 are combined into their median, and
+  // their spread (0.1% either side) is below the err% of the runs.
+  bool const read =
+    baseline.size() == 3 && baseline[0].name == "sum_map_10000" &&
+    near(baseline[0].ns_per_op, 53'206.26) && near(baseline[0].noise, 0.003) &&
+    baseline[0].instructions && near(*baseline[0].instructions, 202'472.05) &&
+    baseline[0].branch_misses &&
+    near(*baseline[0].branch_misses, 72'492.05 * 0.006) &&
+    baseline[2].name == "philox_serial" && baseline[2].unit == "value" &&
+    near(baseline[2].ns_per_op, 2.5) && baseline[2].instructions &&
+    near(*baseline[2].instructions, 20.0);
+  std::cout << "tables read, with their units: " << read << '\n';
+
+  bool const without_counters =
+    current.size() == 3 && current[1].name == "sum_aosv_10000" &&
+    !current[1].instructions && !current[1].branch_misses &&
+    near(current[1].noise, 0.06) && current[2].unit == "value";
+  std::cout << "tables without counters, and unstable results, read: "
+            << without_counters << '\n';
+
+  // sum_map_10000 is 12.8% slower, well beyond its noise; sum_aosv_10000
+  // 14.5% faster, but less than 3 times its noise of 6%; philox_serial 20%
+  // faster, with 20% fewer instructions and half the misses.
+  auto const comparisons = compare(baseline, current, {});
+  bool const compared =
+    comparisons.size() == 3 && comparisons[0].result == verdict::regressed &&
+    comparisons[1].result == verdict::unchanged &&
+    comparisons[2].result == verdict::improved &&
+    comparisons[2].instructions_change &&
+    near(*comparisons[2].instructions_change, -0.2) &&
+    comparisons[2].branch_misses_change &&
+    near(*comparisons[2].branch_misses_change, -0.5) &&
+    count_regressions(comparisons) == 1;
+  std::cout << "regressions and improvements flagged: " << compared << '\n';
+
+  // A benchmark of the same name in another unit is not compared.
+  auto renamed = current;
+  renamed[2].unit = "count";
+  bool const units = compare(baseline, renamed, {}).size() == 2;
+  std::cout << "different units not compared: " << units << '\n';
+
+  fmt::print("\n{}", describe(comparisons));
+}
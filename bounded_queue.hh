@@ -0,0 +1,108 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// A multi-producer, multi-consumer FIFO queue with a fixed capacity. push
+// blocks while the queue is full, and pop blocks while it is empty, so a
+// fast producer can not run arbitrarily far ahead of its consumers.
+//
+// After close(), push fails and pop drains the remaining items and then
+// returns an empty optional.
+template <typename T>
+class bounded_queue {
+public:
+  explicit bounded_queue(std::size_t capacity);
+
+  // Return false if the queue was closed; the item is then discarded.
+  bool push(T item);
+  std::optional<T> pop();
+  void close();
+
+  // Number of times push or pop had to wait; used to report stalls.
+  std::size_t full_waits() const;
+  std::size_t empty_waits() const;
+
+private:
+  mutable std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  std::size_t capacity_;
+  std::size_t full_waits_ = 0;
+  std::size_t empty_waits_ = 0;
+  bool closed_ = false;
+};
+
+template <typename T>
+bounded_queue<T>::bounded_queue(std::size_t capacity)
+  : capacity_(capacity == 0 ? 1 : capacity)
+{}
+
+template <typename T>
+bool
+bounded_queue<T>::push(T item)
+{
+  std::unique_lock lock(mutex_);
+  if (items_.size() >= capacity_ && !closed_) {
+    ++full_waits_;
+    not_full_.wait(lock,
+                   [this]() { return items_.size() < capacity_ || closed_; });
+  }
+  if (closed_)
+    return false;
+  items_.push_back(std::move(item));
+  lock.unlock();
+  not_empty_.notify_one();
+  return true;
+}
+
+template <typename T>
+std::optional<T>
+bounded_queue<T>::pop()
+{
+  std::unique_lock lock(mutex_);
+  if (items_.empty() && !closed_) {
+    ++empty_waits_;
+    not_empty_.wait(lock, [this]() { return !items_.empty() || closed_; });
+  }
+  if (items_.empty())
+    return std::nullopt;
+  std::optional<T> result(std::move(items_.front()));
+  items_.pop_front();
+  lock.unlock();
+  not_full_.notify_one();
+  return result;
+}
+
+template <typename T>
+void
+bounded_queue<T>::close()
+{
+  {
+    std::lock_guard lock(mutex_);
+    closed_ = true;
+  }
+  not_full_.notify_all();
+  not_empty_.notify_all();
+}
+
+template <typename T>
+std::size_t
+bounded_queue<T>::full_waits() const
+{
+  std::lock_guard lock(mutex_);
+  return full_waits_;
+}
+
+template <typename T>
+std::size_t
+bounded_queue<T>::empty_waits() const
+{
+  std::lock_guard lock(mutex_);
+  return empty_waits_;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "data_structures.hh"
+#include "recycling_map.hh"
+
+////////////////////////////////////////////
+// Capacity handling for each kind of channel container.
+//
+// Containers with a trim() (recycling_map, which releases spare nodes, and
+// flat_int_map, which rehashes into smaller slot arrays) use it; those with
+// reserve(), capacity() and swap() (the vector-based layouts) are trimmed by
+// swapping in a smaller buffer. Deques and lists have no separate capacity
+// to keep.
+namespace pool_detail {
+  template <typename C>
+  std::size_t
+  capacity_of(C const& c) noexcept
+  {
+    if constexpr (requires { c.capacity(); })
+      return c.capacity();
+    else
+      return 0;
+  }
+
+  template <typename C>
+  void
+  trim_to(C& c, std::size_t n)
+  {
+    if constexpr (requires { c.trim(n); }) {
+      c.trim(n);
+    } else if constexpr (requires {
+                           c.reserve(n);
+                           c.capacity();
+                           c.swap(c);
+                         }) {
+      if (c.capacity() > n) {
+        C tmp;
+        tmp.reserve(n);
+        c.swap(tmp);
+      }
+    }
+  }
+
+  template <typename S>
+  std::size_t
+  capacity_of_channel(S const& s) noexcept
+  {
+    if constexpr (soa_layout<S>)
+      return capacity_of(s.ticks);
+    else
+      return capacity_of(s);
+  }
+
+  template <typename S>
+  std::size_t
+  size_of_channel(S const& s) noexcept
+  {
+    if constexpr (soa_layout<S>)
+      return std::ranges::distance(s.nphots);
+    else if constexpr (requires { s.size(); })
+      return s.size();
+    else
+      return std::ranges::distance(s);
+  }
+
+  // 's' has been cleared.
+  template <typename S>
+  void
+  trim_channel(S& s, std::size_t n)
+  {
+    if constexpr (soa_layout<S>) {
+      trim_to(s.ticks, n);
+      trim_to(s.nphots, n);
+    } else {
+      trim_to(s, n);
+    }
+  }
+}
+
+// channel_pool hands out channel containers of type S, keeping the capacity
+// they had when they were returned, so that per-event processing does not pay
+// for allocation and page faults again in every event.
+//
+// The pool records the sizes of the last 'history' containers returned to it.
+// A returned container whose capacity exceeds 'slack' times the largest of
+// those sizes (the high-water mark) is trimmed to the high-water mark, so
+// that one unusually large event does not pin its memory forever.
+//
+// acquire() and the release done by the handle's destructor may be called
+// concurrently from several threads. The pool must outlive all its handles.
+template <typename S>
+class channel_pool {
+public:
+  struct returner {
+    channel_pool* pool;
+    void operator()(S* s) const noexcept;
+  };
+  using handle = std::unique_ptr<S, returner>;
+
+  explicit channel_pool(std::size_t history = 64, double slack = 2.0);
+
+  // Return an empty container, reusing a returned one if there is one.
+  handle acquire();
+
+  // Number of containers waiting for reuse.
+  std::size_t cached() const;
+
+private:
+  void release(S* s) noexcept;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<S>> free_;
+  std::vector<std::size_t> recent_sizes_;
+  std::size_t next_recent_ = 0;
+  double slack_;
+};
+
+template <typename S>
+void
+channel_pool<S>::returner::operator()(S* s) const noexcept
+{
+  pool->release(s);
+}
+
+template <typename S>
+channel_pool<S>::channel_pool(std::size_t history, double slack)
+  : recent_sizes_(std::max<std::size_t>(history, 1), 0), slack_(slack)
+{}
+
+template <typename S>
+typename channel_pool<S>::handle
+channel_pool<S>::acquire()
+{
+  std::unique_ptr<S> s;
+  {
+    std::lock_guard lock(mutex_);
+    if (!free_.empty()) {
+      s = std::move(free_.back());
+      free_.pop_back();
+    }
+  }
+  if (!s)
+    s = std::make_unique<S>();
+  return handle(s.release(), returner{this});
+}
+
+template <typename S>
+std::size_t
+channel_pool<S>::cached() const
+{
+  std::lock_guard lock(mutex_);
+  return free_.size();
+}
+
+template <typename S>
+void
+channel_pool<S>::release(S* raw) noexcept
+{
+  std::unique_ptr<S> s(raw);
+  std::size_t const used = pool_detail::size_of_channel(*s);
+  s->clear();
+
+  std::size_t high_water_mark = 0;
+  {
+    std::lock_guard lock(mutex_);
+    recent_sizes_[next_recent_] = used;
+    next_recent_ = (next_recent_ + 1) % recent_sizes_.size();
+    high_water_mark = std::ranges::max(recent_sizes_);
+  }
+
+  // Trimming may allocate; if that fails we just keep the larger buffer.
+  if (pool_detail::capacity_of_channel(*s) > slack_ * high_water_mark) {
+    try {
+      pool_detail::trim_channel(*s, high_water_mark);
+    }
+    catch (...) {
+    }
+  }
+
+  std::lock_guard lock(mutex_);
+  try {
+    free_.push_back(std::move(s));
+  }
+  catch (...) {
+    // Could not grow the free list; the container is destroyed instead.
+  }
+}
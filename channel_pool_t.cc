@@ -0,0 +1,107 @@
+// Benchmark the steady-state cost of filling the channels of one event, with
+// containers from a channel_pool against freshly constructed containers.
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "nanobench.h"
+
+#include "channel_pool.hh"
+#include "data_structures.hh"
+#include "fill_functions.hh"
+#include "flat_int_map.hh"
+#include "operations.hh"
+#include "recycling_map.hh"
+
+// Number of measurements in each channel of an event; log-uniform between 1
+// and 10,000, like the nmeas distribution of the physics validation sample.
+std::vector<std::size_t>
+make_event(std::size_t n_channels, unsigned long long seed)
+{
+  std::minstd_rand0 engine(seed);
+  std::uniform_real_distribution<double> dist{0.0, 4.0};
+  std::vector<std::size_t> sizes(n_channels);
+  for (auto& n : sizes) {
+    n = static_cast<std::size_t>(std::pow(10.0, dist(engine)));
+  }
+  return sizes;
+}
+
+// Each channel is kept until the end of the event, as in production.
+template <typename S>
+void
+run_fresh(ankerl::nanobench::Bench* bench,
+          std::vector<std::vector<std::size_t>> const& events,
+          std::string const& name)
+{
+  std::size_t i = 0;
+  int total = 0;
+  bench->run("fresh_" + name, [&]() {
+    std::vector<S> channels(events[i].size());
+    for (std::size_t c = 0; c != channels.size(); ++c) {
+      fill(channels[c], events[i][c]);
+      total += sum(channels[c]);
+    }
+    i = (i + 1) % events.size();
+  });
+  ankerl::nanobench::doNotOptimizeAway(total);
+}
+
+template <typename S>
+void
+run_pooled(ankerl::nanobench::Bench* bench,
+           std::vector<std::vector<std::size_t>> const& events,
+           std::string const& name)
+{
+  channel_pool<S> pool;
+  std::size_t i = 0;
+  int total = 0;
+  auto process_event = [&]() {
+    std::vector<typename channel_pool<S>::handle> channels;
+    channels.reserve(events[i].size());
+    for (std::size_t n : events[i]) {
+      channels.push_back(pool.acquire());
+      fill(*channels.back(), n);
+      total += sum(*channels.back());
+    }
+    i = (i + 1) % events.size();
+  };
+  // Reach the steady state before measuring.
+  for (std::size_t e = 0; e != events.size(); ++e) {
+    process_event();
+  }
+  bench->run("pool_" + name, process_event);
+  ankerl::nanobench::doNotOptimizeAway(total);
+}
+
+int
+main()
+{
+  ankerl::nanobench::Bench b;
+  b.title("channel recycling")
+    .unit("event")
+    .performanceCounters(true)
+    .minEpochIterations(20);
+
+  std::size_t const n_channels = 200;
+  std::vector<std::vector<std::size_t>> events;
+  for (unsigned long long seed = 1; seed != 9; ++seed) {
+    events.push_back(make_event(n_channels, seed));
+  }
+
+  run_fresh<soa_vector>(&b, events, "soav");
+  run_pooled<soa_vector>(&b, events, "soav");
+  run_fresh<aos_vector>(&b, events, "aosv");
+  run_pooled<aos_vector>(&b, events, "aosv");
+  run_fresh<std::map<int, int>>(&b, events, "map");
+  run_pooled<recycling_map<std::map<int, int>>>(&b, events, "map");
+  run_fresh<std::unordered_map<int, int>>(&b, events, "hashmap");
+  run_pooled<recycling_map<std::unordered_map<int, int>>>(
+    &b, events, "hashmap");
+  run_fresh<flat_int_map>(&b, events, "flatmap");
+  run_pooled<flat_int_map>(&b, events, "flatmap");
+}
@@ -0,0 +1,154 @@
+// Benchmark the fused channel_summary against the same statistics computed
+// in separate passes (sum, find_largest, and one loop for each of the
+// others), for every registered layout; and event_summary over an event of
+// many channels, serially and in parallel. Also checks that the fused kernel
+// gives exactly the results of the separate passes.
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "fill_functions.hh"
+#include "layout_registry.hh"
+#include "operations.hh"
+
+// Call f(tick, nphots) for every measurement, and for the gaps of a dense
+// hybrid_channel, which hold 0.
+template <typename S>
+void
+for_each_measurement(S const& s, auto&& f)
+{
+  if constexpr (is_summarized_channel<S>) {
+    for_each_measurement(s.channel(), f);
+  } else if constexpr (record_layout<S>) {
+    for (auto const& p : s) {
+      f(p.first, p.second);
+    }
+  } else if constexpr (soa_layout<S>) {
+    auto i_ticks = s.ticks.begin();
+    for (int v : s.nphots) {
+      f(*i_ticks++, v);
+    }
+  } else if constexpr (std::is_same_v<S, hybrid_channel>) {
+    auto const& nphots = s.nphots();
+    for (std::size_t i = 0; i != nphots.size(); ++i) {
+      f(s.is_dense() ? s.tick_min() + static_cast<int>(i) : s.ticks()[i],
+        nphots[i]);
+    }
+  } else {
+    for (std::size_t i = 0; i != s.values().size(); ++i) {
+      if (s.keys()[i] != flat_int_map::empty_key)
+        f(s.keys()[i], s.values()[i]);
+    }
+  }
+}
+
+template <typename S>
+summary_t
+separate_passes(S const& s, int threshold)
+{
+  summary_t r;
+  r.total = sum(s);
+  r.peak = find_largest(s);
+  if constexpr (std::is_same_v<S, hybrid_channel>)
+    r.measurements = s.size();
+  else
+    for_each_measurement(s, [&](int, int) { ++r.measurements; });
+  for_each_measurement(s, [&](int, int v) { r.above += v > threshold; });
+  for_each_measurement(s, [&](int t, int) {
+    r.first_tick = std::min(r.first_tick, t);
+    r.last_tick = std::max(r.last_tick, t);
+  });
+  long long weighted = 0;
+  for_each_measurement(
+    s, [&](int t, int v) { weighted += static_cast<long long>(t) * v; });
+  if (r.total != 0)
+    r.mean_time = static_cast<double>(weighted) / r.total;
+  return r;
+}
+
+bool
+same_summary(summary_t const& a, summary_t const& b)
+{
+  return a.measurements == b.measurements && a.total == b.total &&
+         a.peak.key == b.peak.key && a.peak.value == b.peak.value &&
+         a.above == b.above && a.first_tick == b.first_tick &&
+         a.last_tick == b.last_tick && a.mean_time == b.mean_time;
+}
+
+template <typename S>
+void
+run_layout(ankerl::nanobench::Bench* bench,
+           std::size_t n,
+           summary_options const& options,
+           char const* name)
+{
+  S s;
+  fill(s, n);
+  bool const matches = same_summary(channel_summary(s, options),
+                                    separate_passes(s, options.threshold));
+  std::cout << name << ": fused matches separate passes: " << matches << '\n';
+
+  summary_t r;
+  bench->run(fmt::format("separate_{}", name),
+             [&]() { r = separate_passes(s, options.threshold); });
+  bench->run(fmt::format("fused_{}", name),
+             [&]() { r = channel_summary(s, options); });
+  summary_options peak_only = options;
+  peak_only.fields = summary_total | summary_peak;
+  bench->run(fmt::format("fused_sum_peak_{}", name),
+             [&]() { r = channel_summary(s, peak_only); });
+  ankerl::nanobench::doNotOptimizeAway(r);
+}
+
+int
+main()
+{
+  std::size_t const n = 10000;
+  std::size_t const nthreads =
+    std::max(1u, std::thread::hardware_concurrency());
+  summary_options const options{summary_all, 5000};
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+
+  ankerl::nanobench::Bench b;
+  b.title("channel summary").unit("measurement").batch(n);
+  b.minEpochIterations(100);
+  for_each_layout([&](auto const& r) {
+    run_layout<typename std::remove_cvref_t<decltype(r)>::type>(
+      &b, n, options, r.name);
+  });
+
+  // An event of many small channels, as in the detector.
+  std::size_t const nchannels = 4096;
+  std::size_t const per_channel = 1000;
+  std::vector<soa_vector> event(nchannels);
+  for (auto& c : event) {
+    fill(c, per_channel);
+  }
+  std::span<soa_vector const> const channels(event);
+  bool const same = [&]() {
+    auto const serial = event_summary(channels, options, 1);
+    auto const parallel = event_summary(channels, options, nthreads);
+    auto const odd = event_summary(channels, options, 7);
+    return std::ranges::equal(serial, parallel, same_summary) &&
+           std::ranges::equal(serial, odd, same_summary);
+  }();
+  std::cout << "event_summary, 1, 7 and " << nthreads
+            << " threads give identical output: " << same << '\n';
+
+  b.batch(nchannels * per_channel).minEpochIterations(5);
+  std::vector<summary_t> result;
+  b.run("event_soav_1",
+        [&]() { result = event_summary(channels, options, 1); });
+  b.run(fmt::format("event_soav_{}", nthreads),
+        [&]() { result = event_summary(channels, options, nthreads); });
+  ankerl::nanobench::doNotOptimizeAway(result.data());
+}
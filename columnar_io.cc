@@ -0,0 +1,673 @@
+#include "columnar_io.hh"
+#include "bounded_queue.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <lzma.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::size_t
+int_table::rows() const noexcept
+{
+  return columns.empty() ? 0 : columns.front().size();
+}
+
+std::vector<int> const&
+int_table::column(std::string_view name) const
+{
+  auto const it = std::ranges::find(names, name);
+  if (it == names.end())
+    throw std::out_of_range("no column named " + std::string(name));
+  return columns[it - names.begin()];
+}
+
+namespace {
+
+  ////////////////////////////////////////////
+  // Part 1: Sources of text.
+  //
+  // A chunk is a piece of the file that ends at the end of a line. It either
+  // owns its text (decompressed data) or refers into a memory-mapped file.
+  // The storage is on the heap so that 'text' survives moving the chunk.
+  struct chunk {
+    std::size_t index = 0;
+    std::unique_ptr<std::string> storage;
+    std::string_view text;
+  };
+
+  // Produce the chunks of a file through 'emit', which returns false when the
+  // consumers have stopped. The header, if any, is part of the first chunk.
+  using emit_fn = std::function<bool(chunk)>;
+
+  class mapped_file {
+  public:
+    explicit mapped_file(std::filesystem::path const& filename);
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+    ~mapped_file();
+    std::string_view text() const noexcept;
+
+  private:
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+  };
+
+  mapped_file::mapped_file(std::filesystem::path const& filename)
+  {
+    int const fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("can not open " + filename.string());
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::runtime_error("can not stat " + filename.string());
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ != 0) {
+      data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data_ == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("can not map " + filename.string());
+      }
+      madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+  }
+
+  mapped_file::~mapped_file()
+  {
+    if (data_ != nullptr)
+      munmap(data_, size_);
+  }
+
+  std::string_view
+  mapped_file::text() const noexcept
+  {
+    return {static_cast<char const*>(data_), size_};
+  }
+
+  // Split mapped text into chunks of about chunk_bytes, without copying.
+  void
+  split_mapped(std::string_view text, std::size_t chunk_bytes, emit_fn emit)
+  {
+    std::size_t index = 0;
+    while (!text.empty()) {
+      std::size_t end = std::min(chunk_bytes, text.size());
+      if (end != text.size()) {
+        auto const nl = text.find('\n', end - 1);
+        end = (nl == std::string_view::npos) ? text.size() : nl + 1;
+      }
+      if (!emit(chunk{index++, {}, text.substr(0, end)}))
+        return;
+      text.remove_prefix(end);
+    }
+  }
+
+  // Sequential decompression of an xz file.
+  class xz_reader {
+  public:
+    explicit xz_reader(std::filesystem::path const& filename);
+    xz_reader(xz_reader const&) = delete;
+    xz_reader& operator=(xz_reader const&) = delete;
+    ~xz_reader();
+
+    // Decompress up to n bytes into 'out'. Return the number of bytes
+    // written, which is less than n only at the end of the stream.
+    std::size_t read(char* out, std::size_t n);
+
+  private:
+    std::filesystem::path filename_;
+    std::ifstream in_;
+    lzma_stream strm_ = LZMA_STREAM_INIT;
+    std::vector<std::uint8_t> input_;
+    lzma_action action_ = LZMA_RUN;
+    bool done_ = false;
+  };
+
+  xz_reader::xz_reader(std::filesystem::path const& filename)
+    : filename_(filename), in_(filename, std::ios::binary)
+  {
+    if (!in_)
+      throw std::runtime_error("can not open " + filename.string());
+    if (lzma_stream_decoder(&strm_, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+      throw std::runtime_error("can not initialize the xz decoder");
+    input_.resize(std::size_t{1} << 20);
+  }
+
+  xz_reader::~xz_reader()
+  {
+    lzma_end(&strm_);
+  }
+
+  std::size_t
+  xz_reader::read(char* out, std::size_t n)
+  {
+    if (done_)
+      return 0;
+    strm_.next_out = reinterpret_cast<std::uint8_t*>(out);
+    strm_.avail_out = n;
+    while (strm_.avail_out != 0) {
+      if (strm_.avail_in == 0 && action_ == LZMA_RUN) {
+        in_.read(reinterpret_cast<char*>(input_.data()), input_.size());
+        strm_.next_in = input_.data();
+        strm_.avail_in = static_cast<std::size_t>(in_.gcount());
+        if (in_.eof())
+          action_ = LZMA_FINISH;
+        else if (!in_)
+          throw std::runtime_error("error reading " + filename_.string());
+      }
+      lzma_ret const ret = lzma_code(&strm_, action_);
+      if (ret == LZMA_STREAM_END) {
+        done_ = true;
+        break;
+      }
+      if (ret != LZMA_OK)
+        throw std::runtime_error("xz error " + std::to_string(ret) + " in " +
+                                 filename_.string());
+    }
+    return n - strm_.avail_out;
+  }
+
+  // Decompress an xz file, emitting chunks of about chunk_bytes.
+  void
+  split_xz(std::filesystem::path const& filename,
+           std::size_t chunk_bytes,
+           emit_fn emit)
+  {
+    xz_reader xz(filename);
+    std::string carry;
+    std::size_t index = 0;
+    bool done = false;
+    while (!done) {
+      // The text carried over from the previous chunk starts this one.
+      std::string buffer(std::move(carry));
+      std::size_t used = buffer.size();
+      buffer.resize(std::max(chunk_bytes, used + (std::size_t{1} << 16)));
+      std::size_t const wanted = buffer.size() - used;
+      std::size_t const got = xz.read(buffer.data() + used, wanted);
+      done = got < wanted;
+      used += got;
+      buffer.resize(used);
+
+      std::size_t end = used;
+      if (!done) {
+        auto const nl = buffer.rfind('\n');
+        end = (nl == std::string::npos) ? 0 : nl + 1;
+      }
+      carry.assign(buffer, end, std::string::npos);
+      buffer.resize(end);
+      if (!buffer.empty()) {
+        auto storage = std::make_unique<std::string>(std::move(buffer));
+        std::string_view const text = *storage;
+        chunk c{index++, std::move(storage), text};
+        if (!emit(std::move(c)))
+          return;
+      }
+    }
+  }
+
+  ////////////////////////////////////////////
+  // Part 2: Parsing.
+
+  bool
+  is_number_start(char c) noexcept
+  {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+';
+  }
+
+  std::vector<std::string>
+  split_header(std::string_view line)
+  {
+    std::vector<std::string> names;
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
+      line.remove_suffix(1);
+    }
+    std::size_t start = 0;
+    while (true) {
+      auto const tab = line.find('\t', start);
+      names.emplace_back(line.substr(start, tab - start));
+      if (tab == std::string_view::npos)
+        break;
+      start = tab + 1;
+    }
+    return names;
+  }
+
+  // 'where' describes the position for the message, e.g. "in chunk 3".
+  [[noreturn]] void
+  format_error(std::string const& where, char const* line, char const* end)
+  {
+    std::string_view text(line, end - line);
+    throw std::runtime_error("bad line " + where + ": '" +
+                             std::string(text.substr(0, text.find('\n'))) +
+                             "'");
+  }
+
+  // Parse one line of ncols tab-separated integers starting at p, passing
+  // each to sink(column, value). Return the start of the next line, or
+  // nullptr if the line is malformed.
+  template <typename Sink>
+  char const*
+  parse_line(char const* p, char const* end, std::size_t ncols, Sink&& sink)
+  {
+    for (std::size_t col = 0; col != ncols; ++col) {
+      int value = 0;
+      if (p != end && *p == '+')
+        ++p;
+      auto const [next, ec] = std::from_chars(p, end, value);
+      if (ec != std::errc())
+        return nullptr;
+      sink(col, value);
+      p = next;
+      char const expected = (col + 1 == ncols) ? '\n' : '\t';
+      if (p != end && *p == '\r' && expected == '\n')
+        ++p;
+      if (p == end && expected == '\n')
+        return p;
+      if (p == end || *p != expected)
+        return nullptr;
+      ++p;
+    }
+    return p;
+  }
+
+  bool
+  is_blank_line(char c) noexcept
+  {
+    return c == '\n' || c == '\r';
+  }
+
+  char const*
+  skip_line(char const* p, char const* end) noexcept
+  {
+    p = std::find(p, end, '\n');
+    return p + (p != end);
+  }
+
+  // Parse all the lines of 'text', each with exactly ncols integers.
+  std::vector<std::vector<int>>
+  parse_chunk(std::string_view text, std::size_t ncols, std::size_t index)
+  {
+    // Estimate the number of rows, to avoid most reallocations.
+    std::size_t const guess = text.size() / (3 * ncols + 1) + 1;
+    std::vector<std::vector<int>> columns(ncols);
+    for (auto& c : columns) {
+      c.reserve(guess);
+    }
+
+    char const* p = text.data();
+    char const* const end = p + text.size();
+    auto sink = [&](std::size_t col, int value) {
+      columns[col].push_back(value);
+    };
+    while (p != end) {
+      if (is_blank_line(*p)) {
+        p = skip_line(p, end);
+        continue;
+      }
+      char const* const next = parse_line(p, end, ncols, sink);
+      if (next == nullptr)
+        format_error("in chunk " + std::to_string(index), p, end);
+      p = next;
+    }
+    return columns;
+  }
+
+  // Concatenate the per-chunk columns, in chunk order.
+  std::vector<std::vector<int>>
+  concatenate(std::vector<std::vector<std::vector<int>>>& parsed,
+              std::size_t ncols,
+              std::size_t nthreads)
+  {
+    std::vector<std::size_t> offsets(parsed.size() + 1, 0);
+    for (std::size_t i = 0; i != parsed.size(); ++i) {
+      offsets[i + 1] = offsets[i] + parsed[i].front().size();
+    }
+    std::vector<std::vector<int>> columns(ncols);
+    for (auto& c : columns) {
+      c.resize(offsets.back());
+    }
+    nthreads = std::max<std::size_t>(1, std::min(nthreads, parsed.size()));
+    parallel_for(nthreads, [&](std::size_t t) {
+      auto const [begin, end] = static_partition(parsed.size(), nthreads, t);
+      for (std::size_t i = begin; i != end; ++i) {
+        for (std::size_t col = 0; col != ncols; ++col) {
+          std::ranges::copy(parsed[i][col], columns[col].begin() + offsets[i]);
+        }
+        parsed[i] = {};
+      }
+    });
+    return columns;
+  }
+
+  bool
+  ends_with(std::filesystem::path const& filename, std::string_view suffix)
+  {
+    return filename.string().ends_with(suffix);
+  }
+
+  void
+  check_columns(int_table const& table,
+                std::vector<std::string> const& expected,
+                std::filesystem::path const& filename)
+  {
+    if (table.names != expected)
+      throw std::runtime_error(filename.string() +
+                               " does not have the expected columns");
+  }
+}
+
+////////////////////////////////////////////
+// Part 3: The public interface.
+
+int_table
+read_tsv(std::filesystem::path const& filename,
+         std::vector<std::string> const& default_names,
+         tsv_options const& options)
+{
+  std::size_t const nthreads = std::max<std::size_t>(1, options.nthreads);
+  bounded_queue<chunk> queue(2 * nthreads);
+
+  // The first chunk is parsed here, to find the header and the number of
+  // columns, before the parsing threads start.
+  int_table table;
+  std::size_t ncols = 0;
+  std::mutex results_mutex;
+  std::vector<std::vector<std::vector<int>>> parsed;
+  std::exception_ptr error;
+
+  auto store = [&](std::size_t index, std::vector<std::vector<int>> columns) {
+    std::lock_guard lock(results_mutex);
+    if (parsed.size() <= index)
+      parsed.resize(index + 1);
+    parsed[index] = std::move(columns);
+  };
+  auto fail = [&](std::exception_ptr e) {
+    {
+      std::lock_guard lock(results_mutex);
+      if (!error)
+        error = e;
+    }
+    queue.close();
+  };
+
+  // The workers may refer to the mapping, so it must outlive them.
+  std::optional<mapped_file> mapping;
+  std::vector<std::jthread> workers;
+  auto start_workers = [&]() {
+    for (std::size_t t = 0; t != nthreads; ++t) {
+      workers.emplace_back([&]() {
+        while (auto c = queue.pop()) {
+          try {
+            store(c->index, parse_chunk(c->text, ncols, c->index));
+          }
+          catch (...) {
+            fail(std::current_exception());
+          }
+        }
+      });
+    }
+  };
+
+  bool first = true;
+  auto emit = [&](chunk c) {
+    if (first) {
+      first = false;
+      std::string_view text = c.text;
+      if (!text.empty() && !is_number_start(text.front())) {
+        auto const nl = text.find('\n');
+        table.names = split_header(text.substr(0, nl));
+        text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+      } else {
+        table.names = default_names;
+      }
+      ncols = table.names.size();
+      if (ncols == 0)
+        throw std::runtime_error(filename.string() +
+                                 " has no header and no column names given");
+      c.text = text;
+      start_workers();
+    }
+    return queue.push(std::move(c));
+  };
+
+  try {
+    if (ends_with(filename, ".xz")) {
+      split_xz(filename, options.chunk_bytes, emit);
+    } else {
+      mapping.emplace(filename);
+      split_mapped(mapping->text(), options.chunk_bytes, emit);
+    }
+  }
+  catch (...) {
+    fail(std::current_exception());
+  }
+  queue.close();
+  workers.clear();
+  if (error)
+    std::rethrow_exception(error);
+
+  if (parsed.empty()) {
+    if (first)
+      table.names = default_names;
+    table.columns.resize(table.names.size());
+    return table;
+  }
+  for (auto& p : parsed) {
+    if (p.empty())
+      p.resize(ncols);
+  }
+  table.columns = concatenate(parsed, ncols, nthreads);
+  return table;
+}
+
+int_table
+read_measurements(std::filesystem::path const& filename,
+                  tsv_options const& options)
+{
+  auto table = read_table(filename, measurement_columns, options);
+  check_columns(table, measurement_columns, filename);
+  return table;
+}
+
+int_table
+read_channels(std::filesystem::path const& filename, tsv_options const& options)
+{
+  auto table = read_table(filename, channel_columns, options);
+  check_columns(table, channel_columns, filename);
+  return table;
+}
+
+// The unread text is either the rest of a mapped file, or the rest of a
+// buffer of decompressed text that is refilled as needed.
+struct tsv_row_reader::impl {
+  std::filesystem::path filename;
+  std::optional<mapped_file> mapping;
+  std::optional<xz_reader> xz;
+  std::string buffer;
+  std::string_view text;
+  bool at_end = false;
+  std::size_t line_number = 0;
+  std::vector<std::string> names;
+
+  // Make 'text' start with a complete line, or hold all the remaining text.
+  // Return false if there is no text left.
+  bool fill_line();
+};
+
+bool
+tsv_row_reader::impl::fill_line()
+{
+  while (!at_end && text.find('\n') == std::string_view::npos) {
+    if (!xz) {
+      at_end = true;
+      break;
+    }
+    std::size_t const block = std::size_t{1} << 20;
+    std::size_t const kept = text.size();
+    // 'text' may point into 'buffer', so move it to the front first.
+    if (kept != 0)
+      std::memmove(buffer.data(), text.data(), kept);
+    buffer.resize(kept + block);
+    std::size_t const got = xz->read(buffer.data() + kept, block);
+    at_end = got < block;
+    buffer.resize(kept + got);
+    text = buffer;
+  }
+  return !text.empty();
+}
+
+tsv_row_reader::tsv_row_reader(std::filesystem::path const& filename,
+                               std::vector<std::string> const& default_names)
+  : impl_(std::make_unique<impl>())
+{
+  impl_->filename = filename;
+  if (ends_with(filename, ".xz")) {
+    impl_->xz.emplace(filename);
+  } else {
+    impl_->mapping.emplace(filename);
+    impl_->text = impl_->mapping->text();
+  }
+  auto& text = impl_->text;
+  if (impl_->fill_line() && !is_number_start(text.front())) {
+    auto const nl = text.find('\n');
+    impl_->names = split_header(text.substr(0, nl));
+    text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+    impl_->line_number = 1;
+  } else {
+    impl_->names = default_names;
+  }
+  if (impl_->names.empty())
+    throw std::runtime_error(filename.string() +
+                             " has no header and no column names given");
+}
+
+tsv_row_reader::tsv_row_reader(tsv_row_reader&&) noexcept = default;
+tsv_row_reader& tsv_row_reader::operator=(tsv_row_reader&&) noexcept = default;
+tsv_row_reader::~tsv_row_reader() = default;
+
+std::vector<std::string> const&
+tsv_row_reader::names() const noexcept
+{
+  return impl_->names;
+}
+
+bool
+tsv_row_reader::next(std::span<int> row)
+{
+  auto& d = *impl_;
+  while (d.fill_line()) {
+    char const* const begin = d.text.data();
+    char const* const end = begin + d.text.size();
+    ++d.line_number;
+    if (is_blank_line(*begin)) {
+      d.text.remove_prefix(skip_line(begin, end) - begin);
+      continue;
+    }
+    char const* const next = parse_line(
+      begin, end, d.names.size(), [&](std::size_t col, int value) {
+        row[col] = value;
+      });
+    if (next == nullptr)
+      format_error("at line " + std::to_string(d.line_number) + " of " +
+                     d.filename.string(),
+                   begin,
+                   end);
+    d.text.remove_prefix(next - begin);
+    return true;
+  }
+  return false;
+}
+
+namespace {
+  char const columnar_magic[8] = {'D', 'U', 'N', 'E', 'C', 'O', 'L', '1'};
+
+  void
+  write_u64(std::ofstream& out, std::uint64_t v)
+  {
+    out.write(reinterpret_cast<char const*>(&v), sizeof(v));
+  }
+
+  std::uint64_t
+  read_u64(std::ifstream& in)
+  {
+    std::uint64_t v = 0;
+    in.read(reinterpret_cast<char*>(&v), sizeof(v));
+    return v;
+  }
+}
+
+void
+write_columnar(int_table const& table, std::filesystem::path const& filename)
+{
+  static_assert(std::endian::native == std::endian::little);
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    throw std::runtime_error("can not create " + filename.string());
+  out.write(columnar_magic, sizeof(columnar_magic));
+  write_u64(out, table.columns.size());
+  write_u64(out, table.rows());
+  for (auto const& name : table.names) {
+    write_u64(out, name.size());
+    out.write(name.data(), name.size());
+  }
+  for (auto const& c : table.columns) {
+    out.write(reinterpret_cast<char const*>(c.data()), c.size() * sizeof(int));
+  }
+  if (!out)
+    throw std::runtime_error("error writing " + filename.string());
+}
+
+int_table
+read_columnar(std::filesystem::path const& filename)
+{
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("can not open " + filename.string());
+  char magic[sizeof(columnar_magic)];
+  in.read(magic, sizeof(magic));
+  if (!in || std::memcmp(magic, columnar_magic, sizeof(magic)) != 0)
+    throw std::runtime_error(filename.string() + " is not a columnar file");
+  int_table table;
+  std::uint64_t const ncols = read_u64(in);
+  std::uint64_t const nrows = read_u64(in);
+  for (std::uint64_t i = 0; i != ncols; ++i) {
+    std::string name(read_u64(in), '\0');
+    in.read(name.data(), name.size());
+    table.names.push_back(std::move(name));
+  }
+  table.columns.resize(ncols);
+  for (auto& c : table.columns) {
+    c.resize(nrows);
+    in.read(reinterpret_cast<char*>(c.data()), nrows * sizeof(int));
+  }
+  if (!in)
+    throw std::runtime_error("error reading " + filename.string());
+  return table;
+}
+
+int_table
+read_table(std::filesystem::path const& filename,
+           std::vector<std::string> const& default_names,
+           tsv_options const& options)
+{
+  if (ends_with(filename, ".col"))
+    return read_columnar(filename);
+  return read_tsv(filename, default_names, options);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Loading of the measurement and channel files produced by the physics
+// validation jobs, which functions.R reads with read_measurement_data and
+// read_channel_data:
+//
+//   measurements*.tsv[.xz]: run subrun event channel time nphot
+//   channels*.tsv[.xz]:     run subrun event channel nmeas
+//
+// All the columns are integers, so a file is loaded as an int_table: one
+// std::vector<int> per column.
+
+struct int_table {
+  std::vector<std::string> names;
+  std::vector<std::vector<int>> columns;
+
+  std::size_t rows() const noexcept;
+  // Throws std::out_of_range if there is no column with the given name.
+  std::vector<int> const& column(std::string_view name) const;
+};
+
+inline std::vector<std::string> const measurement_columns = {
+  "run", "subrun", "event", "channel", "time", "nphot"};
+inline std::vector<std::string> const channel_columns = {
+  "run", "subrun", "event", "channel", "nmeas"};
+
+struct tsv_options {
+  // Number of parsing threads; decompression uses one more.
+  std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+  // Size of the text chunks handed to the parsing threads.
+  std::size_t chunk_bytes = std::size_t{8} << 20;
+};
+
+// Read a tab-separated file of integers, compressed with xz if its name ends
+// in ".xz". A first line that does not start with a number is taken as the
+// header; otherwise 'default_names' names the columns.
+//
+// One thread reads (and decompresses) the file while the others parse text
+// chunks with std::from_chars into per-chunk columns; uncompressed files are
+// memory-mapped and parsed in place. Throws std::runtime_error on I/O or
+// format errors.
+int_table read_tsv(std::filesystem::path const& filename,
+                   std::vector<std::string> const& default_names = {},
+                   tsv_options const& options = {});
+
+// read_tsv, checking the columns are those of a measurement or channel file.
+int_table read_measurements(std::filesystem::path const& filename,
+                            tsv_options const& options = {});
+int_table read_channels(std::filesystem::path const& filename,
+                        tsv_options const& options = {});
+
+// Sequential reading of a tab-separated file (compressed with xz if its name
+// ends in ".xz"), one row at a time, for consumers that need bounded memory
+// rather than the whole table. The header is handled as by read_tsv.
+class tsv_row_reader {
+public:
+  explicit tsv_row_reader(std::filesystem::path const& filename,
+                          std::vector<std::string> const& default_names = {});
+  tsv_row_reader(tsv_row_reader&&) noexcept;
+  tsv_row_reader& operator=(tsv_row_reader&&) noexcept;
+  ~tsv_row_reader();
+
+  std::vector<std::string> const& names() const noexcept;
+
+  // Read the next row into 'row', which must have names().size() elements.
+  // Return false at the end of the file; throws std::runtime_error on I/O or
+  // format errors.
+  bool next(std::span<int> row);
+
+private:
+  struct impl;
+  std::unique_ptr<impl> impl_;
+};
+
+// A binary columnar file, which can be loaded at the speed of the disk
+// (see read_columnar_data in functions.R). The layout, all little-endian:
+//
+//   8 bytes   magic "DUNECOL1"
+//   uint64    number of columns
+//   uint64    number of rows
+//   for each column: uint64 name length, then the name
+//   for each column: rows x int32
+void write_columnar(int_table const& table,
+                    std::filesystem::path const& filename);
+int_table read_columnar(std::filesystem::path const& filename);
+
+// Read either format, choosing by the file name: ".col" files are columnar,
+// anything else is read_tsv.
+int_table read_table(std::filesystem::path const& filename,
+                     std::vector<std::string> const& default_names = {},
+                     tsv_options const& options = {});
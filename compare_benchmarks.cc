@@ -0,0 +1,66 @@
+// Compare the nanobench tables of a benchmark run with those of a stored
+// baseline (see baseline.hh), such as gcc-12-skylake.txt:
+//
+//   fast_acos_t > new.txt
+//   compare_benchmarks benchmark_2024_01_06.txt new.txt
+//
+// Usage: compare_benchmarks [-t threshold%] [-s sigmas] baseline current
+//
+// A change in time is flagged when it is larger than threshold% (default 5)
+// and than 'sigmas' (default 3) times the combined noise of the two runs.
+// The exit status is 2 if any benchmark regressed, and 1 on errors.
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include "fmt/core.h"
+
+#include "baseline.hh"
+
+namespace {
+  void
+  usage(char const* argv0)
+  {
+    std::cerr << "Usage: " << argv0
+              << " [-t threshold%] [-s sigmas] baseline current\n";
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  comparison_options options;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (std::strcmp(argv[i], "-t") == 0)
+      options.threshold = std::atof(argv[i + 1]) / 100.0;
+    else if (std::strcmp(argv[i], "-s") == 0)
+      options.sigmas = std::atof(argv[i + 1]);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - i != 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    auto const baseline = read_benchmark_table(argv[i]);
+    auto const current = read_benchmark_table(argv[i + 1]);
+    auto const comparisons = compare(baseline, current, options);
+    if (comparisons.empty()) {
+      std::cerr << "no benchmark of " << argv[i + 1] << " is in "
+                << argv[i] << '\n';
+      return 1;
+    }
+    fmt::print("{}", describe(comparisons));
+    return count_regressions(comparisons) == 0 ? 0 : 2;
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Runtime selection of the instruction set used by the kernels.
+//
+// A function marked MULTIVERSION is compiled once for each of the x86-64
+// micro-architecture levels below, and the dynamic loader picks the best
+// clone for the running CPU, once, when the program starts (GCC's
+// target_clones attribute, implemented with an ifunc resolver that reads
+// CPUID). This lets one build run well on every node of a heterogeneous grid,
+// without -march=native.
+//
+//   x86-64     baseline SSE2
+//   x86-64-v3  AVX2, FMA, BMI2
+//   x86-64-v4  AVX-512 F/BW/CD/DQ/VL
+//
+// On AArch64 (e.g. Apple M2), NEON is part of the baseline ISA, so there is
+// only one variant and MULTIVERSION expands to nothing.
+
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) &&           \
+  !defined(__clang__) && (__GNUC__ >= 12)
+#define DUNEPROF_HAS_MULTIVERSION 1
+#define MULTIVERSION                                                           \
+  __attribute__((                                                              \
+    target_clones("default", "arch=x86-64-v3", "arch=x86-64-v4")))
+#else
+#define DUNEPROF_HAS_MULTIVERSION 0
+#define MULTIVERSION
+#endif
+
+// The entry points of the kernel libraries (sum and find_largest in
+// operations.cc). A MULTIVERSION function is called through its ifunc
+// resolver, which link-time optimization can not inline, so when the
+// libraries are built with DUNEPROF_LTO these are not cloned: they are
+// inlined into their callers instead, and vectorized for the ISA of each
+// caller (a MULTIVERSION caller gets the best one).
+#if defined(DUNEPROF_LTO)
+#define KERNEL_MULTIVERSION
+#else
+#define KERNEL_MULTIVERSION MULTIVERSION
+#endif
+
+// Return the name of the variant of the MULTIVERSION functions that is in use
+// on this machine. The tests mirror the priority order used by the resolver.
+inline char const*
+selected_isa()
+{
+#if DUNEPROF_HAS_MULTIVERSION
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("x86-64-v4"))
+    return "x86-64-v4 (AVX-512)";
+  if (__builtin_cpu_supports("x86-64-v3"))
+    return "x86-64-v3 (AVX2+FMA)";
+  return "x86-64 (baseline)";
+#elif defined(__aarch64__)
+  return "aarch64 (NEON)";
+#else
+  return "compiler default (no multiversioning)";
+#endif
+}
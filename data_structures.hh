@@ -1,58 +1,134 @@
 #pragma once
 
+#include <concepts>
+#include <cstddef>
 #include <deque>
 #include <forward_list>
+#include <new>
+#include <ranges>
 #include <vector>
 
-struct soa_vector {
-  std::vector<int> ticks;
-  std::vector<int> nphots;
+// Layout tags used to select how a simphotons object stores its
+// measurements.
+//
+//   aos: an "array of structures", one record per (tick, nphots) measurement.
+//   soa: a "structure of arrays", with parallel ticks and nphots sequences.
+struct aos {};
+struct soa {};
 
-  void clear() noexcept;
+// using record = std::pair<int, int>;
+
+struct record {
+  int first;
+  int second;
 };
 
-inline void
-soa_vector::clear() noexcept
-{
-  ticks.clear();
-  nphots.clear();
-}
+// simphotons<Layout, Container> is the family of SimPhotons implementations
+// we benchmark. The Container is any sequence template (std::vector,
+// std::deque, ...) that takes the element type as its first template
+// argument.
+template <typename Layout, template <typename...> class Container>
+struct simphotons;
 
-struct soa_deq {
-  std::deque<int> ticks;
-  std::deque<int> nphots;
+template <template <typename...> class Container>
+struct simphotons<soa, Container> {
+  Container<int> ticks;
+  Container<int> nphots;
 
   void clear() noexcept;
 };
 
+template <template <typename...> class Container>
 inline void
-soa_deq::clear() noexcept
+simphotons<soa, Container>::clear() noexcept
 {
   ticks.clear();
   nphots.clear();
 }
 
-struct soa_slist {
-  std::forward_list<int> ticks;
-  std::forward_list<int> nphots;
+// The AOS form is just the container of records, so that it can be used
+// anywhere the underlying container can.
+template <template <typename...> class Container>
+struct simphotons<aos, Container> : Container<record> {
+  using base = Container<record>;
+  using base::base;
+};
+
+// Allocator that places every allocation on a cache-line boundary, so that
+// vectorized loops never start with a split load.
+template <typename T>
+struct cache_aligned_allocator {
+  using value_type = T;
+  static constexpr std::align_val_t alignment{64};
 
-  void clear() noexcept;
+  cache_aligned_allocator() = default;
+  template <typename U>
+  cache_aligned_allocator(cache_aligned_allocator<U> const&) noexcept
+  {}
+
+  T* allocate(std::size_t n);
+  void deallocate(T* p, std::size_t n) noexcept;
+
+  template <typename U>
+  bool
+  operator==(cache_aligned_allocator<U> const&) const noexcept
+  {
+    return true;
+  }
 };
 
+template <typename T>
+inline T*
+cache_aligned_allocator<T>::allocate(std::size_t n)
+{
+  return static_cast<T*>(::operator new(n * sizeof(T), alignment));
+}
+
+template <typename T>
 inline void
-soa_slist::clear() noexcept
+cache_aligned_allocator<T>::deallocate(T* p, std::size_t) noexcept
 {
-  ticks.clear();
-  nphots.clear();
+  ::operator delete(p, alignment);
 }
 
-// using record = std::pair<int, int>;
+template <typename T>
+using aligned_vector = std::vector<T, cache_aligned_allocator<T>>;
 
-struct record {
-  int first;
-  int second;
-};
+using soa_vector = simphotons<soa, std::vector>;
+using soa_deq = simphotons<soa, std::deque>;
+using soa_slist = simphotons<soa, std::forward_list>;
+using soa_avector = simphotons<soa, aligned_vector>;
+
+using aos_vector = simphotons<aos, std::vector>;
+using aos_deq = simphotons<aos, std::deque>;
+using aos_slist = simphotons<aos, std::forward_list>;
+
+////////////////////////////////////////////
+// Concepts describing the storage layouts understood by the generic
+// algorithms in operations.hh and fill_functions.hh.
+//
+// A record layout is any range of elements with .first (the tick) and .second
+// (the number of photons); this includes the AOS types and the maps.
+template <typename S>
+concept record_layout =
+  std::ranges::forward_range<S const> &&
+  requires(std::ranges::range_reference_t<S const> r) {
+    { r.first } -> std::convertible_to<int>;
+    { r.second } -> std::convertible_to<int>;
+  };
 
-using aos_vector = std::vector<record>;
-using aos_deq = std::deque<record>;
-using aos_slist = std::forward_list<record>;
+// A keyed layout is a record layout that is an associative container, keyed
+// by tick.
+template <typename S>
+concept keyed_layout = record_layout<S> && requires { typename S::key_type; };
+
+// A sequence layout is a record layout that stores its records in order.
+template <typename S>
+concept sequence_layout = record_layout<S> && !keyed_layout<S>;
+
+// A SOA layout has parallel ticks and nphots sequences.
+template <typename S>
+concept soa_layout = requires(S const& s) {
+  { s.ticks } -> std::ranges::forward_range;
+  { s.nphots } -> std::ranges::forward_range;
+};
@@ -0,0 +1,327 @@
+// Run the processing of a stream of events through a pipeline (see
+// pipeline.hh), once strictly in sequence and once with the stages
+// overlapping, and report the stage occupancies and stalls of each run:
+//
+//   read        the rows of one event, from a measurement file, or made up
+//   decode      the rows grouped into one soa_vector per channel
+//   simulate    Poisson photons added to each measurement
+//   accumulate  event_summary of the channels
+//   write       one line per channel, in event order
+//
+// Usage: event_pipeline [-e events] [-c channels] [-n measurements]
+//                       [-f events_in_flight] [-j threads] [-o output]
+//                       [measurements]
+//
+// Without a measurement file (TSV, xz or columnar, see columnar_io.hh),
+// 'events' events of 'channels' channels with 'measurements' measurements
+// each are made up, with fill (see fill_functions.hh). The rows of each event
+// must be sorted by channel, then time. The simulate and accumulate stages
+// get 'threads' threads each, and decode a quarter of them. The output is
+// discarded unless -o is given.
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "columnar_io.hh"
+#include "data_structures.hh"
+#include "fill_functions.hh"
+#include "operations.hh"
+#include "pipeline.hh"
+#include "poisson.hh"
+
+namespace {
+  void
+  usage(char const* argv0)
+  {
+    std::cerr << "Usage: " << argv0
+              << " [-e events] [-c channels] [-n measurements]"
+                 " [-f events_in_flight] [-j threads] [-o output]"
+                 " [measurements]\n";
+  }
+
+  constexpr std::uint64_t seed = 123;
+
+  // The buffers are kept from one use of the event to the next.
+  struct event {
+    std::array<int, 3> key{}; // run, subrun, event
+    // channel, time, nphot
+    std::vector<std::array<int, 3>> rows;
+    std::vector<int> channel_ids;
+    std::vector<soa_vector> channels;
+    std::vector<summary_t> summaries;
+    // The means and counts of the simulated photons of one channel.
+    std::vector<float> means;
+    std::vector<int> photons;
+    fmt::memory_buffer text;
+  };
+
+  // The events of a measurement file, sorted by event, read one at a time.
+  class file_source {
+  public:
+    explicit file_source(std::string const& filename)
+      : reader_(filename, measurement_columns)
+    {
+      have_row_ = reader_.next(row_);
+    }
+
+    bool
+    operator()(event& e)
+    {
+      if (!have_row_)
+        return false;
+      e.key = {row_[0], row_[1], row_[2]};
+      e.rows.clear();
+      do {
+        e.rows.push_back({row_[3], row_[4], row_[5]});
+        have_row_ = reader_.next(row_);
+      } while (have_row_ &&
+               std::array<int, 3>{row_[0], row_[1], row_[2]} == e.key);
+      return true;
+    }
+
+  private:
+    tsv_row_reader reader_;
+    std::array<int, 6> row_;
+    bool have_row_ = false;
+  };
+
+  // Made-up events, whose channels all hold the measurements of fill (see
+  // fill_functions.hh); simulate makes them differ.
+  class synthetic_source {
+  public:
+    synthetic_source(std::size_t nevents,
+                     std::size_t nchannels,
+                     std::size_t nmeasurements)
+      : nevents_(nevents), nchannels_(nchannels)
+    {
+      fill(channel_, nmeasurements);
+    }
+
+    bool
+    operator()(event& e)
+    {
+      if (next_ == nevents_)
+        return false;
+      e.key = {1, 0, static_cast<int>(next_++)};
+      e.rows.clear();
+      for (std::size_t c = 0; c != nchannels_; ++c) {
+        for (std::size_t t = 0; t != channel_.ticks.size(); ++t) {
+          e.rows.push_back(
+            {static_cast<int>(c), channel_.ticks[t], channel_.nphots[t]});
+        }
+      }
+      return true;
+    }
+
+  private:
+    std::size_t nevents_;
+    std::size_t nchannels_;
+    std::size_t next_ = 0;
+    soa_vector channel_;
+  };
+
+  [[noreturn]] void
+  not_sorted(event const& e)
+  {
+    throw std::runtime_error(
+      fmt::format("measurements are not sorted, at event {}/{}/{}",
+                  e.key[0],
+                  e.key[1],
+                  e.key[2]));
+  }
+
+  // The rows must be sorted by channel, then time.
+  void
+  decode(event& e)
+  {
+    e.channel_ids.clear();
+    std::size_t n = 0;
+    for (std::size_t i = 0; i != e.rows.size(); ++n) {
+      if (e.channels.size() == n)
+        e.channels.emplace_back();
+      soa_vector& c = e.channels[n];
+      c.clear();
+      int const channel = e.rows[i][0];
+      if (n != 0 && channel < e.channel_ids.back())
+        not_sorted(e);
+      e.channel_ids.push_back(channel);
+      for (; i != e.rows.size() && e.rows[i][0] == channel; ++i) {
+        if (!c.ticks.empty() && e.rows[i][1] < c.ticks.back())
+          not_sorted(e);
+        c.ticks.push_back(e.rows[i][1]);
+        c.nphots.push_back(e.rows[i][2]);
+      }
+    }
+    e.channels.resize(n);
+  }
+
+  // Add photons from a second source, with a mean of a tenth of those
+  // already there, to every measurement.
+  void
+  simulate(event& e)
+  {
+    for (std::size_t c = 0; c != e.channels.size(); ++c) {
+      std::uint64_t const stream =
+        (static_cast<std::uint64_t>(e.key[2]) << 20) + e.channel_ids[c];
+      auto& nphots = e.channels[c].nphots;
+      e.means.resize(nphots.size());
+      e.photons.resize(nphots.size());
+      for (std::size_t i = 0; i != nphots.size(); ++i) {
+        e.means[i] = 0.1f * nphots[i] + 0.5f;
+      }
+      poisson_counts(seed, stream, 0, e.means, e.photons);
+      for (std::size_t i = 0; i != nphots.size(); ++i) {
+        nphots[i] += e.photons[i];
+      }
+    }
+  }
+
+  void
+  accumulate(event& e)
+  {
+    e.summaries =
+      event_summary(std::span<soa_vector const>(e.channels), {}, 1);
+  }
+
+  void
+  format(event& e)
+  {
+    e.text.clear();
+    for (std::size_t c = 0; c != e.channels.size(); ++c) {
+      summary_t const& s = e.summaries[c];
+      fmt::format_to(std::back_inserter(e.text),
+                     "{}\t{}\t{}\t{}\t{}\t{}\t{}\n",
+                     e.key[0],
+                     e.key[1],
+                     e.key[2],
+                     e.channel_ids[c],
+                     s.measurements,
+                     s.total,
+                     s.peak.key);
+    }
+  }
+
+  void
+  print_report(char const* title, pipeline_report const& r)
+  {
+    fmt::print("{}: {} events in {:.3f} s, {:.1f} events/s\n",
+               title,
+               r.events,
+               r.seconds,
+               r.events / r.seconds);
+    fmt::print("  {:<12}{:>8}{:>10}{:>12}{:>11}{:>9}\n",
+               "stage",
+               "threads",
+               "events",
+               "busy (s)",
+               "occupancy",
+               "stalls");
+    for (auto const& s : r.stages) {
+      fmt::print("  {:<12}{:>8}{:>10}{:>12.3f}{:>10.1f}%{:>9}\n",
+                 s.name,
+                 s.threads,
+                 s.events,
+                 s.busy_seconds,
+                 100 * s.occupancy,
+                 s.stalls);
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  std::size_t nevents = 200;
+  std::size_t nchannels = 480;
+  std::size_t nmeasurements = 200;
+  std::size_t in_flight = 32;
+  std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+  std::string output;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    std::size_t const value = std::max(1l, std::atol(argv[i + 1]));
+    if (std::strcmp(argv[i], "-e") == 0)
+      nevents = value;
+    else if (std::strcmp(argv[i], "-c") == 0)
+      nchannels = value;
+    else if (std::strcmp(argv[i], "-n") == 0)
+      nmeasurements = value;
+    else if (std::strcmp(argv[i], "-f") == 0)
+      in_flight = value;
+    else if (std::strcmp(argv[i], "-j") == 0)
+      nthreads = value;
+    else if (std::strcmp(argv[i], "-o") == 0)
+      output = argv[i + 1];
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - i > 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    std::ofstream out;
+    if (!output.empty()) {
+      out.open(output);
+      if (!out)
+        throw std::runtime_error("can not create " + output);
+      out << "run\tsubrun\tevent\tchannel\tnmeas\tnphots\tpeak_time\n";
+    }
+    // Every run reads the input from the start.
+    auto run = [&](std::size_t in_flight,
+                   std::size_t nthreads,
+                   std::ofstream* sink) {
+      pipeline<event> p(in_flight);
+      if (argc - i == 1)
+        p.source("read",
+                 [src = std::make_shared<file_source>(argv[i])](event& e) {
+                   return (*src)(e);
+                 });
+      else
+        p.source("read",
+                 synthetic_source(nevents, nchannels, nmeasurements));
+      p.stage("decode", std::max<std::size_t>(1, nthreads / 4), decode);
+      p.stage("simulate", nthreads, simulate);
+      p.stage("accumulate", nthreads, accumulate);
+      p.ordered_stage("write", [sink](event& e) {
+        format(e);
+        if (sink != nullptr)
+          sink->write(e.text.data(),
+                      static_cast<std::streamsize>(e.text.size()));
+      });
+      return p.run();
+    };
+
+    // Only the pipelined run's output is kept.
+    auto const sequential = run(1, 1, nullptr);
+    auto const pipelined =
+      run(in_flight, nthreads, out.is_open() ? &out : nullptr);
+    print_report("sequential", sequential);
+    print_report(
+      fmt::format("pipelined, {} in flight", in_flight).c_str(), pipelined);
+    fmt::print("speedup: {:.2f}\n", sequential.seconds / pipelined.seconds);
+    if (out.is_open() && !out.flush())
+      throw std::runtime_error("error writing " + output);
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
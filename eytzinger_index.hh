@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "data_structures.hh"
+
+// eytzinger_index is a read-only search index over the sorted ticks of a
+// channel, built once after the channel is filled.
+//
+// The ticks are stored in Eytzinger (BFS) order: the children of node k are
+// 2k and 2k+1. The first levels of the tree, which every search visits, share
+// a few cache lines, and the 16 great-great-grandchildren of node k are in
+// one cache line, so they can be prefetched four levels ahead.
+//
+// The tree is padded with INT_MIN to a full binary tree. A padding node
+// always sends the search right, and the final shift discards right turns,
+// so every search takes exactly the same number of steps. The search loop
+// thus has no data-dependent branches at all.
+//
+// Searches return positions in the original sorted array, so they can be used
+// to index the matching nphots.
+class eytzinger_index {
+public:
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  eytzinger_index() = default;
+  // 'ticks' must be sorted in increasing order, without duplicates, and must
+  // not contain INT_MIN.
+  explicit eytzinger_index(std::span<int const> ticks);
+
+  std::size_t size() const noexcept;
+
+  // Position of the first tick not less than 'tick', or size() if there is
+  // none; the same as std::lower_bound over the sorted ticks.
+  std::size_t lower_bound(int tick) const noexcept;
+  // Position of 'tick', or npos if it is not present.
+  std::size_t find(int tick) const noexcept;
+  // positions[i] = find(ticks[i]). The searches are interleaved, so the
+  // memory accesses of several searches are in flight at once.
+  void find_batch(std::span<int const> ticks,
+                  std::span<std::size_t> positions) const noexcept;
+
+private:
+  // Number of queries interleaved by find_batch.
+  static constexpr std::size_t batch_width = 16;
+
+  std::size_t build(std::span<int const> ticks, std::size_t i, std::size_t k);
+  std::size_t descend(int tick) const noexcept;
+  std::size_t position_of(std::size_t node, int tick) const noexcept;
+
+  // tree_[0] is unused; the allocation is cache-line aligned, so the 16
+  // children four levels below node k, at 16k, are one cache line.
+  aligned_vector<int> tree_;
+  // sorted_[k] is the position in the sorted ticks of tree_[k].
+  std::vector<std::uint32_t> sorted_;
+  std::size_t size_ = 0;
+  unsigned levels_ = 0;
+};
+
+inline eytzinger_index::eytzinger_index(std::span<int const> ticks)
+  : size_(ticks.size()), levels_(std::bit_width(ticks.size()))
+{
+  std::size_t const nodes = std::size_t{1} << levels_;
+  tree_.assign(nodes, INT_MIN);
+  sorted_.assign(nodes, 0);
+  build(ticks, 0, 1);
+}
+
+inline std::size_t
+eytzinger_index::size() const noexcept
+{
+  return size_;
+}
+
+// In-order traversal of the implicit tree, taking the sorted ticks in order.
+// Return the index of the next tick to place.
+inline std::size_t
+eytzinger_index::build(std::span<int const> ticks, std::size_t i, std::size_t k)
+{
+  if (k <= ticks.size()) {
+    i = build(ticks, i, 2 * k);
+    tree_[k] = ticks[i];
+    sorted_[k] = static_cast<std::uint32_t>(i);
+    ++i;
+    i = build(ticks, i, 2 * k + 1);
+  }
+  return i;
+}
+
+// Return the node holding the lower bound of 'tick', or 0 if all the ticks
+// are less than 'tick'.
+inline std::size_t
+eytzinger_index::descend(int tick) const noexcept
+{
+  int const* tree = tree_.data();
+  std::size_t k = 1;
+  for (unsigned level = 0; level != levels_; ++level) {
+    __builtin_prefetch(tree + 16 * k);
+    k = 2 * k + (tree[k] < tick);
+  }
+  // Undo the right turns taken after the last left turn, and that left turn.
+  return k >> (std::countr_one(k) + 1);
+}
+
+inline std::size_t
+eytzinger_index::lower_bound(int tick) const noexcept
+{
+  std::size_t const k = descend(tick);
+  return k == 0 ? size_ : sorted_[k];
+}
+
+inline std::size_t
+eytzinger_index::position_of(std::size_t node, int tick) const noexcept
+{
+  return (node != 0 && tree_[node] == tick) ? sorted_[node] : npos;
+}
+
+inline std::size_t
+eytzinger_index::find(int tick) const noexcept
+{
+  if (size_ == 0)
+    return npos;
+  return position_of(descend(tick), tick);
+}
+
+inline void
+eytzinger_index::find_batch(std::span<int const> ticks,
+                            std::span<std::size_t> positions) const noexcept
+{
+  if (size_ == 0) {
+    std::fill(positions.begin(), positions.end(), npos);
+    return;
+  }
+  int const* tree = tree_.data();
+  std::size_t const n = ticks.size();
+  std::size_t start = 0;
+  for (; start + batch_width <= n; start += batch_width) {
+    std::size_t k[batch_width];
+    for (std::size_t j = 0; j != batch_width; ++j) {
+      k[j] = 1;
+    }
+    for (unsigned level = 0; level != levels_; ++level) {
+      for (std::size_t j = 0; j != batch_width; ++j) {
+        __builtin_prefetch(tree + 16 * k[j]);
+        k[j] = 2 * k[j] + (tree[k[j]] < ticks[start + j]);
+      }
+    }
+    for (std::size_t j = 0; j != batch_width; ++j) {
+      std::size_t const node = k[j] >> (std::countr_one(k[j]) + 1);
+      positions[start + j] = position_of(node, ticks[start + j]);
+    }
+  }
+  for (; start != n; ++start) {
+    positions[start] = find(ticks[start]);
+  }
+}
@@ -1,14 +1,18 @@
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <vector>
 
 #include "nanobench.h"
 
+#include "cpu_dispatch.hh"
+#include "roofline.hh"
+
 double ieee754_acos(double);
 
 // This is from LArSim.
 
-__attribute__((noinline)) double
+__attribute__((noinline)) MULTIVERSION double
 fast_acos(double x)
 {
   double negate = double(x < 0.);
@@ -32,7 +36,7 @@ std_acosd_fm(double x)
   return std::acos(x);
 }
 
-__attribute__((noinline)) double
+__attribute__((noinline)) MULTIVERSION double
 hastings_acos_obfuscated(double xin)
 {
   double x = xin;
@@ -60,7 +64,7 @@ hastings_acos_obfuscated(double xin)
   return factor * ret + term;
 }
 
-__attribute__((noinline)) double
+__attribute__((noinline)) MULTIVERSION double
 hastings_acos(double xin)
 {
   double const x = std::abs(xin);
@@ -81,7 +85,7 @@ hastings_acos(double xin)
   return M_PI - ret;
 }
 
-__attribute__((noinline)) double
+__attribute__((noinline)) MULTIVERSION double
 hastings_acos_4(double xin)
 {
   double const a3 = -2.08730442907856008e-02;
@@ -102,7 +106,7 @@ hastings_acos_4(double xin)
   return M_PI - ret;
 }
 
-__attribute__((noinline)) double
+__attribute__((noinline)) MULTIVERSION double
 hastings_acos_5(double xin)
 {
   double const a4 = 9.50315681176718517e-03;
@@ -204,14 +208,15 @@ atan2_auto(double y, double x)
   return res;
 }
 
-__attribute__((noinline)) double
+__attribute__((noinline)) MULTIVERSION double
 acos_from_atan2(double x)
 {
   return atan2_auto(std::sqrt((1.0 + x) * (1.0 - x)), x);
 }
 
+// Return the median time of the run, of two calls.
 template <typename F>
-void
+double
 run_bench(F func, ankerl::nanobench::Bench* bench, char const* name)
 {
   volatile double x = 0.457;
@@ -222,25 +227,59 @@ run_bench(F func, ankerl::nanobench::Bench* bench, char const* name)
     ankerl::nanobench::doNotOptimizeAway(z1);
     ankerl::nanobench::doNotOptimizeAway(z2);
   });
+  using measure = ankerl::nanobench::Result::Measure;
+  return bench->results().back().median(measure::elapsed);
+}
+
+// The cost of an iteration of run_bench, with the given flops for its two
+// calls; the arguments are read from the stack.
+kernel_cost
+acos_cost(double flops)
+{
+  return {16.0, flops, false, 16};
 }
 
 void
 bmark()
 {
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
   ankerl::nanobench::Bench b;
   b.title("acos tests")
     .performanceCounters(true)
     .minEpochIterations(10 * 1000 * 1000);
-  run_bench(&fast_acos, &b, "fast_acos");
-  run_bench(&hastings_acos, &b, "hastings_acos");
-  run_bench(&hastings_acos_obfuscated, &b, "hastings_acos_obfuscated");
+
+  // For the roofline report, the flops of the path taken for the two
+  // arguments, one positive and one negative, counting +, -, *, / and sqrt
+  // but not abs, comparisons or selects. std::acos and ieee754_acos take a
+  // different path for each range of the argument, so they are not counted.
+  // The calls are scalar, and far below the vector peak.
+  std::vector<costed_run> runs;
+  runs.push_back({"fast_acos",
+                  acos_cost(34.0),
+                  run_bench(&fast_acos, &b, "fast_acos")});
+  runs.push_back({"hastings_acos",
+                  acos_cost(19.0),
+                  run_bench(&hastings_acos, &b, "hastings_acos")});
+  runs.push_back(
+    {"hastings_acos_obfuscated",
+     acos_cost(23.0),
+     run_bench(&hastings_acos_obfuscated, &b, "hastings_acos_obfuscated")});
   run_bench(&std_acos, &b, "acosd");
   run_bench(&std_acosf, &b, "acosf");
-  run_bench(&hastings_acos_4, &b, "hastings_acos_4");
-  run_bench(&hastings_acos_5, &b, "hastings_acos_5");
+  runs.push_back({"hastings_acos_4",
+                  acos_cost(19.0),
+                  run_bench(&hastings_acos_4, &b, "hastings_acos_4")});
+  runs.push_back({"hastings_acos_5",
+                  acos_cost(23.0),
+                  run_bench(&hastings_acos_5, &b, "hastings_acos_5")});
   run_bench(&ieee754_acos, &b, "ieee");
-  run_bench(&acos_from_atan2, &b, "acos_from_atan2");
+  runs.push_back({"acos_from_atan2",
+                  acos_cost(37.0),
+                  run_bench(&acos_from_atan2, &b, "acos_from_atan2")});
   run_bench(&std_acosd_fm, &b, "acosd_fm");
+
+  auto const peaks = measure_machine();
+  std::cout << describe(peaks) << describe(peaks, runs);
 }
 
 int
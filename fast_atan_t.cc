@@ -7,6 +7,9 @@
 
 #include "nanobench.h"
 
+#include "cpu_dispatch.hh"
+#include "roofline.hh"
+
 double
 atan2d(double y, double x)
 {
@@ -110,33 +113,66 @@ make_randoms(unsigned long n)
   return values;
 }
 
-template <typename F>
-void
-run_bench(F func, ankerl::nanobench::Bench* bench, char const* name)
+// Apply F to each pair (vals[i], vals[i + n]). The loop, rather than F, is
+// MULTIVERSION (see cpu_dispatch.hh), so that F is inlined and the whole loop
+// is vectorized for the ISA selected at run time.
+template <double (*F)(double, double)>
+MULTIVERSION void
+apply_atan2(std::vector<double> const& vals, std::vector<double>& zs)
+{
+  std::size_t const n = zs.size();
+  for (std::size_t i = 0; i != n; ++i) {
+    zs[i] = F(vals[i], vals[i + n]);
+  }
+}
+
+// array sizes are set large enough to exhause L2 cache on my laptop.
+unsigned long const n = 1 * 1000 * 1000;
+
+// The cost of apply_atan2 with the given flops per call; each call reads two
+// doubles and writes one.
+kernel_cost
+atan2_cost(double flops_per_call)
+{
+  return {24.0 * n, flops_per_call * n, false, 24 * n};
+}
+
+// Return the median time of the run.
+template <double (*F)(double, double)>
+double
+run_bench(ankerl::nanobench::Bench* bench, char const* name)
 {
-  // array sizes are set large enough to exhause L2 cache on my laptop.
-  unsigned long const n = 1 * 1000 * 1000;
   auto vals = make_randoms(2 * n);
   std::vector<double> zs(n);
   bench->run(name, [&]() {
-    for (int i = 0; i != n; ++i) {
-      zs[i] = func(vals[i], vals[i + n]);
-    }
+    apply_atan2<F>(vals, zs);
     ankerl::nanobench::doNotOptimizeAway(zs);
   });
+  using measure = ankerl::nanobench::Result::Measure;
+  return bench->results().back().median(measure::elapsed);
 }
 
 void
 bmark()
 {
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
   ankerl::nanobench::Bench b;
   b.title("atan tests");
   b.performanceCounters(true);
   // b.minEpochIterations(1 * 1000);
 
-  run_bench(&atan2d, &b, "atan2d");
-  run_bench(&atan2_1, &b, "atan2_1");
-  run_bench(&atan2_4, &b, "atan2_4");
+  // For the roofline report, the flops of each call are counted from the
+  // vectorized code path (the division, 1/|z| for |z| > 1, the polynomial
+  // and the quadrant corrections; a division counts as one flop).
+  // std::atan2 is a library call, so it is not counted.
+  run_bench<&atan2d>(&b, "atan2d");
+  costed_run const runs[] = {
+    {"atan2_1", atan2_cost(10.0), run_bench<&atan2_1>(&b, "atan2_1")},
+    {"atan2_4", atan2_cost(12.0), run_bench<&atan2_4>(&b, "atan2_4")},
+  };
+
+  auto const peaks = measure_machine();
+  std::cout << describe(peaks) << describe(peaks, runs);
 }
 
 int
@@ -1,17 +1,19 @@
 #pragma once
 
 #include "data_structures.hh"
-#include <map>
-#include <unordered_map>
-#include <vector>
+#include "flat_int_map.hh"
+#include "hybrid_channel.hh"
+#include <cstddef>
 
-void fill(std::map<int, int>& m, std::size_t n_measurements);
-void fill(std::unordered_map<int, int>& m, std::size_t n_measurements);
+template <keyed_layout S>
+void fill(S& m, std::size_t n_measurements);
+template <sequence_layout S>
+void fill(S& m, std::size_t n_measurements);
+template <soa_layout S>
+void fill(S& m, std::size_t n_measurements);
+void fill(hybrid_channel& m, std::size_t n_measurements);
+void fill(flat_int_map& m, std::size_t n_measurements);
 
-void fill(aos_vector& m, std::size_t n_measurements);
-void fill(aos_deq& m, std::size_t n_measurements);
-void fill(aos_slist& m, std::size_t n_measurements);
-
-void fill(soa_vector& m, std::size_t n_measurements);
-void fill(soa_deq& m, std::size_t n_measurements);
-void fill(soa_slist& m, std::size_t n_measurements);
+// The definitions live in fill_functions.cc, which instantiates them for every
+// type in registered_layouts (see layout_registry.hh). The same functions are
+// in fill_functions_inline.hh, for callers that want them inlined.
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <thread>
+#include <vector>
+
+#include "data_structures.hh"
+#include "flat_int_map.hh"
+#include "hybrid_channel.hh"
+#include "parallel.hh"
+#include "philox.hh"
+
+// The definitions of the fill functions, as inline functions in namespace
+// kernels, for callers that want them inlined rather than called in the
+// fill_functions library (see operations_inline.hh). The parallel fills
+// start threads, so callers must link Threads::Threads.
+//
+// The measurements used to fill the various data structures have random
+// numbers of photons, and consecutive integers for the ticks; this avoids map
+// and hashmap key collisions. The photons of measurement i are the i-th draw
+// of a Philox stream, so every structure gets the same values, computed in
+// place without intermediate vectors, whatever the number of threads.
+namespace kernels {
+  inline constexpr std::uint64_t fill_seed = 123;
+  inline constexpr std::uint32_t max_nphot = 10000;
+  // Below this size, starting threads costs more than it saves.
+  inline constexpr std::size_t parallel_threshold = std::size_t{1} << 16;
+
+  // Call f(i, nphot) for the measurements i in [begin, end). Each Philox
+  // block gives the photons of four consecutive measurements, so the block is
+  // computed once and all its words are used.
+  template <typename F>
+  void
+  for_each_nphot(std::size_t begin, std::size_t end, F&& f)
+  {
+    philox_engine const engine(fill_seed);
+    std::size_t i = begin;
+    while (i != end) {
+      auto const block = engine.block_at(i >> 2);
+      for (std::size_t j = i & 3; j != block.size() && i != end; ++j, ++i) {
+        f(i, static_cast<int>(uniform_below(block[j], max_nphot + 1)));
+      }
+    }
+  }
+
+  // Call body(begin, end) on parts of [0, n), in parallel if n is large.
+  template <typename F>
+  void
+  partitioned(std::size_t n, F const& body)
+  {
+    if (n < parallel_threshold) {
+      body(0, n);
+      return;
+    }
+    std::size_t const nthreads =
+      std::max(1u, std::thread::hardware_concurrency());
+    parallel_for(nthreads, [&](std::size_t t) {
+      auto const [begin, end] = static_partition(n, nthreads, t);
+      body(begin, end);
+    });
+  }
+
+  // Set the i-th element of r to f(i), in parallel for large random-access
+  // ranges.
+  template <typename R, typename F>
+  void
+  generate_indexed(R& r, F f)
+  {
+    auto const n = static_cast<std::size_t>(std::ranges::distance(r));
+    auto body = [&r, &f](std::size_t begin, std::size_t end) {
+      auto it = std::ranges::next(std::ranges::begin(r), begin);
+      for (std::size_t i = begin; i != end; ++i, ++it) {
+        *it = f(i);
+      }
+    };
+    if constexpr (std::ranges::random_access_range<R>) {
+      partitioned(n, body);
+    } else {
+      body(0, n);
+    }
+  }
+
+  // Set the i-th element of r to f(i, nphot), with nphot the photons of
+  // measurement i; in parallel for large random-access ranges.
+  template <typename R, typename F>
+  void
+  generate_measurements(R& r, F f)
+  {
+    auto const n = static_cast<std::size_t>(std::ranges::distance(r));
+    auto body = [&r, &f](std::size_t begin, std::size_t end) {
+      auto it = std::ranges::next(std::ranges::begin(r), begin);
+      for_each_nphot(begin, end, [&it, &f](std::size_t i, int nphot) {
+        *it++ = f(i, nphot);
+      });
+    };
+    if constexpr (std::ranges::random_access_range<R>) {
+      partitioned(n, body);
+    } else {
+      body(0, n);
+    }
+  }
+
+  // Node-based versions; the inserts are serial.
+  template <keyed_layout S>
+  void
+  fill(S& m, std::size_t n_measurements)
+  {
+    for_each_nphot(0, n_measurements, [&m](std::size_t i, int nphot) {
+      m.insert({static_cast<int>(i), nphot});
+    });
+  }
+
+  // AOS-based versions.
+  template <sequence_layout S>
+  void
+  fill(S& m, std::size_t n_measurements)
+  {
+    using value_type = typename S::value_type;
+    m.resize(n_measurements);
+    generate_measurements(m, [](std::size_t i, int nphot) {
+      return value_type{static_cast<int>(i), nphot};
+    });
+  }
+
+  // SOA-based versions.
+  template <soa_layout S>
+  void
+  fill(S& m, std::size_t n_measurements)
+  {
+    m.ticks.resize(n_measurements);
+    m.nphots.resize(n_measurements);
+    generate_indexed(m.ticks,
+                     [](std::size_t i) { return static_cast<int>(i); });
+    generate_measurements(m.nphots,
+                          [](std::size_t, int nphot) { return nphot; });
+  }
+
+  // The ticks are consecutive, so this always chooses the dense form. The
+  // hybrid builds its own storage from spans, so it needs the vectors.
+  inline void
+  fill(hybrid_channel& m, std::size_t n_measurements)
+  {
+    soa_vector v;
+    kernels::fill(v, n_measurements);
+    m.assign(v.ticks, v.nphots);
+  }
+
+  inline void
+  fill(flat_int_map& m, std::size_t n_measurements)
+  {
+    m.reserve(n_measurements);
+    for_each_nphot(0, n_measurements, [&m](std::size_t i, int nphot) {
+      m.insert(static_cast<int>(i), nphot);
+    });
+  }
+}
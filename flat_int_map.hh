@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// flat_int_map is an open-addressing hash map from int tick to int number of
+// photons, using linear probing.
+//
+// The keys and values are kept in separate arrays (SOA slots), and empty
+// slots hold the value 0. A scan that looks only at the values (e.g. sum)
+// therefore runs over one contiguous array without looking at the keys or
+// testing for empty slots, which std::unordered_map cannot do.
+//
+// INT_MIN is reserved to mark empty slots, and can not be used as a key.
+// Erasure is not supported; the data product is written once and then read.
+class flat_int_map {
+public:
+  static constexpr int empty_key = INT_MIN;
+
+  flat_int_map() = default;
+
+  // Insert (tick, nphots) if tick is not already present. Return true if the
+  // insertion happened.
+  bool insert(int tick, int nphots);
+  // Add nphots to the value at tick, inserting tick if needed.
+  void accumulate(int tick, int nphots);
+  // Return a pointer to the value at tick, or nullptr if tick is not present.
+  int const* find(int tick) const noexcept;
+
+  void reserve(std::size_t n);
+  // Shrink the slot arrays to the smallest that hold n elements, and the
+  // current ones.
+  void trim(std::size_t n);
+  void clear() noexcept;
+
+  std::size_t size() const noexcept;
+  // The number of elements held without a rehash.
+  std::size_t capacity() const noexcept;
+  bool empty() const noexcept;
+
+  // The slot arrays; keys()[i] == empty_key for an empty slot, in which case
+  // values()[i] == 0.
+  std::vector<int> const& keys() const noexcept;
+  std::vector<int> const& values() const noexcept;
+
+private:
+  // Maximum load factor is max_load_num / max_load_den.
+  static constexpr std::size_t max_load_num = 7;
+  static constexpr std::size_t max_load_den = 8;
+
+  static std::size_t slots_for(std::size_t n) noexcept;
+  std::size_t slot_for(int tick) const noexcept;
+  std::size_t probe(int tick) const noexcept;
+  void rehash(std::size_t capacity);
+  // Return true if the slots were rehashed.
+  bool grow_if_needed();
+
+  std::vector<int> keys_;
+  std::vector<int> values_;
+  std::size_t size_ = 0;
+  std::size_t mask_ = 0;
+};
+
+inline std::size_t
+flat_int_map::size() const noexcept
+{
+  return size_;
+}
+
+inline std::size_t
+flat_int_map::capacity() const noexcept
+{
+  return keys_.size() * max_load_num / max_load_den;
+}
+
+inline bool
+flat_int_map::empty() const noexcept
+{
+  return size_ == 0;
+}
+
+inline std::vector<int> const&
+flat_int_map::keys() const noexcept
+{
+  return keys_;
+}
+
+inline std::vector<int> const&
+flat_int_map::values() const noexcept
+{
+  return values_;
+}
+
+inline void
+flat_int_map::clear() noexcept
+{
+  std::fill(keys_.begin(), keys_.end(), empty_key);
+  std::fill(values_.begin(), values_.end(), 0);
+  size_ = 0;
+}
+
+// Ticks are nearly consecutive integers, so the identity hash would put runs
+// of ticks in runs of slots and make long probe sequences when they collide.
+// Fibonacci hashing spreads them out with one multiplication.
+inline std::size_t
+flat_int_map::slot_for(int tick) const noexcept
+{
+  std::uint64_t const h =
+    static_cast<std::uint32_t>(tick) * 0x9E3779B97F4A7C15ULL;
+  return static_cast<std::size_t>(h >> 32) & mask_;
+}
+
+// Return the slot holding tick, or the empty slot where it would go.
+inline std::size_t
+flat_int_map::probe(int tick) const noexcept
+{
+  std::size_t i = slot_for(tick);
+  while (keys_[i] != tick && keys_[i] != empty_key) {
+    i = (i + 1) & mask_;
+  }
+  return i;
+}
+
+inline void
+flat_int_map::rehash(std::size_t capacity)
+{
+  std::vector<int> old_keys(capacity, empty_key);
+  std::vector<int> old_values(capacity, 0);
+  old_keys.swap(keys_);
+  old_values.swap(values_);
+  mask_ = capacity - 1;
+  for (std::size_t i = 0, sz = old_keys.size(); i != sz; ++i) {
+    if (old_keys[i] != empty_key) {
+      std::size_t const j = probe(old_keys[i]);
+      keys_[j] = old_keys[i];
+      values_[j] = old_values[i];
+    }
+  }
+}
+
+// The number of slots, a power of two of at least 16, needed to hold n
+// elements.
+inline std::size_t
+flat_int_map::slots_for(std::size_t n) noexcept
+{
+  std::size_t const needed =
+    std::bit_ceil((n * max_load_den + max_load_num - 1) / max_load_num);
+  return std::max<std::size_t>(needed, 16);
+}
+
+inline void
+flat_int_map::reserve(std::size_t n)
+{
+  std::size_t const needed = slots_for(n);
+  if (needed > keys_.size())
+    rehash(needed);
+}
+
+inline void
+flat_int_map::trim(std::size_t n)
+{
+  std::size_t const needed = slots_for(std::max(n, size_));
+  if (needed < keys_.size())
+    rehash(needed);
+}
+
+inline bool
+flat_int_map::grow_if_needed()
+{
+  if ((size_ + 1) * max_load_den <= keys_.size() * max_load_num)
+    return false;
+  rehash(keys_.empty() ? 16 : 2 * keys_.size());
+  return true;
+}
+
+// Both probe before growing, so that a tick already present never causes a
+// rehash.
+inline bool
+flat_int_map::insert(int tick, int nphots)
+{
+  assert(tick != empty_key);
+  std::size_t i = keys_.empty() ? 0 : probe(tick);
+  if (!keys_.empty() && keys_[i] == tick)
+    return false;
+  if (grow_if_needed())
+    i = probe(tick);
+  keys_[i] = tick;
+  values_[i] = nphots;
+  ++size_;
+  return true;
+}
+
+inline void
+flat_int_map::accumulate(int tick, int nphots)
+{
+  assert(tick != empty_key);
+  std::size_t i = keys_.empty() ? 0 : probe(tick);
+  if (!keys_.empty() && keys_[i] == tick) {
+    values_[i] += nphots;
+    return;
+  }
+  if (grow_if_needed())
+    i = probe(tick);
+  keys_[i] = tick;
+  values_[i] = nphots;
+  ++size_;
+}
+
+inline int const*
+flat_int_map::find(int tick) const noexcept
+{
+  if (keys_.empty() || tick == empty_key)
+    return nullptr;
+  std::size_t const i = probe(tick);
+  return keys_[i] == tick ? &values_[i] : nullptr;
+}
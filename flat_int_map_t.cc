@@ -0,0 +1,144 @@
+// Benchmark flat_int_map against std::unordered_map and std::map, for the
+// operations a tick-keyed consumer needs: insert, accumulate, lookup of
+// present and absent ticks, and full scans.
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "flat_int_map.hh"
+#include "operations.hh"
+
+// Uniform interface over the three map types, for the parts of the benchmark
+// that are not covered by operations.hh.
+void
+insert_one(std::map<int, int>& m, int tick, int nphots)
+{
+  m.insert({tick, nphots});
+}
+
+void
+insert_one(std::unordered_map<int, int>& m, int tick, int nphots)
+{
+  m.insert({tick, nphots});
+}
+
+void
+insert_one(flat_int_map& m, int tick, int nphots)
+{
+  m.insert(tick, nphots);
+}
+
+void
+accumulate_one(std::map<int, int>& m, int tick, int nphots)
+{
+  m[tick] += nphots;
+}
+
+void
+accumulate_one(std::unordered_map<int, int>& m, int tick, int nphots)
+{
+  m[tick] += nphots;
+}
+
+void
+accumulate_one(flat_int_map& m, int tick, int nphots)
+{
+  m.accumulate(tick, nphots);
+}
+
+template <typename M>
+void
+run_benches(ankerl::nanobench::Bench* bench,
+            std::vector<int> const& ticks,
+            std::vector<int> const& nphots,
+            std::vector<int> const& hits,
+            std::vector<int> const& misses,
+            std::string const& name)
+{
+  std::size_t const n = ticks.size();
+  std::string const suffix = fmt::format("{}_{}", name, n);
+
+  bench->batch(n).run("insert_" + suffix, [&]() {
+    M m;
+    for (std::size_t i = 0; i != n; ++i) {
+      insert_one(m, ticks[i], nphots[i]);
+    }
+    ankerl::nanobench::doNotOptimizeAway(m);
+  });
+
+  // Each tick is seen four times, as when summing photons from several
+  // deposits.
+  bench->batch(4 * n).run("accumulate_" + suffix, [&]() {
+    M m;
+    for (int rep = 0; rep != 4; ++rep) {
+      for (std::size_t i = 0; i != n; ++i) {
+        accumulate_one(m, ticks[i], nphots[i]);
+      }
+    }
+    ankerl::nanobench::doNotOptimizeAway(m);
+  });
+
+  M m;
+  for (std::size_t i = 0; i != n; ++i) {
+    insert_one(m, ticks[i], nphots[i]);
+  }
+
+  int s = 0;
+  bench->batch(hits.size()).run("hit_" + suffix, [&]() {
+    for (int q : hits) {
+      s += lookup(m, q);
+    }
+  });
+  bench->batch(misses.size()).run("miss_" + suffix, [&]() {
+    for (int q : misses) {
+      s += lookup(m, q);
+    }
+  });
+  bench->batch(n).run("sum_" + suffix, [&]() { s += sum(m); });
+  result_t r;
+  bench->batch(n).run("scan_" + suffix, [&]() { r = find_largest(m); });
+  bench->batch(1);
+  ankerl::nanobench::doNotOptimizeAway(s);
+  ankerl::nanobench::doNotOptimizeAway(r);
+}
+
+int
+main()
+{
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  ankerl::nanobench::Bench b;
+  b.title("tick-keyed maps").performanceCounters(true).minEpochIterations(10);
+
+  std::minstd_rand0 engine(123);
+  std::uniform_int_distribution<int> phot{0, 10000};
+  std::array<std::size_t, 3> NM = {100ULL, 1000ULL, 10000ULL};
+  for (auto n : NM) {
+    // Ticks are the even numbers in a burst, inserted in a random order;
+    // the odd numbers are guaranteed misses.
+    std::vector<int> ticks(n);
+    std::vector<int> nphots(n);
+    for (std::size_t i = 0; i != n; ++i) {
+      ticks[i] = 2 * static_cast<int>(i);
+      nphots[i] = phot(engine);
+    }
+    std::shuffle(ticks.begin(), ticks.end(), engine);
+    std::vector<int> hits(ticks);
+    std::shuffle(hits.begin(), hits.end(), engine);
+    std::vector<int> misses(n);
+    std::ranges::transform(hits, misses.begin(), [](int t) { return t + 1; });
+
+    run_benches<std::map<int, int>>(&b, ticks, nphots, hits, misses, "map");
+    run_benches<std::unordered_map<int, int>>(
+      &b, ticks, nphots, hits, misses, "hashmap");
+    run_benches<flat_int_map>(&b, ticks, nphots, hits, misses, "flatmap");
+  }
+}
@@ -0,0 +1,519 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu_dispatch.hh"
+#include "data_structures.hh"
+#include "parallel.hh"
+
+// Histograms of the validation distributions (photons per measurement,
+// measurements per channel, deviations between algorithms, time profiles).
+//
+// Bin 0 is the underflow and bin nbins() + 1 the overflow, so every value is
+// counted somewhere; NaN is counted as an underflow. Filling a span of
+// values goes through the batched indices() of the binning, which for fixed
+// binning the compiler vectorizes (see MULTIVERSION in cpu_dispatch.hh); log
+// binning vectorizes only the part after the logarithm. For large inputs,
+// fill_parallel fills one private histogram per thread and merges them at the
+// end.
+
+// nbins equal bins covering [lo, hi).
+class fixed_binning {
+public:
+  fixed_binning(std::size_t nbins, double lo, double hi);
+
+  std::size_t nbins() const noexcept;
+  double lower_edge(std::size_t bin) const noexcept;
+  std::size_t index(double x) const noexcept;
+  // out[i] = index(xs[i]).
+  void indices(std::span<int const> xs, std::uint32_t* out) const noexcept;
+  void indices(std::span<double const> xs, std::uint32_t* out) const noexcept;
+
+  friend bool operator==(fixed_binning const&,
+                         fixed_binning const&) = default;
+
+private:
+  std::size_t nbins_;
+  double lo_;
+  double hi_;
+  double scale_;
+};
+
+// nbins bins covering [lo, hi) whose edges are equally spaced in log(x); lo
+// must be positive. Values not above zero are underflows.
+class log_binning {
+public:
+  log_binning(std::size_t nbins, double lo, double hi);
+
+  std::size_t nbins() const noexcept;
+  double lower_edge(std::size_t bin) const noexcept;
+  std::size_t index(double x) const noexcept;
+  void indices(std::span<int const> xs, std::uint32_t* out) const noexcept;
+  void indices(std::span<double const> xs, std::uint32_t* out) const noexcept;
+
+  friend bool operator==(log_binning const&, log_binning const&) = default;
+
+private:
+  fixed_binning log_bins_;
+};
+
+template <typename Binning>
+class histogram1d {
+public:
+  explicit histogram1d(Binning binning);
+
+  Binning const& binning() const noexcept;
+  void fill(double x) noexcept;
+  template <typename T>
+  void fill(std::span<T const> xs);
+  // Add the counts of 'other', which must have the same binning.
+  void merge(histogram1d const& other);
+  // An empty histogram with the same binning.
+  histogram1d empty_copy() const;
+
+  // nbins() + 2 counts, including the underflow and overflow.
+  std::span<std::uint64_t const> counts() const noexcept;
+  std::uint64_t entries() const noexcept;
+
+private:
+  Binning binning_;
+  std::vector<std::uint64_t> counts_;
+};
+
+template <typename BinningX, typename BinningY>
+class histogram2d {
+public:
+  histogram2d(BinningX x, BinningY y);
+
+  BinningX const& binning_x() const noexcept;
+  BinningY const& binning_y() const noexcept;
+  void fill(double x, double y) noexcept;
+  template <typename T, typename U>
+  void fill(std::span<T const> xs, std::span<U const> ys);
+  void merge(histogram2d const& other);
+  histogram2d empty_copy() const;
+
+  // The count in bin (ix, iy), both including the underflow and overflow.
+  std::uint64_t count(std::size_t ix, std::size_t iy) const noexcept;
+  std::uint64_t entries() const noexcept;
+
+private:
+  BinningX x_;
+  BinningY y_;
+  std::size_t stride_;
+  std::vector<std::uint64_t> counts_;
+};
+
+// Fill 'h' with the values, using nthreads private histograms.
+template <typename Binning, typename T>
+void fill_parallel(histogram1d<Binning>& h,
+                   std::span<T const> xs,
+                   std::size_t nthreads);
+template <typename BinningX, typename BinningY, typename T, typename U>
+void fill_parallel(histogram2d<BinningX, BinningY>& h,
+                   std::span<T const> xs,
+                   std::span<U const> ys,
+                   std::size_t nthreads);
+
+// Fill 'h' with the photon counts of a channel, in any layout.
+template <typename Binning, typename S>
+void fill_nphots(histogram1d<Binning>& h, S const& s);
+
+// Write the histogram as TSV with columns lo, hi, count; the underflow and
+// overflow rows have lo = -inf and hi = inf respectively.
+template <typename Binning>
+void write_tsv(histogram1d<Binning> const& h, std::ostream& out);
+// Columns x_lo, x_hi, y_lo, y_hi, count; only non-empty bins are written.
+template <typename BinningX, typename BinningY>
+void write_tsv(histogram2d<BinningX, BinningY> const& h, std::ostream& out);
+
+////////////////////////////////////////////
+// Implementation
+
+inline fixed_binning::fixed_binning(std::size_t nbins, double lo, double hi)
+  : nbins_(nbins), lo_(lo), hi_(hi), scale_(nbins / (hi - lo))
+{
+  if (nbins == 0 || !(lo < hi))
+    throw std::invalid_argument("fixed_binning needs nbins > 0 and lo < hi");
+}
+
+inline std::size_t
+fixed_binning::nbins() const noexcept
+{
+  return nbins_;
+}
+
+inline double
+fixed_binning::lower_edge(std::size_t bin) const noexcept
+{
+  if (bin == 0)
+    return -INFINITY;
+  return lo_ + (bin - 1) * (hi_ - lo_) / nbins_;
+}
+
+// The bin is floor((x - lo) * scale) + 1, clamped to [0, nbins + 1], and 0
+// for NaN, which fails every comparison. It is written with comparisons
+// rather than std::clamp and std::floor so that the loops below vectorize;
+// truncation equals floor after the clamp to >= 0.
+inline std::size_t
+fixed_binning::index(double x) const noexcept
+{
+  double const top = static_cast<double>(nbins_ + 1);
+  double b = (x - lo_) * scale_ + 1.0;
+  b = !(b >= 0.0) ? 0.0 : b;
+  b = b > top ? top : b;
+  return static_cast<std::size_t>(b);
+}
+
+MULTIVERSION inline void
+fixed_binning::indices(std::span<int const> xs,
+                       std::uint32_t* out) const noexcept
+{
+  double const lo = lo_;
+  double const scale = scale_;
+  double const top = static_cast<double>(nbins_ + 1);
+  for (std::size_t i = 0; i != xs.size(); ++i) {
+    double b = (xs[i] - lo) * scale + 1.0;
+    b = !(b >= 0.0) ? 0.0 : b;
+    b = b > top ? top : b;
+    out[i] = static_cast<std::uint32_t>(b);
+  }
+}
+
+MULTIVERSION inline void
+fixed_binning::indices(std::span<double const> xs,
+                       std::uint32_t* out) const noexcept
+{
+  double const lo = lo_;
+  double const scale = scale_;
+  double const top = static_cast<double>(nbins_ + 1);
+  for (std::size_t i = 0; i != xs.size(); ++i) {
+    double b = (xs[i] - lo) * scale + 1.0;
+    b = !(b >= 0.0) ? 0.0 : b;
+    b = b > top ? top : b;
+    out[i] = static_cast<std::uint32_t>(b);
+  }
+}
+
+inline log_binning::log_binning(std::size_t nbins, double lo, double hi)
+  : log_bins_(nbins, std::log(lo), std::log(hi))
+{
+  if (!(lo > 0.0))
+    throw std::invalid_argument("log_binning needs lo > 0");
+}
+
+inline std::size_t
+log_binning::nbins() const noexcept
+{
+  return log_bins_.nbins();
+}
+
+inline double
+log_binning::lower_edge(std::size_t bin) const noexcept
+{
+  return bin == 0 ? -INFINITY : std::exp(log_bins_.lower_edge(bin));
+}
+
+inline std::size_t
+log_binning::index(double x) const noexcept
+{
+  return x > 0.0 ? log_bins_.index(std::log(x)) : 0;
+}
+
+inline void
+log_binning::indices(std::span<int const> xs, std::uint32_t* out) const noexcept
+{
+  // Non-positive values become -inf, which is an underflow.
+  double logs[256];
+  for (std::size_t i = 0; i < xs.size(); i += 256) {
+    std::size_t const n = std::min<std::size_t>(256, xs.size() - i);
+    for (std::size_t j = 0; j != n; ++j) {
+      logs[j] = xs[i + j] > 0 ? std::log(xs[i + j]) : -INFINITY;
+    }
+    log_bins_.indices(std::span<double const>(logs, n), out + i);
+  }
+}
+
+inline void
+log_binning::indices(std::span<double const> xs,
+                     std::uint32_t* out) const noexcept
+{
+  double logs[256];
+  for (std::size_t i = 0; i < xs.size(); i += 256) {
+    std::size_t const n = std::min<std::size_t>(256, xs.size() - i);
+    for (std::size_t j = 0; j != n; ++j) {
+      logs[j] = xs[i + j] > 0.0 ? std::log(xs[i + j]) : -INFINITY;
+    }
+    log_bins_.indices(std::span<double const>(logs, n), out + i);
+  }
+}
+
+template <typename Binning>
+histogram1d<Binning>::histogram1d(Binning binning)
+  : binning_(binning), counts_(binning.nbins() + 2, 0)
+{}
+
+template <typename Binning>
+Binning const&
+histogram1d<Binning>::binning() const noexcept
+{
+  return binning_;
+}
+
+template <typename Binning>
+void
+histogram1d<Binning>::fill(double x) noexcept
+{
+  ++counts_[binning_.index(x)];
+}
+
+template <typename Binning>
+template <typename T>
+void
+histogram1d<Binning>::fill(std::span<T const> xs)
+{
+  // Compute the indices a block at a time, so they stay in L1.
+  std::uint32_t idx[256];
+  for (std::size_t i = 0; i < xs.size(); i += 256) {
+    std::size_t const n = std::min<std::size_t>(256, xs.size() - i);
+    binning_.indices(xs.subspan(i, n), idx);
+    for (std::size_t j = 0; j != n; ++j) {
+      ++counts_[idx[j]];
+    }
+  }
+}
+
+template <typename Binning>
+void
+histogram1d<Binning>::merge(histogram1d const& other)
+{
+  if (!(binning_ == other.binning_))
+    throw std::invalid_argument("merging histograms with different binning");
+  for (std::size_t i = 0; i != counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+}
+
+template <typename Binning>
+histogram1d<Binning>
+histogram1d<Binning>::empty_copy() const
+{
+  return histogram1d(binning_);
+}
+
+template <typename Binning>
+std::span<std::uint64_t const>
+histogram1d<Binning>::counts() const noexcept
+{
+  return counts_;
+}
+
+template <typename Binning>
+std::uint64_t
+histogram1d<Binning>::entries() const noexcept
+{
+  std::uint64_t total = 0;
+  for (auto c : counts_) {
+    total += c;
+  }
+  return total;
+}
+
+template <typename BinningX, typename BinningY>
+histogram2d<BinningX, BinningY>::histogram2d(BinningX x, BinningY y)
+  : x_(x)
+  , y_(y)
+  , stride_(y.nbins() + 2)
+  , counts_((x.nbins() + 2) * stride_, 0)
+{}
+
+template <typename BinningX, typename BinningY>
+BinningX const&
+histogram2d<BinningX, BinningY>::binning_x() const noexcept
+{
+  return x_;
+}
+
+template <typename BinningX, typename BinningY>
+BinningY const&
+histogram2d<BinningX, BinningY>::binning_y() const noexcept
+{
+  return y_;
+}
+
+template <typename BinningX, typename BinningY>
+void
+histogram2d<BinningX, BinningY>::fill(double x, double y) noexcept
+{
+  ++counts_[x_.index(x) * stride_ + y_.index(y)];
+}
+
+template <typename BinningX, typename BinningY>
+template <typename T, typename U>
+void
+histogram2d<BinningX, BinningY>::fill(std::span<T const> xs,
+                                      std::span<U const> ys)
+{
+  if (xs.size() != ys.size())
+    throw std::invalid_argument("histogram2d::fill needs equal lengths");
+  std::uint32_t ix[256];
+  std::uint32_t iy[256];
+  for (std::size_t i = 0; i < xs.size(); i += 256) {
+    std::size_t const n = std::min<std::size_t>(256, xs.size() - i);
+    x_.indices(xs.subspan(i, n), ix);
+    y_.indices(ys.subspan(i, n), iy);
+    for (std::size_t j = 0; j != n; ++j) {
+      ++counts_[ix[j] * stride_ + iy[j]];
+    }
+  }
+}
+
+template <typename BinningX, typename BinningY>
+void
+histogram2d<BinningX, BinningY>::merge(histogram2d const& other)
+{
+  if (!(x_ == other.x_) || !(y_ == other.y_))
+    throw std::invalid_argument("merging histograms with different binning");
+  for (std::size_t i = 0; i != counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+}
+
+template <typename BinningX, typename BinningY>
+histogram2d<BinningX, BinningY>
+histogram2d<BinningX, BinningY>::empty_copy() const
+{
+  return histogram2d(x_, y_);
+}
+
+template <typename BinningX, typename BinningY>
+std::uint64_t
+histogram2d<BinningX, BinningY>::count(std::size_t ix,
+                                       std::size_t iy) const noexcept
+{
+  return counts_[ix * stride_ + iy];
+}
+
+template <typename BinningX, typename BinningY>
+std::uint64_t
+histogram2d<BinningX, BinningY>::entries() const noexcept
+{
+  std::uint64_t total = 0;
+  for (auto c : counts_) {
+    total += c;
+  }
+  return total;
+}
+
+namespace histogram_detail {
+  // Give each thread its static_partition of [0, n) and a private copy of
+  // 'h' to fill with fill_range(copy, begin, end), then merge the copies.
+  template <typename H, typename F>
+  void
+  fill_partitioned(H& h, std::size_t n, std::size_t nthreads, F fill_range)
+  {
+    nthreads = std::max<std::size_t>(1, std::min(nthreads, n));
+    std::vector<H> partial(nthreads, h.empty_copy());
+    parallel_for(nthreads, [&](std::size_t t) {
+      auto const [begin, end] = static_partition(n, nthreads, t);
+      fill_range(partial[t], begin, end);
+    });
+    for (auto const& p : partial) {
+      h.merge(p);
+    }
+  }
+}
+
+template <typename Binning, typename T>
+void
+fill_parallel(histogram1d<Binning>& h,
+              std::span<T const> xs,
+              std::size_t nthreads)
+{
+  histogram_detail::fill_partitioned(
+    h,
+    xs.size(),
+    nthreads,
+    [xs](histogram1d<Binning>& p, std::size_t begin, std::size_t end) {
+      p.fill(xs.subspan(begin, end - begin));
+    });
+}
+
+template <typename BinningX, typename BinningY, typename T, typename U>
+void
+fill_parallel(histogram2d<BinningX, BinningY>& h,
+              std::span<T const> xs,
+              std::span<U const> ys,
+              std::size_t nthreads)
+{
+  if (xs.size() != ys.size())
+    throw std::invalid_argument("fill_parallel needs equal lengths");
+  histogram_detail::fill_partitioned(
+    h,
+    xs.size(),
+    nthreads,
+    [xs, ys](histogram2d<BinningX, BinningY>& p,
+             std::size_t begin,
+             std::size_t end) {
+      p.fill(xs.subspan(begin, end - begin), ys.subspan(begin, end - begin));
+    });
+}
+
+template <typename Binning, typename S>
+void
+fill_nphots(histogram1d<Binning>& h, S const& s)
+{
+  if constexpr (soa_layout<S>) {
+    if constexpr (std::ranges::contiguous_range<decltype(s.nphots)>) {
+      h.fill(std::span<int const>(std::ranges::data(s.nphots),
+                                  std::ranges::size(s.nphots)));
+    } else {
+      for (int n : s.nphots) {
+        h.fill(n);
+      }
+    }
+  } else {
+    for (auto const& r : s) {
+      h.fill(r.second);
+    }
+  }
+}
+
+template <typename Binning>
+void
+write_tsv(histogram1d<Binning> const& h, std::ostream& out)
+{
+  auto const& b = h.binning();
+  out << "lo\thi\tcount\n";
+  auto const counts = h.counts();
+  for (std::size_t i = 0; i != counts.size(); ++i) {
+    double const hi = i + 1 == counts.size() ? INFINITY : b.lower_edge(i + 1);
+    out << b.lower_edge(i) << '\t' << hi << '\t' << counts[i] << '\n';
+  }
+}
+
+template <typename BinningX, typename BinningY>
+void
+write_tsv(histogram2d<BinningX, BinningY> const& h, std::ostream& out)
+{
+  auto const& bx = h.binning_x();
+  auto const& by = h.binning_y();
+  auto upper = [](auto const& b, std::size_t i) {
+    return i == b.nbins() + 1 ? INFINITY : b.lower_edge(i + 1);
+  };
+  out << "x_lo\tx_hi\ty_lo\ty_hi\tcount\n";
+  for (std::size_t ix = 0; ix != bx.nbins() + 2; ++ix) {
+    for (std::size_t iy = 0; iy != by.nbins() + 2; ++iy) {
+      if (auto const c = h.count(ix, iy); c != 0)
+        out << bx.lower_edge(ix) << '\t' << upper(bx, ix) << '\t'
+            << by.lower_edge(iy) << '\t' << upper(by, iy) << '\t' << c << '\n';
+    }
+  }
+}
@@ -0,0 +1,139 @@
+// Benchmark histogram filling: one value at a time, batched (vectorized bin
+// indices), and in parallel with per-thread histograms; and filling straight
+// from channel containers.
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "data_structures.hh"
+#include "fill_functions.hh"
+#include "histogram.hh"
+
+// Photon counts are roughly exponential, like the real ones.
+std::vector<int>
+make_nphots(std::size_t n, unsigned long long seed)
+{
+  std::minstd_rand0 engine(seed);
+  std::exponential_distribution<double> dist{0.05};
+  std::vector<int> result(n);
+  for (auto& x : result) {
+    x = 1 + static_cast<int>(dist(engine));
+  }
+  return result;
+}
+
+// The batched and parallel paths must count exactly what the scalar one does.
+template <typename Binning>
+bool
+same_counts(Binning const& b, std::vector<int> const& xs, std::size_t nthreads)
+{
+  histogram1d<Binning> scalar(b);
+  for (int x : xs) {
+    scalar.fill(x);
+  }
+  histogram1d<Binning> batched(b);
+  batched.fill(std::span<int const>(xs));
+  histogram1d<Binning> parallel(b);
+  fill_parallel(parallel, std::span<int const>(xs), nthreads);
+  return std::ranges::equal(scalar.counts(), batched.counts()) &&
+         std::ranges::equal(scalar.counts(), parallel.counts());
+}
+
+// NaN (the mean time of a channel without photons), infinities and huge
+// values go to the underflow and overflow bins, in the batched path as in
+// the scalar one.
+template <typename Binning>
+bool
+special_values_counted(Binning const& b)
+{
+  std::vector<double> xs = {std::nan(""), -INFINITY, -1e300, 50.0};
+  xs.insert(xs.end(), {INFINITY, 1e300, -std::nan("")});
+  // Enough copies for the vectorized loop, and a remainder.
+  for (std::size_t i = 0; i != 5; ++i) {
+    xs.insert(xs.end(), xs.begin(), xs.begin() + 7);
+  }
+  histogram1d<Binning> scalar(b);
+  for (double x : xs) {
+    scalar.fill(x);
+  }
+  histogram1d<Binning> batched(b);
+  batched.fill(std::span<double const>(xs));
+  auto const& counts = batched.counts();
+  return std::ranges::equal(scalar.counts(), counts) &&
+         counts.front() == 4 * 6 && counts.back() == 2 * 6 &&
+         batched.entries() == xs.size();
+}
+
+template <typename Binning>
+void
+run_benches(ankerl::nanobench::Bench* bench,
+            Binning const& b,
+            std::vector<int> const& xs,
+            std::size_t nthreads,
+            std::string const& suffix)
+{
+  histogram1d<Binning> h(b);
+  bench->run("scalar_" + suffix, [&]() {
+    for (int x : xs) {
+      h.fill(x);
+    }
+  });
+  bench->run("batched_" + suffix,
+             [&]() { h.fill(std::span<int const>(xs)); });
+  bench->run(fmt::format("parallel{}_{}", nthreads, suffix), [&]() {
+    fill_parallel(h, std::span<int const>(xs), nthreads);
+  });
+  ankerl::nanobench::doNotOptimizeAway(h.entries());
+}
+
+template <typename S>
+void
+run_container(ankerl::nanobench::Bench* bench,
+              std::size_t n,
+              std::string const& name)
+{
+  S s;
+  fill(s, n);
+  histogram1d h(fixed_binning(100, 0.0, 1000.0));
+  bench->run("container_" + name, [&]() { fill_nphots(h, s); });
+  ankerl::nanobench::doNotOptimizeAway(h.entries());
+}
+
+int
+main()
+{
+  std::size_t const n = 1'000'000;
+  std::size_t const nthreads =
+    std::max(1u, std::thread::hardware_concurrency());
+  auto const xs = make_nphots(n, 123);
+  fixed_binning const fixed(100, 0.0, 200.0);
+  log_binning const logb(50, 1.0, 1.0e4);
+
+  std::cout << "cpu dispatch: " << selected_isa() << '\n'
+            << "batched/parallel counts match scalar: fixed "
+            << same_counts(fixed, xs, nthreads) << ", log "
+            << same_counts(logb, xs, nthreads) << '\n'
+            << "NaN and infinities counted as under/overflows: fixed "
+            << special_values_counted(fixed) << ", log "
+            << special_values_counted(logb) << '\n';
+
+  ankerl::nanobench::Bench b;
+  b.title("histogram fill").unit("value").batch(n).minEpochIterations(5);
+  run_benches(&b, fixed, xs, nthreads, "fixed");
+  run_benches(&b, logb, xs, nthreads, "log");
+
+  std::size_t const nm = 10000;
+  b.batch(nm).minEpochIterations(100);
+  run_container<aos_vector>(&b, nm, "aosv");
+  run_container<soa_vector>(&b, nm, "soav");
+  run_container<soa_deq>(&b, nm, "soad");
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "data_structures.hh"
+#include "parallel.hh"
+
+// How huge_page_allocator obtains memory for large allocations.
+//
+//   transparent: 2 MB aligned anonymous memory, marked with
+//                madvise(MADV_HUGEPAGE) so the kernel backs it with
+//                transparent huge pages.
+//   hugetlb:     memory from the hugetlbfs pool (MAP_HUGETLB), which must
+//                have been reserved by the administrator (vm.nr_hugepages);
+//                falls back to 'transparent' if the pool is empty.
+enum class huge_pages { transparent, hugetlb };
+
+// Allocator for the large flat buffers holding a whole event's photons.
+//
+// Allocations of at least one huge page are 2 MB aligned and backed by huge
+// pages, which removes most dTLB misses when scanning hundreds of MB.
+// Smaller allocations come from operator new, cache-line aligned.
+//
+// construct() with no arguments default-initializes, so resizing a vector
+// does not write to its memory. The pages are then placed on the NUMA node
+// of the thread that first writes to them (Linux "first touch"); see
+// first_touch below. On platforms other than Linux, large allocations are
+// just cache-line aligned.
+template <typename T, huge_pages Mode = huge_pages::transparent>
+struct huge_page_allocator {
+  using value_type = T;
+  static constexpr std::size_t huge_page_size = std::size_t{2} << 20;
+
+  template <typename U>
+  struct rebind {
+    using other = huge_page_allocator<U, Mode>;
+  };
+
+  huge_page_allocator() = default;
+  template <typename U>
+  huge_page_allocator(huge_page_allocator<U, Mode> const&) noexcept
+  {}
+
+  T* allocate(std::size_t n);
+  void deallocate(T* p, std::size_t n) noexcept;
+
+  template <typename U>
+  void
+  construct(U* p) noexcept(noexcept(::new(static_cast<void*>(p)) U))
+  {
+    ::new (static_cast<void*>(p)) U;
+  }
+
+  template <typename U, typename... Args>
+  void
+  construct(U* p, Args&&... args)
+  {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool
+  operator==(huge_page_allocator<U, Mode> const&) const noexcept
+  {
+    return true;
+  }
+
+private:
+  static constexpr std::align_val_t small_alignment{64};
+
+  // The decision depends only on n, so deallocate makes the same one.
+  static bool
+  is_huge(std::size_t n) noexcept
+  {
+    return n * sizeof(T) >= huge_page_size;
+  }
+
+  static std::size_t
+  rounded_bytes(std::size_t n) noexcept
+  {
+    return (n * sizeof(T) + huge_page_size - 1) & ~(huge_page_size - 1);
+  }
+};
+
+#if defined(__linux__)
+template <typename T, huge_pages Mode>
+T*
+huge_page_allocator<T, Mode>::allocate(std::size_t n)
+{
+  if (!is_huge(n))
+    return static_cast<T*>(::operator new(n * sizeof(T), small_alignment));
+
+  std::size_t const bytes = rounded_bytes(n);
+  if constexpr (Mode == huge_pages::hugetlb) {
+    void* p = mmap(nullptr,
+                   bytes,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1,
+                   0);
+    if (p != MAP_FAILED)
+      return static_cast<T*>(p);
+  }
+
+  // Over-allocate by one huge page, and unmap the unaligned head and tail.
+  std::size_t const mapped = bytes + huge_page_size;
+  void* p = mmap(
+    nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::bad_alloc();
+  auto const start = reinterpret_cast<std::uintptr_t>(p);
+  auto const aligned = (start + huge_page_size - 1) & ~(huge_page_size - 1);
+  if (aligned != start)
+    munmap(p, aligned - start);
+  if (std::size_t const tail = start + mapped - (aligned + bytes); tail != 0)
+    munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+  madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+  return reinterpret_cast<T*>(aligned);
+}
+
+template <typename T, huge_pages Mode>
+void
+huge_page_allocator<T, Mode>::deallocate(T* p, std::size_t n) noexcept
+{
+  if (!is_huge(n)) {
+    ::operator delete(p, small_alignment);
+    return;
+  }
+  munmap(p, rounded_bytes(n));
+}
+#else
+template <typename T, huge_pages Mode>
+T*
+huge_page_allocator<T, Mode>::allocate(std::size_t n)
+{
+  return static_cast<T*>(::operator new(n * sizeof(T), small_alignment));
+}
+
+template <typename T, huge_pages Mode>
+void
+huge_page_allocator<T, Mode>::deallocate(T* p, std::size_t) noexcept
+{
+  ::operator delete(p, small_alignment);
+}
+#endif
+
+template <typename T>
+using huge_vector = std::vector<T, huge_page_allocator<T>>;
+
+using soa_hvector = simphotons<soa, huge_vector>;
+
+// Initialize 'data' from nthreads threads, thread i writing the range
+// static_partition(data.size(), nthreads, i). Used on memory from
+// huge_page_allocator, this places each range on the NUMA node of the thread
+// that will process it, provided the processing loop uses the same partition
+// and the same pinning.
+template <typename T>
+void
+first_touch(std::span<T> data, std::size_t nthreads, bool pin = true)
+{
+  parallel_for(
+    nthreads,
+    [data, nthreads](std::size_t i) {
+      auto const [begin, end] = static_partition(data.size(), nthreads, i);
+      std::fill(data.begin() + begin, data.begin() + end, T{});
+    },
+    pin);
+}
@@ -0,0 +1,159 @@
+// Measure the scan bandwidth and dTLB miss rate over a large flat event
+// buffer, with and without huge pages and first-touch NUMA placement.
+//
+// Usage: huge_pages_t [megabytes] [threads] [repetitions]
+//
+// The buffer holds the nphots of a whole event. Each configuration is scanned
+// 'repetitions' times by 'threads' pinned threads, each summing its own
+// static_partition of the buffer; the median time is reported.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+
+#include "cpu_dispatch.hh"
+#include "huge_page_allocator.hh"
+#include "parallel.hh"
+#include "perf_counter.hh"
+
+template <typename T>
+using hugetlb_vector =
+  std::vector<T, huge_page_allocator<T, huge_pages::hugetlb>>;
+
+struct scan_result {
+  double seconds = 0.0;
+  double dtlb_misses = 0.0;
+  double dtlb_loads = 0.0;
+};
+
+MULTIVERSION long long
+sum_range(int const* data, std::size_t n)
+{
+  long long sum = 0;
+  for (std::size_t i = 0; i != n; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+scan_result
+scan(std::span<int const> data, std::size_t nthreads, int repetitions)
+{
+  std::vector<double> times;
+  std::vector<double> misses;
+  std::vector<double> loads;
+  std::vector<long long> partial(nthreads);
+  for (int rep = 0; rep != repetitions; ++rep) {
+    auto miss_counter = perf_counter::dtlb_load_misses();
+    auto load_counter = perf_counter::dtlb_loads();
+    miss_counter.start();
+    load_counter.start();
+    auto const t0 = std::chrono::steady_clock::now();
+    parallel_for(
+      nthreads,
+      [&](std::size_t i) {
+        auto const [begin, end] = static_partition(data.size(), nthreads, i);
+        partial[i] = sum_range(data.data() + begin, end - begin);
+      },
+      true);
+    auto const t1 = std::chrono::steady_clock::now();
+    misses.push_back(miss_counter.stop());
+    loads.push_back(load_counter.stop());
+    times.push_back(std::chrono::duration<double>(t1 - t0).count());
+  }
+  auto median = [](std::vector<double>& v) {
+    std::ranges::nth_element(v, v.begin() + v.size() / 2);
+    return v[v.size() / 2];
+  };
+  return {median(times), median(misses), median(loads)};
+}
+
+void
+report(std::string const& name,
+       scan_result const& r,
+       std::size_t n,
+       bool have_counters)
+{
+  double const bytes = static_cast<double>(n) * sizeof(int);
+  std::string const tlb =
+    have_counters ?
+      fmt::format("{:>14.1f} | {:>9.4f}%",
+                  r.dtlb_misses / (bytes / 4096.0),
+                  r.dtlb_loads > 0 ? 100.0 * r.dtlb_misses / r.dtlb_loads :
+                                     0.0) :
+      fmt::format("{:>14} | {:>10}", "n/a", "n/a");
+  fmt::print("| {:>10.2f} | {:>10.3f} | {} | `{}`\n",
+             bytes / r.seconds / 1e9,
+             r.seconds * 1e3,
+             tlb,
+             name);
+}
+
+template <typename V>
+void
+run_config(std::string const& name,
+           std::size_t n,
+           std::size_t nthreads,
+           int repetitions,
+           bool parallel_touch,
+           bool have_counters)
+{
+  V v;
+  v.resize(n);
+  std::span<int> data(v.data(), v.size());
+  if (parallel_touch)
+    first_touch(data, nthreads);
+  else
+    std::fill(data.begin(), data.end(), 0);
+  // Give the photons non-zero values, using the same partition as the scan.
+  parallel_for(
+    nthreads,
+    [&](std::size_t i) {
+      auto const [begin, end] = static_partition(n, nthreads, i);
+      for (std::size_t j = begin; j != end; ++j) {
+        data[j] = static_cast<int>(j & 0xff);
+      }
+    },
+    true);
+  report(name, scan(data, nthreads, repetitions), n, have_counters);
+}
+
+int
+main(int argc, char** argv)
+{
+  std::size_t const megabytes = argc > 1 ? std::atol(argv[1]) : 512;
+  std::size_t const nthreads =
+    argc > 2 ? std::atol(argv[2]) :
+               std::max(1u, std::thread::hardware_concurrency());
+  int const repetitions = argc > 3 ? std::atoi(argv[3]) : 10;
+  std::size_t const n = megabytes * 1024 * 1024 / sizeof(int);
+
+  bool const have_counters = perf_counter::dtlb_load_misses().valid();
+  std::cout << "cpu dispatch: " << selected_isa() << '\n'
+            << "buffer: " << megabytes << " MB, threads: " << nthreads
+            << ", repetitions: " << repetitions << '\n';
+  if (!have_counters)
+    std::cout << "dTLB counters unavailable (check perf_event_paranoid)\n";
+
+  fmt::print("| {:>10} | {:>10} | {:>14} | {:>10} | {}\n",
+             "GB/s",
+             "ms/scan",
+             "dTLB miss/4KB",
+             "miss%",
+             "huge pages");
+  fmt::print("|-----------:|-----------:|---------------:|-----------:|:---\n");
+  run_config<std::vector<int>>(
+    "std_vector", n, nthreads, repetitions, false, have_counters);
+  run_config<huge_vector<int>>(
+    "thp_serial_touch", n, nthreads, repetitions, false, have_counters);
+  run_config<huge_vector<int>>(
+    "thp_first_touch", n, nthreads, repetitions, true, have_counters);
+  run_config<hugetlb_vector<int>>(
+    "hugetlb_first_touch", n, nthreads, repetitions, true, have_counters);
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// hybrid_channel holds the measurements of one channel, choosing when it is
+// built between two representations, based on the density of the ticks:
+//
+//   dense:  nphots[tick - tick_min] for every tick in [tick_min, tick_max];
+//           the ticks are implicit, and ticks with no measurement (the gaps)
+//           hold 0. A bitmap tells the gaps from measurements of 0 photons.
+//   sparse: sorted ticks and nphots in parallel vectors, as in soa_vector.
+//
+// Busy channels have nearly contiguous ticks inside a burst. For them the
+// dense form removes the ticks stream completely and makes lookups O(1).
+// Quiet channels stay sparse.
+//
+// The density is the number of measurements divided by the number of ticks
+// they span. The dense form uses 4 bytes per spanned tick and the sparse form
+// 8 bytes per measurement, so the default threshold of 0.5 picks whichever is
+// smaller.
+class hybrid_channel {
+public:
+  static constexpr double default_min_density = 0.5;
+
+  hybrid_channel() = default;
+
+  // Replace the contents with the given measurements. 'ticks' must be sorted
+  // in increasing order, without duplicates, and have the same length as
+  // 'nphots'. The dense form is used if the density is at least
+  // 'min_density'.
+  void assign(std::span<int const> ticks,
+              std::span<int const> nphots,
+              double min_density = default_min_density);
+
+  void clear() noexcept;
+
+  bool is_dense() const noexcept;
+  bool empty() const noexcept;
+  // Number of measurements (not the number of spanned ticks).
+  std::size_t size() const noexcept;
+
+  // Number of photons at the given tick, or 0 if there is no measurement.
+  int at_tick(int tick) const noexcept;
+
+  // Used by sum and find_largest. In the dense form, ticks() is empty and the
+  // tick of nphots()[i] is tick_min() + i.
+  int tick_min() const noexcept;
+  std::vector<int> const& ticks() const noexcept;
+  std::vector<int> const& nphots() const noexcept;
+  // In the dense form, bit i % 64 of measured()[i / 64] is set if
+  // nphots()[i] is a measurement rather than a gap; empty in the sparse
+  // form.
+  std::vector<std::uint64_t> const& measured() const noexcept;
+
+private:
+  int tick_min_ = 0;
+  std::size_t nmeas_ = 0;
+  std::vector<int> ticks_;
+  std::vector<int> nphots_;
+  std::vector<std::uint64_t> measured_;
+};
+
+inline void
+hybrid_channel::clear() noexcept
+{
+  tick_min_ = 0;
+  nmeas_ = 0;
+  ticks_.clear();
+  nphots_.clear();
+  measured_.clear();
+}
+
+inline bool
+hybrid_channel::is_dense() const noexcept
+{
+  return ticks_.empty() && !nphots_.empty();
+}
+
+inline bool
+hybrid_channel::empty() const noexcept
+{
+  return nmeas_ == 0;
+}
+
+inline std::size_t
+hybrid_channel::size() const noexcept
+{
+  return nmeas_;
+}
+
+inline int
+hybrid_channel::tick_min() const noexcept
+{
+  return tick_min_;
+}
+
+inline std::vector<int> const&
+hybrid_channel::ticks() const noexcept
+{
+  return ticks_;
+}
+
+inline std::vector<int> const&
+hybrid_channel::nphots() const noexcept
+{
+  return nphots_;
+}
+
+inline std::vector<std::uint64_t> const&
+hybrid_channel::measured() const noexcept
+{
+  return measured_;
+}
+
+inline void
+hybrid_channel::assign(std::span<int const> ticks,
+                       std::span<int const> nphots,
+                       double min_density)
+{
+  assert(ticks.size() == nphots.size());
+  clear();
+  if (ticks.empty())
+    return;
+
+  nmeas_ = ticks.size();
+  tick_min_ = ticks.front();
+  // Use a wide type: the span of int ticks can overflow an int.
+  long long const span = static_cast<long long>(ticks.back()) - tick_min_ + 1;
+  double const density = static_cast<double>(nmeas_) / span;
+
+  if (density >= min_density) {
+    nphots_.assign(span, 0);
+    measured_.assign((span + 63) / 64, 0);
+    for (std::size_t i = 0; i != nmeas_; ++i) {
+      std::size_t const slot = ticks[i] - tick_min_;
+      nphots_[slot] = nphots[i];
+      measured_[slot / 64] |= std::uint64_t{1} << slot % 64;
+    }
+    return;
+  }
+  ticks_.assign(ticks.begin(), ticks.end());
+  nphots_.assign(nphots.begin(), nphots.end());
+}
+
+inline int
+hybrid_channel::at_tick(int tick) const noexcept
+{
+  if (is_dense()) {
+    // Unsigned comparison checks both ends of the range at once.
+    auto const idx = static_cast<unsigned long long>(
+      static_cast<long long>(tick) - tick_min_);
+    return idx < nphots_.size() ? nphots_[idx] : 0;
+  }
+  auto const it = std::ranges::lower_bound(ticks_, tick);
+  if (it == ticks_.end() || *it != tick)
+    return 0;
+  return nphots_[it - ticks_.begin()];
+}
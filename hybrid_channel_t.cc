@@ -0,0 +1,97 @@
+// Benchmark the adaptive dense/sparse hybrid_channel against soa_vector, for
+// channels of different tick densities.
+#include <array>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "data_structures.hh"
+#include "hybrid_channel.hh"
+#include "operations.hh"
+
+// Make n sorted ticks whose density (measurements per spanned tick) is
+// approximately 'density', and the matching photon counts.
+soa_vector
+make_channel(std::size_t n, double density, unsigned long long seed)
+{
+  std::minstd_rand0 engine(seed);
+  std::bernoulli_distribution keep{density};
+  std::uniform_int_distribution<int> dist{0, 10000};
+  soa_vector result;
+  int tick = 0;
+  while (result.ticks.size() != n) {
+    if (keep(engine)) {
+      result.ticks.push_back(tick);
+      result.nphots.push_back(dist(engine));
+    }
+    ++tick;
+  }
+  return result;
+}
+
+// Ticks to look up, uniformly spread over the span of the channel; for sparse
+// channels most of them are misses.
+std::vector<int>
+make_queries(soa_vector const& s, std::size_t nq, unsigned long long seed)
+{
+  std::minstd_rand0 engine(seed);
+  std::uniform_int_distribution<int> dist{s.ticks.front(), s.ticks.back()};
+  std::vector<int> queries(nq);
+  for (auto& q : queries) {
+    q = dist(engine);
+  }
+  return queries;
+}
+
+template <typename S>
+void
+run_benches(ankerl::nanobench::Bench* bench,
+            S const& m,
+            std::vector<int> const& queries,
+            std::string const& suffix)
+{
+  int s = 0;
+  bench->run("sum_" + suffix, [&]() { s = sum(m); });
+  ankerl::nanobench::doNotOptimizeAway(s);
+
+  result_t r;
+  bench->run("scan_" + suffix, [&]() { r = find_largest(m); });
+  ankerl::nanobench::doNotOptimizeAway(r);
+
+  bench->batch(queries.size()).run("find_" + suffix, [&]() {
+    for (int q : queries) {
+      s += lookup(m, q);
+    }
+  });
+  bench->batch(1);
+  ankerl::nanobench::doNotOptimizeAway(s);
+}
+
+int
+main()
+{
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  ankerl::nanobench::Bench b;
+  b.title("hybrid channel").performanceCounters(true).minEpochIterations(1000);
+
+  std::size_t const n = 3000;
+  std::array<double, 6> densities = {1.0, 0.75, 0.5, 0.25, 0.1, 0.01};
+  for (double density : densities) {
+    auto const soa_v = make_channel(n, density, 123);
+    auto const queries = make_queries(soa_v, 1000, 456);
+    hybrid_channel hyb;
+    hyb.assign(soa_v.ticks, soa_v.nphots);
+
+    std::string const pct = std::to_string(static_cast<int>(density * 100));
+    run_benches(&b, soa_v, queries, fmt::format("soav_{}", pct));
+    run_benches(&b,
+                hyb,
+                queries,
+                fmt::format("hyb{}_{}", hyb.is_dense() ? "d" : "s", pct));
+  }
+}
@@ -0,0 +1,116 @@
+// Benchmark sum, find_largest and lookup called in the operations library
+// against the same kernels inlined from operations_inline.hh, for every
+// registered layout and channel sizes from 10 to 10000, and print the cost
+// of the library call per size. Also checks that both give the same results.
+//
+// Both sides of each pair run in the same MULTIVERSION loop, so the inlined
+// kernels are vectorized for the same ISA as the library's. With
+// DUNEPROF_LTO, the library's kernels are inlined as well (see
+// KERNEL_MULTIVERSION in cpu_dispatch.hh), and the pairs should match.
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "fill_functions.hh"
+#include "layout_registry.hh"
+#include "operations.hh"
+#include "operations_inline.hh"
+
+// The calls per iteration of the benchmarks.
+constexpr int batch = 10;
+
+// Calls f batch times, in a MULTIVERSION loop, so that a kernel inlined into
+// f is compiled for the best ISA available at run time, as the library's
+// are. The result is passed to doNotOptimizeAway, which keeps each call in
+// the loop.
+template <typename F>
+MULTIVERSION void
+repeat(F const& f)
+{
+  for (int i = 0; i != batch; ++i) {
+    ankerl::nanobench::doNotOptimizeAway(f());
+  }
+}
+
+// The benchmarks of one layout and size, in pairs: the library call, then
+// the inlined kernel.
+struct paired_run {
+  std::string name;
+  std::size_t n;
+};
+
+template <typename S>
+void
+run_layout(ankerl::nanobench::Bench* bench,
+           std::size_t n,
+           char const* name,
+           std::vector<paired_run>* runs)
+{
+  S s;
+  fill(s, n);
+  int const tick = static_cast<int>(n / 2);
+  result_t const a = find_largest(s);
+  result_t const b = kernels::find_largest(s);
+  bool const same = sum(s) == kernels::sum(s) && a.key == b.key &&
+                    a.value == b.value &&
+                    lookup(s, tick) == kernels::lookup(s, tick);
+  std::cout << name << '_' << n << ": inlined matches library: " << same
+            << '\n';
+
+  bench->run(fmt::format("sum_{}_{}", name, n),
+             [&]() { repeat([&]() { return sum(s); }); });
+  bench->run(fmt::format("sum_{}_{}_inline", name, n),
+             [&]() { repeat([&]() { return kernels::sum(s); }); });
+  runs->push_back({fmt::format("sum_{}", name), n});
+  bench->run(fmt::format("find_largest_{}_{}", name, n),
+             [&]() { repeat([&]() { return find_largest(s); }); });
+  bench->run(fmt::format("find_largest_{}_{}_inline", name, n),
+             [&]() { repeat([&]() { return kernels::find_largest(s); }); });
+  runs->push_back({fmt::format("find_largest_{}", name), n});
+  bench->run(fmt::format("lookup_{}_{}", name, n),
+             [&]() { repeat([&]() { return lookup(s, tick); }); });
+  bench->run(fmt::format("lookup_{}_{}_inline", name, n),
+             [&]() { repeat([&]() { return kernels::lookup(s, tick); }); });
+  runs->push_back({fmt::format("lookup_{}", name), n});
+}
+
+int
+main()
+{
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  ankerl::nanobench::Bench b;
+  b.title("library call vs inlined kernel").unit("call").batch(batch);
+  b.minEpochIterations(100);
+  std::vector<paired_run> runs;
+  for (std::size_t n : {10, 100, 1000, 10000}) {
+    for_each_layout([&](auto const& r) {
+      using S = typename std::remove_cvref_t<decltype(r)>::type;
+      // The cached summary has no kernel to inline.
+      if constexpr (!is_summarized_channel<S>)
+        run_layout<S>(&b, n, r.name, &runs);
+    });
+  }
+
+  // The cost of going through the library, per call and relative to the
+  // inlined kernel. The medians are per iteration, of batch calls.
+  using measure = ankerl::nanobench::Result::Measure;
+  auto const& results = b.results();
+  std::cout << "\nkernel\tsize\tlibrary (ns)\tinline (ns)\toverhead (ns)"
+               "\tratio\n"
+            << std::fixed << std::setprecision(2);
+  for (std::size_t i = 0; i != runs.size(); ++i) {
+    double const library =
+      results[2 * i].median(measure::elapsed) * 1e9 / batch;
+    double const inlined =
+      results[2 * i + 1].median(measure::elapsed) * 1e9 / batch;
+    std::cout << runs[i].name << '\t' << runs[i].n << '\t' << library << '\t'
+              << inlined << '\t' << library - inlined << '\t'
+              << library / inlined << '\n';
+  }
+}
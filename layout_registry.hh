@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+#include "data_structures.hh"
+#include "flat_int_map.hh"
+#include "huge_page_allocator.hh"
+#include "hybrid_channel.hh"
+#include "recycling_map.hh"
+#include "summarized_channel.hh"
+
+// Every SimPhotons implementation we benchmark is registered here, together
+// with the short name used in the benchmark names (e.g. "sum_soav_1000").
+// Adding an entry is all that is needed to have the operations and fill
+// functions instantiated for a new type, and to have the benchmark driver
+// run it.
+template <typename S>
+struct registration {
+  using type = S;
+  char const* name;
+};
+
+inline constexpr std::tuple registered_layouts{
+  // Node-based types
+  registration<std::map<int, int>>{"map"},
+  registration<std::unordered_map<int, int>>{"hashmap"},
+  registration<flat_int_map>{"flatmap"},
+  registration<recycling_map<std::map<int, int>>>{"rmap"},
+  registration<recycling_map<std::unordered_map<int, int>>>{"rhashmap"},
+  // Record-oriented types
+  registration<aos_vector>{"aosv"},
+  registration<aos_deq>{"aosd"},
+  registration<aos_slist>{"aosl"},
+  // Array-oriented types
+  registration<soa_vector>{"soav"},
+  registration<soa_deq>{"soad"},
+  registration<soa_slist>{"soal"},
+  registration<soa_avector>{"soaa"},
+  registration<soa_hvector>{"soah"},
+  // Per-channel adaptive types
+  registration<hybrid_channel>{"hyb"},
+  // Types caching their summary
+  registration<summarized_channel<soa_vector>>{"csoav"}};
+
+using registered_layouts_t = std::remove_const_t<decltype(registered_layouts)>;
+
+// Call f(r) for each registration r, in order of registration.
+template <typename F>
+constexpr void
+for_each_layout(F&& f)
+{
+  std::apply([&f](auto const&... r) { (f(r), ...); }, registered_layouts);
+}
@@ -0,0 +1,197 @@
+// Make the histograms of the validation distributions from a measurement
+// file and, optionally, the per-channel table written by physics_validate.
+//
+// Usage: make_histograms [-j threads] [-o prefix] measurements [channels.tsv]
+//
+// From the measurements (TSV, xz or columnar, see columnar_io.hh):
+//   <prefix>nphot.tsv       photons per measurement, log binning
+//   <prefix>time.tsv        measurement times
+//   <prefix>time_nphot.tsv  times against photons per measurement
+//   <prefix>nmeas.tsv       measurements per channel
+// From the physics_validate channels table, for each variant:
+//   <prefix>dnmeas_<variant>.tsv, <prefix>dnphots_<variant>.tsv
+//     differences from the reference (the first file given to
+//     physics_validate)
+// Each file has the columns written by write_tsv in histogram.hh.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+
+#include "columnar_io.hh"
+#include "histogram.hh"
+
+namespace {
+  void
+  usage(char const* argv0)
+  {
+    std::cerr << "Usage: " << argv0
+              << " [-j threads] [-o prefix] measurements [channels.tsv]\n";
+  }
+
+  template <typename H>
+  void
+  save(H const& h, std::string const& filename)
+  {
+    std::ofstream out(filename);
+    write_tsv(h, out);
+    if (!out)
+      throw std::runtime_error("error writing " + filename);
+    fmt::print("{}: {} entries\n", filename, h.entries());
+  }
+
+  // Bins of width one centred on the integers in [lo, hi], with no more than
+  // max_bins bins (the width grows as needed).
+  fixed_binning
+  integer_binning(int lo, int hi, int max_bins = 400)
+  {
+    int const n = hi - lo + 1;
+    int const width = (n + max_bins - 1) / max_bins;
+    int const nbins = (n + width - 1) / width;
+    return fixed_binning(nbins, lo - 0.5, lo - 0.5 + nbins * width);
+  }
+
+  // The number of measurements of each (run, subrun, event, channel), for
+  // measurements sorted by those columns.
+  std::vector<int>
+  measurements_per_channel(int_table const& t)
+  {
+    std::vector<std::span<int const>> keys;
+    for (char const* name : {"run", "subrun", "event", "channel"}) {
+      keys.emplace_back(t.column(name));
+    }
+    std::vector<int> result;
+    std::size_t const n = t.rows();
+    std::size_t start = 0;
+    for (std::size_t i = 1; i <= n; ++i) {
+      bool const same =
+        i != n && std::ranges::all_of(
+                    keys, [i](auto const& k) { return k[i] == k[i - 1]; });
+      if (!same) {
+        result.push_back(static_cast<int>(i - start));
+        start = i;
+      }
+    }
+    return result;
+  }
+
+  void
+  histogram_measurements(int_table const& t,
+                         std::string const& prefix,
+                         std::size_t nthreads)
+  {
+    auto const& time = t.column("time");
+    auto const& nphot = t.column("nphot");
+    if (time.empty())
+      return;
+    auto const [tmin, tmax] = std::ranges::minmax(time);
+    fixed_binning const time_bins(200, tmin, tmax + 1.0);
+    log_binning const nphot_bins(50, 1.0, 1.0e5);
+
+    histogram1d h_nphot(nphot_bins);
+    fill_parallel(h_nphot, std::span<int const>(nphot), nthreads);
+    save(h_nphot, prefix + "nphot.tsv");
+
+    histogram1d h_time(time_bins);
+    fill_parallel(h_time, std::span<int const>(time), nthreads);
+    save(h_time, prefix + "time.tsv");
+
+    histogram2d h_time_nphot(fixed_binning(100, tmin, tmax + 1.0),
+                             log_binning(25, 1.0, 1.0e5));
+    fill_parallel(h_time_nphot,
+                  std::span<int const>(time),
+                  std::span<int const>(nphot),
+                  nthreads);
+    save(h_time_nphot, prefix + "time_nphot.tsv");
+
+    auto const nmeas = measurements_per_channel(t);
+    histogram1d h_nmeas(integer_binning(1, std::ranges::max(nmeas)));
+    fill_parallel(h_nmeas, std::span<int const>(nmeas), nthreads);
+    save(h_nmeas, prefix + "nmeas.tsv");
+  }
+
+  // Histogram column_<variant> - column_<reference> for each variant.
+  void
+  histogram_differences(int_table const& t,
+                        std::string const& column,
+                        std::string const& prefix,
+                        std::size_t nthreads)
+  {
+    std::string const stem = column + "_";
+    std::vector<std::size_t> found;
+    for (std::size_t i = 0; i != t.names.size(); ++i) {
+      if (t.names[i].starts_with(stem))
+        found.push_back(i);
+    }
+    if (found.size() < 2)
+      return;
+    auto const& ref = t.columns[found.front()];
+    std::vector<int> diff(t.rows());
+    for (std::size_t k = 1; k != found.size(); ++k) {
+      auto const& var = t.columns[found[k]];
+      for (std::size_t i = 0; i != diff.size(); ++i) {
+        diff[i] = var[i] - ref[i];
+      }
+      auto const [dmin, dmax] = std::ranges::minmax(diff);
+      int const range = std::clamp(std::max(-dmin, dmax), 1, 200);
+      histogram1d h(integer_binning(-range, range));
+      fill_parallel(h, std::span<int const>(diff), nthreads);
+      save(h,
+           prefix + "d" + column + "_" +
+             t.names[found[k]].substr(stem.size()) + ".tsv");
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+  std::string prefix;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (std::strcmp(argv[i], "-j") == 0)
+      nthreads = std::max(1l, std::atol(argv[i + 1]));
+    else if (std::strcmp(argv[i], "-o") == 0)
+      prefix = argv[i + 1];
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - i < 1 || argc - i > 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    tsv_options options;
+    options.nthreads = nthreads;
+    auto const t0 = std::chrono::steady_clock::now();
+    auto const measurements = read_measurements(argv[i], options);
+    auto const t1 = std::chrono::steady_clock::now();
+    histogram_measurements(measurements, prefix, nthreads);
+    if (argc - i == 2) {
+      auto const channels = read_tsv(argv[i + 1], {}, options);
+      histogram_differences(channels, "nmeas", prefix, nthreads);
+      histogram_differences(channels, "nphots", prefix, nthreads);
+    }
+    auto const t2 = std::chrono::steady_clock::now();
+    fmt::print("load: {:.3f} s, histograms: {:.3f} s\n",
+               std::chrono::duration<double>(t1 - t0).count(),
+               std::chrono::duration<double>(t2 - t1).count());
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
@@ -1,7 +1,17 @@
 #include "nanobench.h"
 #include <cmath>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
 
+#include "fmt/core.h"
+
+#include "cpu_dispatch.hh"
 #include "fast_atan.hh"
+#include "roofline.hh"
+#include "solid_angle_table.hh"
 
 inline double
 fast_acos(double xin)
@@ -24,7 +34,8 @@ fast_acos(double xin)
   return M_PI - ret;
 }
 
-__attribute__((noinline)) __attribute__((optimize("-ffast-math"))) double
+__attribute__((noinline)) __attribute__((optimize("-ffast-math"))) MULTIVERSION
+double
 omega_1(double a, double b, double d)
 {
   double const alpha = a / (2 * d);
@@ -35,7 +46,8 @@ omega_1(double a, double b, double d)
   return 4 * fast_acos(x);
 }
 
-__attribute__((noinline)) __attribute__((optimize("-ffast-math"))) double
+__attribute__((noinline)) __attribute__((optimize("-ffast-math"))) MULTIVERSION
+double
 omega_2(double a, double b, double d)
 {
   double const alpha = a / (2 * d);
@@ -45,8 +57,9 @@ omega_2(double a, double b, double d)
   return 4 * atan2_4(denominator, numerator);
 }
 
+// Return the median time of the run.
 template <typename F>
-void
+double
 run_bench(F func, ankerl::nanobench::Bench* bench, char const* name)
 {
   volatile double a = 0.457;
@@ -57,15 +70,176 @@ run_bench(F func, ankerl::nanobench::Bench* bench, char const* name)
     double z = func(a, b, d);
     ankerl::nanobench::doNotOptimizeAway(z);
   });
+  using measure = ankerl::nanobench::Result::Measure;
+  return bench->results().back().median(measure::elapsed);
+}
+
+// The flops of omega_1 and omega_2, for the roofline report: +, -, *, / and
+// sqrt, with the common subexpressions (2 * d, alpha * alpha, beta * beta)
+// counted once, as -ffast-math computes them. omega_1's fast_acos takes 9,
+// and omega_2's atan2_4 12 (as in fast_atan_t).
+constexpr double omega_1_flops = 22.0;
+constexpr double omega_2_flops = 22.0;
+
+// The cost of a call of run_bench, which reads its three arguments from the
+// stack, and of a batch of n calls, each reading three doubles and writing
+// one.
+kernel_cost
+scalar_cost(double flops)
+{
+  return {24.0, flops, false, 24};
+}
+
+kernel_cost
+batch_cost(double flops, std::size_t n)
+{
+  return {32.0 * n, flops * n, false, 32 * n};
+}
+
+// Apertures and distances with |alpha| and |beta| up to max_alpha, the range
+// of the tables.
+struct geometry {
+  std::vector<double> a, b, d;
+};
+
+geometry
+make_geometry(std::size_t n, double max_alpha)
+{
+  std::minstd_rand0 engine(123);
+  std::uniform_real_distribution<double> side{-2 * max_alpha, 2 * max_alpha};
+  std::uniform_real_distribution<double> distance{1.0, 2.0};
+  geometry g;
+  for (std::size_t i = 0; i != n; ++i) {
+    double const d = distance(engine);
+    g.a.push_back(side(engine) * d / 2);
+    g.b.push_back(side(engine) * d / 2);
+    g.d.push_back(d);
+  }
+  return g;
+}
+
+void
+report_errors(std::vector<solid_angle_table> const& tables,
+              geometry const& g)
+{
+  for (auto const& t : tables) {
+    auto const e = measure_error(t, 1'000'000);
+    fmt::print("table {:>5} KiB: max error {:.2e} (bound {:.2e}), rms "
+               "{:.2e}, max relative {:.2e}\n",
+               t.bytes() >> 10,
+               e.max_abs,
+               e.bound,
+               e.rms,
+               e.max_rel);
+  }
+  double max_abs = 0.0;
+  for (std::size_t i = 0; i != g.d.size(); ++i) {
+    double const exact = solid_angle(g.a[i], g.b[i], g.d[i]);
+    double const approx = omega_1(g.a[i], g.b[i], g.d[i]);
+    max_abs = std::max(max_abs, std::abs(approx - exact));
+  }
+  fmt::print("omega_1: max error {:.2e}\n", max_abs);
+}
+
+// Points with d <= 0 give negative or NaN alpha and beta, which the table
+// must not index with; it evaluates them exactly, as solid_angle does.
+void
+report_degenerate(solid_angle_table const& table)
+{
+  std::vector<double> const a{1.0, 0.0, 1.0, 0.0, 3.0, -2.0};
+  std::vector<double> const b{1.0, 0.0, 2.0, 1.0, 0.5, 1.0};
+  std::vector<double> const d{-1.0, 0.0, -0.5, -1.0, 0.0, -0.25};
+  std::vector<double> omega(d.size());
+  table.lookup(a, b, d, omega);
+  auto const same = [](double x, double y) {
+    return x == y || (std::isnan(x) && std::isnan(y));
+  };
+  bool exact = true;
+  for (std::size_t i = 0; i != d.size(); ++i) {
+    double const expected = solid_angle(a[i], b[i], d[i]);
+    exact = exact && same(table(a[i], b[i], d[i]), expected) &&
+            same(omega[i], expected);
+  }
+  std::cout << "table: d <= 0 evaluated exactly: " << exact << '\n';
+}
+
+// Return the median time of the run, for the whole batch.
+template <typename F>
+double
+run_batch(F func,
+          ankerl::nanobench::Bench* bench,
+          geometry const& g,
+          std::string const& name)
+{
+  std::vector<double> omega(g.d.size());
+  bench->run(name, [&]() { func(g, omega); });
+  ankerl::nanobench::doNotOptimizeAway(omega.data());
+  using measure = ankerl::nanobench::Result::Measure;
+  return bench->results().back().median(measure::elapsed);
 }
 
 int
 main()
 {
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  double const max_alpha = 4.0;
+  std::vector<solid_angle_table> tables;
+  for (std::size_t cells : {64, 128, 512}) {
+    tables.emplace_back(max_alpha, max_alpha, cells, cells);
+  }
+  auto const g = make_geometry(4096, max_alpha);
+  report_errors(tables, g);
+  report_degenerate(tables[1]);
+
   ankerl::nanobench::Bench b;
   b.title("solid angle tests")
     .performanceCounters(true)
     .minEpochIterations(100 * 1000 * 1000);
-  run_bench(&omega_1, &b, "omega_1");
-  run_bench(&omega_2, &b, "omega_3");
+  // The tables are not placed on the roofline: their traffic depends on the
+  // cells the geometries touch, rather than on a count per call.
+  std::vector<costed_run> runs;
+  runs.push_back({"omega_1",
+                  scalar_cost(omega_1_flops),
+                  run_bench(&omega_1, &b, "omega_1")});
+  runs.push_back({"omega_3",
+                  scalar_cost(omega_2_flops),
+                  run_bench(&omega_2, &b, "omega_3")});
+  auto const& t128 = tables[1];
+  run_bench([&t128](double a, double b, double d) { return t128(a, b, d); },
+            &b,
+            "table128");
+
+  // Many geometries at once, as in the fast simulation; the table's batched
+  // lookup against the scalar functions in a loop.
+  b.batch(g.d.size()).minEpochIterations(1000);
+  auto const omega_1_loop = [](geometry const& g,
+                               std::vector<double>& omega) {
+    for (std::size_t i = 0; i != omega.size(); ++i) {
+      omega[i] = omega_1(g.a[i], g.b[i], g.d[i]);
+    }
+  };
+  auto const omega_2_loop = [](geometry const& g,
+                               std::vector<double>& omega) {
+    for (std::size_t i = 0; i != omega.size(); ++i) {
+      omega[i] = omega_2(g.a[i], g.b[i], g.d[i]);
+    }
+  };
+  runs.push_back({"omega_1_batch",
+                  batch_cost(omega_1_flops, g.d.size()),
+                  run_batch(omega_1_loop, &b, g, "omega_1_batch")});
+  runs.push_back({"omega_3_batch",
+                  batch_cost(omega_2_flops, g.d.size()),
+                  run_batch(omega_2_loop, &b, g, "omega_3_batch")});
+  for (auto const& t : tables) {
+    run_batch(
+      [&t](geometry const& g, std::vector<double>& omega) {
+        t.lookup(g.a, g.b, g.d, omega);
+      },
+      &b,
+      g,
+      fmt::format("table{}KiB_batch", t.bytes() >> 10));
+  }
+
+  auto const peaks = measure_machine();
+  std::cout << '\n' << describe(peaks) << describe(peaks, runs);
 }
@@ -1,163 +1,330 @@
 #include "operations.hh"
+#include "cpu_dispatch.hh"
 #include "data_structures.hh"
+#include "layout_registry.hh"
+#include "operations_inline.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <utility>
 
 ////////////////////////////////////////////
-// Part 1: Functions that look only at values, not keys.
+// Parts 1 to 3: Sums, scans and point lookups.
 //
-// Iterate through all values in a record-based structure; this includes both
-// maps and AOS structures.
-template <typename RECORDBASED>
-int
-sum_recordbased(RECORDBASED const& m)
+// The definitions are the inline kernels of operations_inline.hh. The scans
+// are MULTIVERSION (see cpu_dispatch.hh), so that the kernels inlined here
+// are vectorized for the best ISA available at run time, except with
+// DUNEPROF_LTO, which inlines them into their callers (see
+// KERNEL_MULTIVERSION).
+template <record_layout S>
+KERNEL_MULTIVERSION int
+sum(S const& m)
 {
-  int sum = 0;
-  for (auto const& p : m) {
-    sum += p.second;
-  }
-  return sum;
+  return kernels::sum(m);
 }
 
-int
-sum(std::map<int, int> const& m)
+template <soa_layout S>
+KERNEL_MULTIVERSION int
+sum(S const& s)
 {
-  return sum_recordbased(m);
+  return kernels::sum(s);
 }
 
-int
-sum(std::unordered_map<int, int> const& m)
+KERNEL_MULTIVERSION int
+sum(hybrid_channel const& s)
 {
-  return sum_recordbased(m);
+  return kernels::sum(s);
 }
 
-int
-sum(aos_vector const& s)
+KERNEL_MULTIVERSION int
+sum(flat_int_map const& m)
 {
-  return sum_recordbased(s);
+  return kernels::sum(m);
 }
 
-int
-sum(aos_deq const& s)
+template <record_layout S>
+KERNEL_MULTIVERSION result_t
+find_largest(S const& m)
 {
-  return sum_recordbased(s);
+  return kernels::find_largest(m);
 }
 
-int
-sum(aos_slist const& s)
+template <soa_layout S>
+KERNEL_MULTIVERSION result_t
+find_largest(S const& s)
+{
+  return kernels::find_largest(s);
+}
+
+KERNEL_MULTIVERSION result_t
+find_largest(hybrid_channel const& s)
+{
+  return kernels::find_largest(s);
+}
+
+KERNEL_MULTIVERSION result_t
+find_largest(flat_int_map const& m)
 {
-  return sum_recordbased(s);
+  return kernels::find_largest(m);
 }
 
-// Iterate through all values in a SOA structure.
-template <typename SOA>
+template <record_layout S>
 int
-sum_soa(SOA const& s)
+lookup(S const& m, int tick)
 {
-  int sum = 0;
-  for (auto const& p : s.nphots) {
-    sum += p;
-  }
-  return sum;
+  return kernels::lookup(m, tick);
 }
 
+template <soa_layout S>
 int
-sum(soa_vector const& s)
+lookup(S const& s, int tick)
 {
-  return sum_soa(s);
+  return kernels::lookup(s, tick);
 }
 
 int
-sum(soa_deq const& s)
+lookup(hybrid_channel const& s, int tick)
 {
-  return sum_soa(s);
+  return kernels::lookup(s, tick);
 }
 
 int
-sum(soa_slist const& s)
+lookup(flat_int_map const& m, int tick)
 {
-  return sum_soa(s);
+  return kernels::lookup(m, tick);
 }
 
 ////////////////////////////////////////////
-// Part 2: Functions that look at both values and keys.
+// Part 4: Channel summaries.
 //
-// Iterate through all keys and values in a record-based structure; this
-// includes both maps and AOS structures.
-template <typename RECORDBASED>
-result_t
-find_largest_recordbased(RECORDBASED const& m)
-{
-  result_t result;
-  for (auto const& p : m) {
-    if (result.value < p.second) {
-      result.key = p.first;
-      result.value = p.second;
+// The record layouts and the non-contiguous SOA layouts accumulate every
+// requested statistic in one loop over the measurements. The flags are loop
+// invariant, so the compiler can unswitch the loop on them (see
+// kernels::summary_accumulator).
+namespace {
+  using kernels::summary_accumulator;
+
+  // The contiguous path. Each block is small enough to stay in L1 while
+  // every statistic takes its own simple loop over it, and each of those
+  // loops vectorizes: the 64-bit sums, the count, and the maximum. Only a
+  // block whose maximum beats the peak so far is searched again for the
+  // first position of that maximum, which keeps the tie-breaking of
+  // find_largest. If 'ticks' is null the ticks are implicit, tick_base + i.
+  // The tick range is not computed here (see the callers).
+  constexpr std::size_t summary_block = 2048;
+
+  template <unsigned Fields>
+  MULTIVERSION summary_t
+  summarize_contiguous(int const* ticks,
+                       int tick_base,
+                       int const* nphots,
+                       std::size_t n,
+                       int threshold)
+  {
+    summary_t r;
+    r.measurements = n;
+    long long weighted = 0;
+    for (std::size_t begin = 0; begin < n; begin += summary_block) {
+      std::size_t const len = std::min(summary_block, n - begin);
+      int const* v = nphots + begin;
+      long long block_total = 0;
+      if constexpr ((Fields & (summary_total | summary_mean_time)) != 0) {
+        for (std::size_t i = 0; i != len; ++i) {
+          block_total += v[i];
+        }
+        r.total += block_total;
+      }
+      if constexpr ((Fields & summary_above) != 0) {
+        std::size_t above = 0;
+        for (std::size_t i = 0; i != len; ++i) {
+          above += v[i] > threshold;
+        }
+        r.above += above;
+      }
+      if constexpr ((Fields & summary_mean_time) != 0) {
+        long long w = 0;
+        if (ticks == nullptr) {
+          for (std::size_t i = 0; i != len; ++i) {
+            w += static_cast<long long>(i) * v[i];
+          }
+          w += (static_cast<long long>(tick_base) + begin) * block_total;
+        } else {
+          int const* t = ticks + begin;
+          for (std::size_t i = 0; i != len; ++i) {
+            w += static_cast<long long>(t[i]) * v[i];
+          }
+        }
+        weighted += w;
+      }
+      if constexpr ((Fields & summary_peak) != 0) {
+        int m = v[0];
+        for (std::size_t i = 1; i != len; ++i) {
+          m = std::max(m, v[i]);
+        }
+        if (r.peak.value < m) {
+          std::size_t const i = std::find(v, v + len, m) - v;
+          r.peak.value = m;
+          r.peak.key = ticks == nullptr
+                         ? tick_base + static_cast<int>(begin + i)
+                         : ticks[begin + i];
+        }
+      }
     }
+    return summary_accumulator::finish_summary(r, weighted, Fields);
   }
-  return result;
-}
 
-result_t
-find_largest(std::map<int, int> const& m)
-{
-  return find_largest_recordbased(m);
-}
+  using contiguous_kernel = summary_t (*)(int const*,
+                                          int,
+                                          int const*,
+                                          std::size_t,
+                                          int);
+
+  template <std::size_t... F>
+  constexpr std::array<contiguous_kernel, sizeof...(F)>
+  make_contiguous_kernels(std::index_sequence<F...>)
+  {
+    return {&summarize_contiguous<F>...};
+  }
 
-result_t
-find_largest(std::unordered_map<int, int> const& m)
+  // One specialization per combination of fields, so that the unrequested
+  // statistics cost nothing.
+  constexpr auto contiguous_kernels =
+    make_contiguous_kernels(std::make_index_sequence<summary_all + 1>{});
+}
+template <record_layout S>
+summary_t
+channel_summary(S const& m, summary_options const& options)
 {
-  return find_largest_recordbased(m);
+  summary_accumulator acc(options);
+  for (auto const& p : m) {
+    acc.add(p.first, p.second);
+  }
+  return acc.finish();
 }
 
-result_t
-find_largest(aos_vector const& s)
+// The SOA layouts are sorted by tick, so the tick range is at the ends.
+template <soa_layout S>
+summary_t
+channel_summary(S const& s, summary_options const& options)
 {
-  return find_largest_recordbased(s);
+  if constexpr (std::ranges::contiguous_range<decltype(s.ticks)> &&
+                std::ranges::contiguous_range<decltype(s.nphots)>) {
+    auto const n = std::ranges::size(s.nphots);
+    auto r = contiguous_kernels[options.fields & summary_all](
+      std::ranges::data(s.ticks),
+      0,
+      std::ranges::data(s.nphots),
+      n,
+      options.threshold);
+    if ((options.fields & summary_range) && n != 0) {
+      r.first_tick = s.ticks[0];
+      r.last_tick = s.ticks[n - 1];
+    }
+    return r;
+  } else {
+    summary_accumulator acc(options);
+    auto i_ticks = std::ranges::begin(s.ticks);
+    for (int v : s.nphots) {
+      acc.add(*i_ticks, v);
+      ++i_ticks;
+    }
+    return acc.finish();
+  }
 }
 
-result_t
-find_largest(aos_deq const& s)
+// In the dense form the gaps hold 0: they add nothing to the sums and never
+// become the peak, but they are not measurements, and a negative threshold
+// would count them as above it.
+summary_t
+channel_summary(hybrid_channel const& s, summary_options const& options)
 {
-  return find_largest_recordbased(s);
+  auto const& nphots = s.nphots();
+  auto const n = nphots.size();
+  bool const dense = s.is_dense();
+  auto r = contiguous_kernels[options.fields & summary_all](
+    dense ? nullptr : s.ticks().data(),
+    s.tick_min(),
+    nphots.data(),
+    n,
+    options.threshold);
+  r.measurements = s.size();
+  if (dense && (options.fields & summary_above) && options.threshold < 0)
+    r.above -= n - s.size();
+  if ((options.fields & summary_range) && n != 0) {
+    r.first_tick = dense ? s.tick_min() : s.ticks()[0];
+    r.last_tick =
+      dense ? s.tick_min() + static_cast<int>(n - 1) : s.ticks()[n - 1];
+  }
+  return r;
 }
 
-result_t
-find_largest(aos_slist const& s)
+// As with find_largest, ties for the peak are resolved in slot order.
+summary_t
+channel_summary(flat_int_map const& m, summary_options const& options)
 {
-  return find_largest_recordbased(s);
+  summary_accumulator acc(options);
+  auto const& keys = m.keys();
+  auto const& values = m.values();
+  for (std::size_t i = 0, sz = values.size(); i != sz; ++i) {
+    if (keys[i] != flat_int_map::empty_key)
+      acc.add(keys[i], values[i]);
+  }
+  return acc.finish();
 }
 
-// Iterate through all keys and values in a SOA structure.
-template <typename SOA>
-result_t
-find_largest_soa(SOA const& s)
+template <typename S>
+std::vector<summary_t>
+event_summary(std::span<S const> channels,
+              summary_options const& options,
+              std::size_t nthreads)
 {
-  result_t result;
-  auto i_ticks = s.ticks.cbegin();
-  auto i_nphots = s.nphots.cbegin();
-  auto nphots_end = s.nphots.cend();
-  for (; i_nphots != nphots_end; ++i_ticks, ++i_nphots) {
-    if (result.value < *i_nphots) {
-      result.key = *i_ticks;
-      result.value = *i_nphots;
+  std::vector<summary_t> result(channels.size());
+  nthreads = std::max<std::size_t>(1, std::min(nthreads, channels.size()));
+  parallel_for(nthreads, [&](std::size_t t) {
+    auto const [begin, end] = static_partition(channels.size(), nthreads, t);
+    for (std::size_t i = begin; i != end; ++i) {
+      result[i] = channel_summary(channels[i], options);
     }
-  }
+  });
   return result;
 }
 
-result_t
-find_largest(soa_vector const& s)
+////////////////////////////////////////////
+// Part 5: Instantiation.
+//
+// Keeping the address of each specialization in a table that the compiler
+// must retain forces its definition to be emitted in this library, for every
+// registered layout.
+// Types with their own (non-template) overloads, such as hybrid_channel and
+// flat_int_map, only need event_summary.
+template <typename S>
+constexpr auto
+operations_for()
 {
-  return find_largest_soa(s);
+  using summary_fn = summary_t (*)(S const&, summary_options const&);
+  using event_fn = std::vector<summary_t> (*)(
+    std::span<S const>, summary_options const&, std::size_t);
+  if constexpr (record_layout<S> || soa_layout<S>) {
+    return std::tuple{static_cast<int (*)(S const&)>(&sum<S>),
+                      static_cast<result_t (*)(S const&)>(&find_largest<S>),
+                      static_cast<int (*)(S const&, int)>(&lookup<S>),
+                      static_cast<summary_fn>(&channel_summary<S>),
+                      static_cast<event_fn>(&event_summary<S>)};
+  } else {
+    return std::tuple{static_cast<event_fn>(&event_summary<S>)};
+  }
 }
 
-result_t
-find_largest(soa_deq const& s)
+template <typename... S>
+constexpr auto
+operations_table(std::tuple<registration<S>...> const&)
 {
-  return find_largest_soa(s);
+  return std::tuple_cat(operations_for<S>()...);
 }
 
-result_t
-find_largest(soa_slist const& s)
-{
-  return find_largest_soa(s);
-}
+[[gnu::used]] static auto const instantiated_operations =
+  operations_table(registered_layouts);
@@ -1,20 +1,22 @@
 #pragma once
 
-#include <map>
-#include <unordered_map>
-#include <vector>
-
 #include "data_structures.hh"
+#include "flat_int_map.hh"
+#include "hybrid_channel.hh"
+
+#include <climits>
+#include <cstddef>
+#include <limits>
+#include <span>
+#include <vector>
 
-// Iterate through all values in map; we don't look at the keys.
-int sum(std::map<int, int> const& m);
-int sum(soa_vector const& s);
-int sum(std::unordered_map<int, int> const& m);
-int sum(aos_vector const& s);
-int sum(soa_deq const& s);
-int sum(soa_slist const& s);
-int sum(aos_deq const& s);
-int sum(aos_slist const& s);
+// Iterate through all values; we don't look at the keys.
+template <record_layout S>
+int sum(S const& s);
+template <soa_layout S>
+int sum(S const& s);
+int sum(hybrid_channel const& s);
+int sum(flat_int_map const& s);
 
 // This is the type of the result returned by all the find_largest functions.
 struct result_t {
@@ -22,13 +24,71 @@ struct result_t {
   int value = -1;
 };
 
-result_t find_largest(std::map<int, int> const& m);
-result_t find_largest(std::unordered_map<int, int> const& m);
+template <record_layout S>
+result_t find_largest(S const& s);
+template <soa_layout S>
+result_t find_largest(S const& s);
+result_t find_largest(hybrid_channel const& s);
+result_t find_largest(flat_int_map const& s);
+
+// Return the number of photons at the given tick, or 0 if there is no
+// measurement at that tick. The sequence and SOA layouts must hold their
+// measurements sorted by tick, as the fill functions do.
+template <record_layout S>
+int lookup(S const& s, int tick);
+template <soa_layout S>
+int lookup(S const& s, int tick);
+int lookup(hybrid_channel const& s, int tick);
+int lookup(flat_int_map const& s, int tick);
+
+// The statistics channel_summary can compute; combine them with |.
+enum summary_field : unsigned {
+  summary_total = 1u << 0,     // total photons
+  summary_peak = 1u << 1,      // tick and value of the largest, as find_largest
+  summary_above = 1u << 2,     // measurements above the threshold
+  summary_range = 1u << 3,     // first and last tick
+  summary_mean_time = 1u << 4, // photon-weighted mean tick
+  summary_all = (1u << 5) - 1
+};
+
+struct summary_options {
+  unsigned fields = summary_all;
+  int threshold = 0;
+};
+
+// The result of channel_summary. The fields that were not requested keep
+// these initial values.
+struct summary_t {
+  std::size_t measurements = 0;
+  long long total = 0;
+  result_t peak;
+  std::size_t above = 0;
+  int first_tick = INT_MAX;
+  int last_tick = INT_MIN;
+  // NaN if there are no photons.
+  double mean_time = std::numeric_limits<double>::quiet_NaN();
+};
+
+// Compute the requested statistics in a single pass over the channel. The
+// contiguous SOA layouts (and both forms of hybrid_channel) go through a
+// vectorized path that processes the channel in L1-sized blocks.
+template <record_layout S>
+summary_t channel_summary(S const& s, summary_options const& options = {});
+template <soa_layout S>
+summary_t channel_summary(S const& s, summary_options const& options = {});
+summary_t channel_summary(hybrid_channel const& s,
+                          summary_options const& options = {});
+summary_t channel_summary(flat_int_map const& s,
+                          summary_options const& options = {});
 
-result_t find_largest(aos_vector const& m);
-result_t find_largest(aos_deq const& s);
-result_t find_largest(aos_slist const& s);
+// channel_summary of every channel of an event, using nthreads threads, each
+// with its static_partition (see parallel.hh) of the channels.
+template <typename S>
+std::vector<summary_t> event_summary(std::span<S const> channels,
+                                     summary_options const& options,
+                                     std::size_t nthreads);
 
-result_t find_largest(soa_vector const& m);
-result_t find_largest(soa_deq const& s);
-result_t find_largest(soa_slist const& s);
\ No newline at end of file
+// The definitions live in operations.cc, which instantiates them for every
+// type in registered_layouts (see layout_registry.hh).
+// sum, find_largest and lookup are also in operations_inline.hh, for callers
+// that want them inlined.
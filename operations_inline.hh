@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <ranges>
+
+#include "data_structures.hh"
+#include "flat_int_map.hh"
+#include "hybrid_channel.hh"
+#include "operations.hh"
+
+// The definitions of sum, find_largest and lookup, and the accumulator of
+// channel_summary, as inline functions in namespace kernels, for callers that
+// want them inlined into their own loops rather than called in the
+// operations library. The library's functions call these, from MULTIVERSION
+// wrappers (see cpu_dispatch.hh); inlined here, they are compiled for the
+// caller's ISA, so a caller that wants the vectorized forms must itself be
+// MULTIVERSION.
+//
+// Calling the library costs a call through the PLT, which cannot be inlined
+// or specialized for the caller, and for the smallest channels that is a
+// large part of the time (see inline_kernels_t). Building with DUNEPROF_LTO
+// links the library statically with link-time optimization instead, and
+// drops the MULTIVERSION of its wrappers, whose ifunc calls can not be
+// inlined, so that the linker inlines them into their callers.
+namespace kernels {
+  ////////////////////////////////////////////
+  // Part 1: Functions that look only at values, not keys.
+  //
+  // Iterate through all values in a record-based structure; this includes
+  // both maps and AOS structures.
+  template <record_layout S>
+  constexpr int
+  sum(S const& m)
+  {
+    int sum = 0;
+    for (auto const& p : m) {
+      sum += p.second;
+    }
+    return sum;
+  }
+
+  // Iterate through all values in a SOA structure.
+  template <soa_layout S>
+  constexpr int
+  sum(S const& s)
+  {
+    int sum = 0;
+    for (auto const& p : s.nphots) {
+      sum += p;
+    }
+    return sum;
+  }
+
+  // In the dense form the gaps hold 0, so they do not change the sum.
+  inline int
+  sum(hybrid_channel const& s)
+  {
+    int sum = 0;
+    for (auto const& p : s.nphots()) {
+      sum += p;
+    }
+    return sum;
+  }
+
+  // Empty slots hold 0, so we can sum all the values without looking at the
+  // keys.
+  inline int
+  sum(flat_int_map const& m)
+  {
+    int sum = 0;
+    for (auto const& p : m.values()) {
+      sum += p;
+    }
+    return sum;
+  }
+
+  ////////////////////////////////////////////
+  // Part 2: Functions that look at both values and keys.
+  //
+  // Iterate through all keys and values in a record-based structure; this
+  // includes both maps and AOS structures.
+  template <record_layout S>
+  constexpr result_t
+  find_largest(S const& m)
+  {
+    result_t result;
+    for (auto const& p : m) {
+      if (result.value < p.second) {
+        result.key = p.first;
+        result.value = p.second;
+      }
+    }
+    return result;
+  }
+
+  // Iterate through all keys and values in a SOA structure.
+  template <soa_layout S>
+  constexpr result_t
+  find_largest(S const& s)
+  {
+    result_t result;
+    auto i_ticks = s.ticks.cbegin();
+    auto i_nphots = s.nphots.cbegin();
+    auto nphots_end = s.nphots.cend();
+    for (; i_nphots != nphots_end; ++i_ticks, ++i_nphots) {
+      if (result.value < *i_nphots) {
+        result.key = *i_ticks;
+        result.value = *i_nphots;
+      }
+    }
+    return result;
+  }
+
+  // In the dense form the ticks are implicit. The gaps hold 0, and can never
+  // replace an earlier measurement because the comparison is strict.
+  inline result_t
+  find_largest(hybrid_channel const& s)
+  {
+    result_t result;
+    bool const dense = s.is_dense();
+    auto const& ticks = s.ticks();
+    auto const& nphots = s.nphots();
+    for (std::size_t i = 0, sz = nphots.size(); i != sz; ++i) {
+      if (result.value < nphots[i]) {
+        result.key = dense ? s.tick_min() + static_cast<int>(i) : ticks[i];
+        result.value = nphots[i];
+      }
+    }
+    return result;
+  }
+
+  // As with std::unordered_map, ties are resolved in slot order rather than in
+  // tick order.
+  inline result_t
+  find_largest(flat_int_map const& m)
+  {
+    result_t result;
+    auto const& keys = m.keys();
+    auto const& values = m.values();
+    for (std::size_t i = 0, sz = values.size(); i != sz; ++i) {
+      if (result.value < values[i] && keys[i] != flat_int_map::empty_key) {
+        result.key = keys[i];
+        result.value = values[i];
+      }
+    }
+    return result;
+  }
+
+  ////////////////////////////////////////////
+  // Part 3: Point lookups.
+  //
+  // Maps use their own find; the sequence and SOA layouts are sorted by tick,
+  // so we can use a binary search.
+  template <record_layout S>
+  constexpr int
+  lookup(S const& m, int tick)
+  {
+    if constexpr (keyed_layout<S>) {
+      auto const it = m.find(tick);
+      return it == m.end() ? 0 : it->second;
+    } else {
+      auto const tick_of = [](auto const& r) { return r.first; };
+      auto const it = std::ranges::lower_bound(m, tick, {}, tick_of);
+      return (it == std::ranges::end(m) || it->first != tick) ? 0 : it->second;
+    }
+  }
+
+  template <soa_layout S>
+  constexpr int
+  lookup(S const& s, int tick)
+  {
+    auto const it = std::ranges::lower_bound(s.ticks, tick);
+    if (it == std::ranges::end(s.ticks) || *it != tick)
+      return 0;
+    auto const offset = std::ranges::distance(std::ranges::begin(s.ticks), it);
+    return *std::ranges::next(std::ranges::begin(s.nphots), offset);
+  }
+
+  inline int
+  lookup(hybrid_channel const& s, int tick)
+  {
+    return s.at_tick(tick);
+  }
+
+  inline int
+  lookup(flat_int_map const& m, int tick)
+  {
+    int const* p = m.find(tick);
+    return p == nullptr ? 0 : *p;
+  }
+
+  ////////////////////////////////////////////
+  // Part 4: Channel summaries.
+  //
+  // Accumulate the statistics requested in 'options' one measurement at a
+  // time. The flags are loop invariant, so the compiler can unswitch a loop
+  // calling add on them.
+  class summary_accumulator {
+  public:
+    explicit summary_accumulator(summary_options const& options)
+      : fields_(options.fields), threshold_(options.threshold)
+    {}
+
+    void
+    add(int tick, int value)
+    {
+      ++r_.measurements;
+      if (fields_ & (summary_total | summary_mean_time))
+        r_.total += value;
+      if ((fields_ & summary_peak) && r_.peak.value < value) {
+        r_.peak.key = tick;
+        r_.peak.value = value;
+      }
+      if (fields_ & summary_above)
+        r_.above += value > threshold_;
+      if (fields_ & summary_range) {
+        r_.first_tick = std::min(r_.first_tick, tick);
+        r_.last_tick = std::max(r_.last_tick, tick);
+      }
+      if (fields_ & summary_mean_time)
+        weighted_ += static_cast<long long>(tick) * value;
+    }
+
+    summary_t
+    finish() const
+    {
+      return finish_summary(r_, weighted_, fields_);
+    }
+
+    // Fill in the mean time, and clear the total if it was only needed for
+    // the mean.
+    static summary_t
+    finish_summary(summary_t r, long long weighted, unsigned fields)
+    {
+      if ((fields & summary_mean_time) && r.total != 0)
+        r.mean_time = static_cast<double>(weighted) / r.total;
+      if (!(fields & summary_total))
+        r.total = 0;
+      return r;
+    }
+
+  private:
+    unsigned fields_;
+    int threshold_;
+    summary_t r_;
+    long long weighted_ = 0;
+  };
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The half-open range of [0, n) processed by thread i of nthreads. Every
+// parallel loop over the same data should use the same partition, so that
+// the thread that first touches a page (and thus decides its NUMA node) is
+// the thread that later processes it.
+inline std::pair<std::size_t, std::size_t>
+static_partition(std::size_t n, std::size_t nthreads, std::size_t i)
+{
+  std::size_t const chunk = n / nthreads;
+  std::size_t const extra = n % nthreads;
+  std::size_t const begin = i * chunk + std::min(i, extra);
+  return {begin, begin + chunk + (i < extra ? 1 : 0)};
+}
+
+// Pin the calling thread to the given CPU. Return false if that is not
+// possible (or not supported on this platform).
+inline bool
+pin_to_cpu(unsigned cpu)
+{
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+// Call f(i) for i in [0, nthreads), each on its own thread, and wait for all
+// of them. If 'pin' is true, thread i is pinned to CPU i (modulo the number
+// of CPUs), so that repeated calls run each i on the same core and NUMA node.
+template <typename F>
+void
+parallel_for(std::size_t nthreads, F&& f, bool pin = false)
+{
+  unsigned const ncpus = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::jthread> threads;
+  threads.reserve(nthreads);
+  for (std::size_t i = 0; i != nthreads; ++i) {
+    threads.emplace_back([&f, i, pin, ncpus]() {
+      if (pin)
+        pin_to_cpu(static_cast<unsigned>(i % ncpus));
+      f(i);
+    });
+  }
+}
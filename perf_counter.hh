@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// A single hardware performance counter for the calling thread and the
+// threads it creates after the counter is opened, for the events nanobench
+// does not report (such as dTLB misses).
+//
+// The counter is not available on platforms other than Linux, or when
+// kernel.perf_event_paranoid forbids it; valid() then returns false and
+// stop() returns 0.
+class perf_counter {
+public:
+  // Data TLB misses on loads.
+  static perf_counter dtlb_load_misses();
+  // Data TLB accesses on loads.
+  static perf_counter dtlb_loads();
+
+  perf_counter(perf_counter const&) = delete;
+  perf_counter& operator=(perf_counter const&) = delete;
+  perf_counter(perf_counter&& other) noexcept;
+  ~perf_counter();
+
+  bool valid() const noexcept;
+  void start() noexcept;
+  // Return the count since the last start().
+  std::uint64_t stop() noexcept;
+
+private:
+  perf_counter(std::uint32_t type, std::uint64_t config) noexcept;
+  int fd_ = -1;
+};
+
+#if defined(__linux__)
+inline perf_counter::perf_counter(std::uint32_t type,
+                                  std::uint64_t config) noexcept
+{
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+inline perf_counter
+perf_counter::dtlb_load_misses()
+{
+  return perf_counter(PERF_TYPE_HW_CACHE,
+                      PERF_COUNT_HW_CACHE_DTLB |
+                        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+inline perf_counter
+perf_counter::dtlb_loads()
+{
+  return perf_counter(PERF_TYPE_HW_CACHE,
+                      PERF_COUNT_HW_CACHE_DTLB |
+                        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16));
+}
+
+inline perf_counter::~perf_counter()
+{
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+inline void
+perf_counter::start() noexcept
+{
+  if (fd_ < 0)
+    return;
+  ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+inline std::uint64_t
+perf_counter::stop() noexcept
+{
+  if (fd_ < 0)
+    return 0;
+  ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+  std::uint64_t count = 0;
+  if (read(fd_, &count, sizeof(count)) != sizeof(count))
+    return 0;
+  return count;
+}
+#else
+inline perf_counter::perf_counter(std::uint32_t, std::uint64_t) noexcept {}
+
+inline perf_counter
+perf_counter::dtlb_load_misses()
+{
+  return perf_counter(0, 0);
+}
+
+inline perf_counter
+perf_counter::dtlb_loads()
+{
+  return perf_counter(0, 0);
+}
+
+inline perf_counter::~perf_counter() {}
+
+inline void
+perf_counter::start() noexcept
+{}
+
+inline std::uint64_t
+perf_counter::stop() noexcept
+{
+  return 0;
+}
+#endif
+
+inline perf_counter::perf_counter(perf_counter&& other) noexcept
+  : fd_(other.fd_)
+{
+  other.fd_ = -1;
+}
+
+inline bool
+perf_counter::valid() const noexcept
+{
+  return fd_ >= 0;
+}
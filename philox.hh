@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+
+// Philox4x32-10, the counter-based generator of Salmon et al., "Parallel
+// random numbers: as easy as 1, 2, 3" (SC11). Its output is a bijection of a
+// 128-bit counter under a 64-bit key, so the n-th number of any stream can be
+// computed directly, without generating the ones before it. Synthetic data
+// generated from it is therefore identical whatever the number of threads
+// and whatever order the elements are generated in.
+//
+// A philox_engine is one stream, addressed by (seed, stream, substream); for
+// synthetic measurements, 'stream' identifies the event and channel, and
+// 'substream' separates the different quantities drawn for them. It is a
+// std::uniform_random_bit_generator, so it also works with the standard
+// distributions (see poisson_count).
+
+// One application of the Philox4x32-10 bijection.
+std::array<std::uint32_t, 4> philox4x32(std::array<std::uint32_t, 4> counter,
+                                        std::array<std::uint32_t, 2> key);
+
+class philox_engine {
+public:
+  using result_type = std::uint32_t;
+
+  explicit philox_engine(std::uint64_t seed,
+                         std::uint64_t stream = 0,
+                         std::uint32_t substream = 0) noexcept;
+
+  static constexpr result_type min() noexcept;
+  static constexpr result_type max() noexcept;
+
+  // The n-th number of the stream; does not change the engine.
+  result_type at(std::uint64_t n) const noexcept;
+
+  // The next number of the stream, starting at at(0).
+  result_type operator()() noexcept;
+  void discard(std::uint64_t n) noexcept;
+
+  // Numbers 4 block to 4 block + 3 of the stream, from one application of
+  // the bijection.
+  std::array<std::uint32_t, 4> block_at(std::uint64_t block) const noexcept;
+
+private:
+  std::array<std::uint32_t, 2> key_;
+  std::uint32_t substream_;
+  std::uint64_t stream_;
+  std::uint64_t position_ = 0;
+  std::array<std::uint32_t, 4> block_{};
+};
+
+// An integer uniform in [0, n), from one 32-bit draw. This is Lemire's
+// multiply-shift without the rejection step, so that every value takes
+// exactly one draw; the bias is below n / 2^32.
+std::uint32_t uniform_below(std::uint32_t draw, std::uint32_t n) noexcept;
+
+// A double uniform in (0, 1), from one 32-bit draw.
+double uniform_open01(std::uint32_t draw) noexcept;
+
+// A Poisson count with the given mean for element 'index' of 'stream',
+// independent of every other (stream, index). It draws from substream
+// 'index' of 'stream', so that stream should not be used for anything else.
+int poisson_count(std::uint64_t seed,
+                  std::uint64_t stream,
+                  std::uint32_t index,
+                  double mean);
+
+////////////////////////////////////////////
+// Implementation
+
+namespace philox_detail {
+  constexpr std::uint32_t m0 = 0xD2511F53;
+  constexpr std::uint32_t m1 = 0xCD9E8D57;
+  constexpr std::uint32_t w0 = 0x9E3779B9;
+  constexpr std::uint32_t w1 = 0xBB67AE85;
+
+  inline void
+  mulhilo(std::uint32_t a,
+          std::uint32_t b,
+          std::uint32_t& hi,
+          std::uint32_t& lo) noexcept
+  {
+    std::uint64_t const p = std::uint64_t{a} * b;
+    hi = static_cast<std::uint32_t>(p >> 32);
+    lo = static_cast<std::uint32_t>(p);
+  }
+}
+
+inline std::array<std::uint32_t, 4>
+philox4x32(std::array<std::uint32_t, 4> c, std::array<std::uint32_t, 2> k)
+{
+  using namespace philox_detail;
+  for (int round = 0; round != 10; ++round) {
+    std::uint32_t hi0, lo0, hi1, lo1;
+    mulhilo(m0, c[0], hi0, lo0);
+    mulhilo(m1, c[2], hi1, lo1);
+    c = {hi1 ^ c[1] ^ k[0], lo1, hi0 ^ c[3] ^ k[1], lo0};
+    k[0] += w0;
+    k[1] += w1;
+  }
+  return c;
+}
+
+inline philox_engine::philox_engine(std::uint64_t seed,
+                                    std::uint64_t stream,
+                                    std::uint32_t substream) noexcept
+  : key_{static_cast<std::uint32_t>(seed),
+         static_cast<std::uint32_t>(seed >> 32)}
+  , substream_(substream)
+  , stream_(stream)
+{}
+
+constexpr philox_engine::result_type
+philox_engine::min() noexcept
+{
+  return 0;
+}
+
+constexpr philox_engine::result_type
+philox_engine::max() noexcept
+{
+  return std::numeric_limits<result_type>::max();
+}
+
+// The counter is (block, substream, stream low, stream high), where block
+// n / 4 holds numbers n to n + 3 of the stream; streams of up to 2^34
+// numbers never overlap.
+inline std::array<std::uint32_t, 4>
+philox_engine::block_at(std::uint64_t block) const noexcept
+{
+  return philox4x32({static_cast<std::uint32_t>(block),
+                     substream_,
+                     static_cast<std::uint32_t>(stream_),
+                     static_cast<std::uint32_t>(stream_ >> 32)},
+                    key_);
+}
+
+inline philox_engine::result_type
+philox_engine::at(std::uint64_t n) const noexcept
+{
+  return block_at(n >> 2)[n & 3];
+}
+
+// block_ holds the block of position_, unless position_ is at the start of a
+// block, which has not been computed yet.
+inline philox_engine::result_type
+philox_engine::operator()() noexcept
+{
+  if ((position_ & 3) == 0)
+    block_ = block_at(position_ >> 2);
+  return block_[position_++ & 3];
+}
+
+inline void
+philox_engine::discard(std::uint64_t n) noexcept
+{
+  position_ += n;
+  if ((position_ & 3) != 0)
+    block_ = block_at(position_ >> 2);
+}
+
+inline std::uint32_t
+uniform_below(std::uint32_t draw, std::uint32_t n) noexcept
+{
+  return static_cast<std::uint32_t>((std::uint64_t{draw} * n) >> 32);
+}
+
+inline double
+uniform_open01(std::uint32_t draw) noexcept
+{
+  return (draw + 0.5) * 0x1p-32;
+}
+
+inline int
+poisson_count(std::uint64_t seed,
+              std::uint64_t stream,
+              std::uint32_t index,
+              double mean)
+{
+  // Each element gets its own substream, since the number of draws the
+  // distribution takes varies.
+  philox_engine engine(seed, stream, index);
+  std::poisson_distribution<int> dist(mean);
+  return dist(engine);
+}
@@ -0,0 +1,103 @@
+// Benchmark the generation of synthetic photon counts: the serial
+// std::minstd_rand0 into an intermediate vector that is then copied (the old
+// make_random_vectors), against Philox draws written in place, serially and
+// in parallel. Also checks Philox against the published known-answer values,
+// that the parallel output does not depend on the number of threads, and the
+// moments of poisson_count.
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "data_structures.hh"
+#include "parallel.hh"
+#include "philox.hh"
+
+// From the Random123 distribution (kat_vectors, philox4x32_10).
+bool
+known_answers_match()
+{
+  using block = std::array<std::uint32_t, 4>;
+  using key = std::array<std::uint32_t, 2>;
+  return philox4x32(block{0, 0, 0, 0}, key{0, 0}) ==
+           block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8} &&
+         philox4x32(block{~0u, ~0u, ~0u, ~0u}, key{~0u, ~0u}) ==
+           block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd} &&
+         philox4x32(block{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                    key{0xa4093822, 0x299f31d0}) ==
+           block{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+}
+
+void
+philox_fill(std::vector<int>& nphots, std::size_t nthreads)
+{
+  philox_engine const engine(123);
+  parallel_for(nthreads, [&](std::size_t t) {
+    auto const [begin, end] = static_partition(nphots.size(), nthreads, t);
+    for (std::size_t i = begin; i != end; ++i) {
+      nphots[i] = static_cast<int>(uniform_below(engine.at(i), 10001));
+    }
+  });
+}
+
+void
+report_poisson(double mean, std::size_t n)
+{
+  double sum = 0.0;
+  double sum2 = 0.0;
+  for (std::size_t i = 0; i != n; ++i) {
+    double const k = poisson_count(123, 7, static_cast<std::uint32_t>(i), mean);
+    sum += k;
+    sum2 += k * k;
+  }
+  double const m = sum / n;
+  fmt::print("poisson mean {:>6.1f}: sample mean {:.4f}, variance {:.4f}\n",
+             mean,
+             m,
+             sum2 / n - m * m);
+}
+
+int
+main()
+{
+  std::size_t const n = 10'000'000;
+  std::size_t const nthreads =
+    std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<int> serial(n);
+  std::vector<int> parallel(n);
+  std::vector<int> odd(n);
+  philox_fill(serial, 1);
+  philox_fill(parallel, nthreads);
+  philox_fill(odd, 7);
+  std::cout << "cpu dispatch: " << selected_isa() << '\n'
+            << "philox known answers: " << known_answers_match() << '\n'
+            << "1, 7 and " << nthreads << " threads give identical output: "
+            << (serial == parallel && serial == odd) << '\n';
+  report_poisson(3.0, 1'000'000);
+  report_poisson(50.0, 1'000'000);
+
+  ankerl::nanobench::Bench b;
+  b.title("synthetic nphots").unit("value").batch(n).minEpochIterations(3);
+
+  soa_vector m;
+  b.run("minstd_copy", [&]() {
+    std::minstd_rand0 engine(123);
+    std::uniform_int_distribution<int> dist{0, 10000};
+    std::vector<int> tmp(n);
+    std::generate(tmp.begin(), tmp.end(), [&]() { return dist(engine); });
+    m.nphots.assign(tmp.begin(), tmp.end());
+  });
+  b.run("philox_serial", [&]() { philox_fill(serial, 1); });
+  b.run(fmt::format("philox_parallel{}", nthreads),
+        [&]() { philox_fill(parallel, nthreads); });
+  ankerl::nanobench::doNotOptimizeAway(m.nphots.data());
+}
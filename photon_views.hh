@@ -0,0 +1,509 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "cpu_dispatch.hh"
+#include "data_structures.hh"
+#include "flat_int_map.hh"
+#include "hybrid_channel.hh"
+#include "operations.hh"
+#include "operations_inline.hh"
+#include "parallel.hh"
+
+// Views selecting some of the measurements of a channel, without copying
+// them:
+//
+//   s | photon_views::records           every measurement
+//   s | photon_views::above(threshold)  those with nphots > threshold
+//   s | photon_views::window(a, b)      those with a <= tick <= b
+//   s | photon_views::where(mask)       those for which mask(tick, nphots)
+//
+// for s of any layout in data_structures.hh, a hybrid_channel or a
+// flat_int_map. The adaptors can be chained; the masks are then combined, and
+// the result is still a view of s. A view is a forward range of records
+// (tick, nphots), and sum, find_largest, lookup and channel_summary accept it
+// directly. The view refers to s, which must outlive it.
+//
+// The operations do not filter: they run the same loop as for the whole
+// channel, with the measurements outside the view counted as 0 photons (a
+// masked reduction), so the loops over contiguous storage still vectorize.
+// The gaps of a dense hybrid_channel and the empty slots of a flat_int_map
+// are not measurements: they are in no view, as channel_summary of the
+// channel does not count them.
+//
+// select_channels(channels, selected) is the "only these channels" view of
+// an event, which event_summary accepts.
+
+////////////////////////////////////////////
+// Masks.
+namespace photon_views {
+  struct all_measurements {
+    constexpr bool
+    operator()(int, int) const noexcept
+    {
+      return true;
+    }
+  };
+
+  struct above_mask {
+    int threshold;
+    constexpr bool
+    operator()(int, int nphots) const noexcept
+    {
+      return nphots > threshold;
+    }
+  };
+
+  // The comparisons are combined with &, not &&, so that there is no branch.
+  struct window_mask {
+    int first;
+    int last;
+    constexpr bool
+    operator()(int tick, int) const noexcept
+    {
+      return (tick >= first) & (tick <= last);
+    }
+  };
+
+  template <typename A, typename B>
+  struct both_masks {
+    A a;
+    B b;
+    constexpr bool
+    operator()(int tick, int nphots) const
+    {
+      return a(tick, nphots) & b(tick, nphots);
+    }
+  };
+}
+
+////////////////////////////////////////////
+// Cursors: the position of a measurement in each kind of storage.
+namespace view_detail {
+  template <typename S>
+  struct cursor;
+
+  template <record_layout S>
+  struct cursor<S> {
+    std::ranges::iterator_t<S const> it;
+
+    int tick() const { return it->first; }
+    int nphots() const { return it->second; }
+    bool present() const { return true; }
+    void next() { ++it; }
+    bool operator==(cursor const&) const = default;
+
+    static cursor begin(S const& s) { return {std::ranges::begin(s)}; }
+    static cursor end(S const& s) { return {std::ranges::end(s)}; }
+  };
+
+  // Only the nphots positions are compared; the end cursor holds the end of
+  // ticks too, but never reads it.
+  template <soa_layout S>
+  struct cursor<S> {
+    std::ranges::iterator_t<decltype(S::ticks) const> t;
+    std::ranges::iterator_t<decltype(S::nphots) const> v;
+
+    int tick() const { return *t; }
+    int nphots() const { return *v; }
+    bool present() const { return true; }
+    void
+    next()
+    {
+      ++t;
+      ++v;
+    }
+    bool
+    operator==(cursor const& other) const
+    {
+      return v == other.v;
+    }
+
+    static cursor
+    begin(S const& s)
+    {
+      return {std::ranges::begin(s.ticks), std::ranges::begin(s.nphots)};
+    }
+    static cursor
+    end(S const& s)
+    {
+      return {std::ranges::end(s.ticks), std::ranges::end(s.nphots)};
+    }
+  };
+
+  template <>
+  struct cursor<hybrid_channel> {
+    hybrid_channel const* s = nullptr;
+    std::size_t i = 0;
+
+    int
+    tick() const
+    {
+      return s->is_dense() ? s->tick_min() + static_cast<int>(i)
+                           : s->ticks()[i];
+    }
+    int nphots() const { return s->nphots()[i]; }
+    bool
+    present() const
+    {
+      return !s->is_dense() || (s->measured()[i / 64] >> i % 64 & 1);
+    }
+    void next() { ++i; }
+    bool operator==(cursor const&) const = default;
+
+    static cursor begin(hybrid_channel const& s) { return {&s, 0}; }
+    static cursor
+    end(hybrid_channel const& s)
+    {
+      return {&s, s.nphots().size()};
+    }
+  };
+
+  template <>
+  struct cursor<flat_int_map> {
+    flat_int_map const* m = nullptr;
+    std::size_t i = 0;
+
+    int tick() const { return m->keys()[i]; }
+    int nphots() const { return m->values()[i]; }
+    bool present() const { return m->keys()[i] != flat_int_map::empty_key; }
+    void next() { ++i; }
+    bool operator==(cursor const&) const = default;
+
+    static cursor begin(flat_int_map const& m) { return {&m, 0}; }
+    static cursor
+    end(flat_int_map const& m)
+    {
+      return {&m, m.values().size()};
+    }
+  };
+
+  template <typename S>
+  concept contiguous_soa =
+    soa_layout<S> && requires(S const& s) {
+      { s.ticks } -> std::ranges::contiguous_range;
+      { s.nphots } -> std::ranges::contiguous_range;
+    };
+
+  // Call f(tick, nphots, present) for every slot of s. The SOA layouts in
+  // vectors and both forms of hybrid_channel are indexed loops over
+  // contiguous arrays, which the compiler can vectorize once f is inlined.
+  // The gaps of a dense hybrid_channel and the empty slots of a flat_int_map
+  // hold 0, and are visited with present false; f must ignore them.
+  template <typename S, typename F>
+  constexpr void
+  for_each_slot(S const& s, F&& f)
+  {
+    if constexpr (contiguous_soa<S>) {
+      int const* t = std::ranges::data(s.ticks);
+      int const* v = std::ranges::data(s.nphots);
+      for (std::size_t i = 0, n = std::ranges::size(s.nphots); i != n; ++i) {
+        f(t[i], v[i], true);
+      }
+    } else if constexpr (std::is_same_v<S, hybrid_channel>) {
+      int const* v = s.nphots().data();
+      std::size_t const n = s.nphots().size();
+      if (s.is_dense()) {
+        int const tick_min = s.tick_min();
+        std::uint64_t const* measured = s.measured().data();
+        for (std::size_t i = 0; i != n; ++i) {
+          f(tick_min + static_cast<int>(i),
+            v[i],
+            static_cast<bool>(measured[i / 64] >> i % 64 & 1));
+        }
+      } else {
+        int const* t = s.ticks().data();
+        for (std::size_t i = 0; i != n; ++i) {
+          f(t[i], v[i], true);
+        }
+      }
+    } else if constexpr (std::is_same_v<S, flat_int_map>) {
+      int const* k = s.keys().data();
+      int const* v = s.values().data();
+      for (std::size_t i = 0, n = s.values().size(); i != n; ++i) {
+        f(k[i], v[i], k[i] != flat_int_map::empty_key);
+      }
+    } else {
+      for (auto c = cursor<S>::begin(s), e = cursor<S>::end(s); c != e;
+           c.next()) {
+        f(c.tick(), c.nphots(), c.present());
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////
+// The view.
+template <typename S, typename Mask>
+class channel_view
+  : public std::ranges::view_interface<channel_view<S, Mask>> {
+public:
+  using channel_type = S;
+  using mask_type = Mask;
+
+  class iterator {
+  public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = record;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(view_detail::cursor<S> c,
+             view_detail::cursor<S> end,
+             Mask const* mask)
+      : c_(c), end_(end), mask_(mask)
+    {
+      satisfy();
+    }
+
+    record operator*() const { return {c_.tick(), c_.nphots()}; }
+
+    iterator&
+    operator++()
+    {
+      c_.next();
+      satisfy();
+      return *this;
+    }
+
+    iterator
+    operator++(int)
+    {
+      iterator old = *this;
+      ++*this;
+      return old;
+    }
+
+    bool
+    operator==(iterator const& other) const
+    {
+      return c_ == other.c_;
+    }
+
+  private:
+    void
+    satisfy()
+    {
+      while (!(c_ == end_) &&
+             !(c_.present() && (*mask_)(c_.tick(), c_.nphots()))) {
+        c_.next();
+      }
+    }
+
+    view_detail::cursor<S> c_{};
+    view_detail::cursor<S> end_{};
+    Mask const* mask_ = nullptr;
+  };
+
+  channel_view(S const& channel, Mask mask) : channel_(&channel), mask_(mask)
+  {}
+
+  S const& channel() const noexcept { return *channel_; }
+  Mask const& mask() const noexcept { return mask_; }
+
+  iterator
+  begin() const
+  {
+    return {view_detail::cursor<S>::begin(*channel_),
+            view_detail::cursor<S>::end(*channel_),
+            &mask_};
+  }
+
+  iterator
+  end() const
+  {
+    auto const e = view_detail::cursor<S>::end(*channel_);
+    return {e, e, &mask_};
+  }
+
+private:
+  S const* channel_;
+  Mask mask_;
+};
+
+template <typename S>
+inline constexpr bool is_channel_view = false;
+template <typename S, typename Mask>
+inline constexpr bool is_channel_view<channel_view<S, Mask>> = true;
+
+////////////////////////////////////////////
+// Adaptors.
+namespace photon_views {
+  template <typename Mask>
+  struct adaptor {
+    Mask mask;
+  };
+
+  inline constexpr adaptor<all_measurements> records{};
+
+  constexpr adaptor<above_mask>
+  above(int threshold) noexcept
+  {
+    return {{threshold}};
+  }
+
+  constexpr adaptor<window_mask>
+  window(int first, int last) noexcept
+  {
+    return {{first, last}};
+  }
+
+  // The mask is called as mask(tick, nphots) -> bool, for every measurement;
+  // avoid branches in it to keep the loops vectorized.
+  template <typename Mask>
+  constexpr adaptor<Mask>
+  where(Mask mask)
+  {
+    return {mask};
+  }
+
+  template <typename S, typename Mask>
+  auto
+  operator|(S const& s, adaptor<Mask> const& a)
+  {
+    if constexpr (is_channel_view<S>) {
+      using M = typename S::mask_type;
+      if constexpr (std::is_same_v<Mask, all_measurements>)
+        return s;
+      else if constexpr (std::is_same_v<M, all_measurements>)
+        return channel_view(s.channel(), a.mask);
+      else
+        return channel_view(s.channel(),
+                            both_masks<M, Mask>{s.mask(), a.mask});
+    } else {
+      return channel_view(s, a.mask);
+    }
+  }
+
+  // A view of a temporary container would dangle.
+  template <typename S, typename Mask>
+    requires(!std::is_lvalue_reference_v<S> && !is_channel_view<S>)
+  void operator|(S&& s, adaptor<Mask> const& a) = delete;
+}
+
+////////////////////////////////////////////
+// Operations on the views. Without a mask they are the operations of the
+// channel, from operations_inline.hh.
+template <typename S, typename Mask>
+MULTIVERSION int
+sum(channel_view<S, Mask> const& view)
+{
+  if constexpr (std::is_same_v<Mask, photon_views::all_measurements>) {
+    return kernels::sum(view.channel());
+  } else {
+    Mask const mask = view.mask();
+    int sum = 0;
+    // The slots that are not measurements hold 0.
+    auto const visit = [&](int tick, int nphots, bool) {
+      sum += mask(tick, nphots) ? nphots : 0;
+    };
+    view_detail::for_each_slot(view.channel(), visit);
+    return sum;
+  }
+}
+
+// The measurements outside the view count as -1 photons, so that they never
+// replace the initial result.
+template <typename S, typename Mask>
+MULTIVERSION result_t
+find_largest(channel_view<S, Mask> const& view)
+{
+  if constexpr (std::is_same_v<Mask, photon_views::all_measurements>) {
+    return kernels::find_largest(view.channel());
+  } else {
+    Mask const mask = view.mask();
+    result_t result;
+    auto const visit = [&](int tick, int nphots, bool present) {
+      bool const in = present & mask(tick, nphots);
+      int const value = in ? nphots : -1;
+      if (result.value < value) {
+        result.key = tick;
+        result.value = value;
+      }
+    };
+    view_detail::for_each_slot(view.channel(), visit);
+    return result;
+  }
+}
+
+template <typename S, typename Mask>
+int
+lookup(channel_view<S, Mask> const& view, int tick)
+{
+  int const nphots = kernels::lookup(view.channel(), tick);
+  return view.mask()(tick, nphots) ? nphots : 0;
+}
+
+// As channel_summary of the channel, restricted to the view.
+template <typename S, typename Mask>
+summary_t
+channel_summary(channel_view<S, Mask> const& view,
+                summary_options const& options = {})
+{
+  if constexpr (std::is_same_v<Mask, photon_views::all_measurements>) {
+    return channel_summary(view.channel(), options);
+  } else {
+    Mask const mask = view.mask();
+    kernels::summary_accumulator acc(options);
+    auto const visit = [&](int tick, int nphots, bool present) {
+      if (present && mask(tick, nphots))
+        acc.add(tick, nphots);
+    };
+    view_detail::for_each_slot(view.channel(), visit);
+    return acc.finish();
+  }
+}
+
+////////////////////////////////////////////
+// Channel subsets.
+namespace view_detail {
+  template <typename S>
+  struct channel_at {
+    std::span<S const> channels;
+    S const&
+    operator()(std::size_t i) const
+    {
+      return channels[i];
+    }
+  };
+}
+
+// A random-access view of channels[selected[i]].
+template <typename S>
+using channel_subset =
+  std::ranges::transform_view<std::span<std::size_t const>,
+                              view_detail::channel_at<S>>;
+
+template <typename S>
+channel_subset<S>
+select_channels(std::span<S const> channels,
+                std::span<std::size_t const> selected)
+{
+  return channel_subset<S>(selected, view_detail::channel_at<S>{channels});
+}
+
+// event_summary of the selected channels only; the result is in the order of
+// 'selected'.
+template <typename S>
+std::vector<summary_t>
+event_summary(channel_subset<S> const& channels,
+              summary_options const& options,
+              std::size_t nthreads)
+{
+  std::vector<summary_t> result(channels.size());
+  nthreads = std::max<std::size_t>(1, std::min(nthreads, channels.size()));
+  parallel_for(nthreads, [&](std::size_t t) {
+    auto const [begin, end] = static_partition(channels.size(), nthreads, t);
+    for (std::size_t i = begin; i != end; ++i) {
+      result[i] = channel_summary(channels[i], options);
+    }
+  });
+  return result;
+}
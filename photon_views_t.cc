@@ -0,0 +1,194 @@
+// Benchmark selections made through the views of photon_views.hh against
+// copying the selected measurements into an aos_vector first, as analysis code
+// does now, for every registered layout: the photons above a threshold, the
+// ticks in a window, and both. Also checks that both ways give the same sum,
+// find_largest and channel_summary, and that event_summary over a subset of
+// the channels matches the copied subset.
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <ranges>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "fill_functions.hh"
+#include "layout_registry.hh"
+#include "operations.hh"
+#include "photon_views.hh"
+
+// The selection as a new container. The hash maps are not sorted by tick, so
+// it must be a layout that does not assume it.
+template <typename V>
+aos_vector
+copy_of(V const& view)
+{
+  aos_vector result;
+  for (record r : view) {
+    result.push_back(r);
+  }
+  return result;
+}
+
+bool
+same_summary(summary_t const& a, summary_t const& b)
+{
+  return a.measurements == b.measurements && a.total == b.total &&
+         a.peak.key == b.peak.key && a.peak.value == b.peak.value &&
+         a.above == b.above && a.first_tick == b.first_tick &&
+         a.last_tick == b.last_tick &&
+         (a.mean_time == b.mean_time || (a.mean_time != a.mean_time &&
+                                         b.mean_time != b.mean_time));
+}
+
+template <typename S, typename V>
+void
+run_selection(ankerl::nanobench::Bench* bench,
+              V const& view,
+              std::string const& name)
+{
+  aos_vector const copy = copy_of(view);
+  result_t const a = find_largest(view);
+  result_t const b = find_largest(copy);
+  bool const same = sum(view) == sum(copy) && a.key == b.key &&
+                    a.value == b.value &&
+                    same_summary(channel_summary(view), channel_summary(copy));
+  std::cout << name << ": view matches copy: " << same << '\n';
+
+  int r = 0;
+  result_t largest;
+  bench->run(fmt::format("sum_copy_{}", name),
+             [&]() { r = sum(copy_of(view)); });
+  bench->run(fmt::format("sum_view_{}", name), [&]() { r = sum(view); });
+  bench->run(fmt::format("find_largest_copy_{}", name),
+             [&]() { largest = find_largest(copy_of(view)); });
+  bench->run(fmt::format("find_largest_view_{}", name),
+             [&]() { largest = find_largest(view); });
+  ankerl::nanobench::doNotOptimizeAway(r);
+  ankerl::nanobench::doNotOptimizeAway(largest);
+}
+
+template <typename S>
+void
+run_selections(ankerl::nanobench::Bench* bench,
+               S const& s,
+               std::size_t n,
+               char const* name)
+{
+  using namespace photon_views;
+  int const first = static_cast<int>(n / 4);
+  int const last = static_cast<int>(3 * n / 4);
+  // About half of the photon counts are above the threshold.
+  int const threshold = 5000;
+  run_selection<S>(bench, s | above(threshold), fmt::format("above_{}", name));
+  run_selection<S>(
+    bench, s | window(first, last), fmt::format("window_{}", name));
+  run_selection<S>(bench,
+                   s | window(first, last) | above(threshold),
+                   fmt::format("both_{}", name));
+}
+
+template <typename S>
+void
+run_layout(ankerl::nanobench::Bench* bench, std::size_t n, char const* name)
+{
+  S s;
+  fill(s, n);
+  run_selections(bench, s, n, name);
+}
+
+// fill makes dense hybrid_channels without gaps. This one has a gap at
+// every fourth tick, and some measurements of 0 photons, which the views
+// must tell from the gaps.
+void
+run_gapped_hybrid(ankerl::nanobench::Bench* bench, std::size_t n)
+{
+  using namespace photon_views;
+  std::vector<int> ticks;
+  std::vector<int> nphots;
+  for (std::size_t i = 0; i != n; ++i) {
+    if (i % 4 != 1) {
+      ticks.push_back(static_cast<int>(i));
+      nphots.push_back(i % 7 == 0 ? 0 : static_cast<int>(i * 7919 % 10000));
+    }
+  }
+  hybrid_channel h;
+  h.assign(ticks, nphots);
+  aos_vector const records_copy = copy_of(h | records);
+  bool const same =
+    h.is_dense() && records_copy.size() == ticks.size() &&
+    std::ranges::equal(records_copy, std::views::iota(0u, ticks.size()),
+                       [&](record const& r, std::size_t i) {
+                         return r.first == ticks[i] && r.second == nphots[i];
+                       }) &&
+    same_summary(channel_summary(h | window(INT_MIN, INT_MAX)),
+                 channel_summary(h)) &&
+    same_summary(channel_summary(h | above(-1)), channel_summary(h));
+  std::cout << "gapped hyb: views skip the gaps: " << same << '\n';
+  run_selections(bench, h, n, "gapped_hyb");
+}
+
+int
+main()
+{
+  std::size_t const n = 10000;
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+
+  ankerl::nanobench::Bench b;
+  b.title("channel views").unit("measurement").batch(n);
+  b.minEpochIterations(100);
+  for_each_layout([&](auto const& r) {
+    using S = typename std::remove_cvref_t<decltype(r)>::type;
+    // The cached summary is not a storage layout.
+    if constexpr (!is_summarized_channel<S>)
+      run_layout<S>(&b, n, r.name);
+  });
+  run_gapped_hybrid(&b, n);
+
+  // Every third channel of an event.
+  std::size_t const nchannels = 4096;
+  std::size_t const per_channel = 1000;
+  std::size_t const nthreads =
+    std::max(1u, std::thread::hardware_concurrency());
+  std::vector<soa_vector> event(nchannels);
+  for (auto& c : event) {
+    fill(c, per_channel);
+  }
+  std::vector<std::size_t> selected;
+  for (std::size_t i = 0; i < nchannels; i += 3) {
+    selected.push_back(i);
+  }
+  auto const copy_subset = [&]() {
+    std::vector<soa_vector> result;
+    for (std::size_t i : selected) {
+      result.push_back(event[i]);
+    }
+    return result;
+  };
+  auto const subset =
+    select_channels(std::span<soa_vector const>(event), selected);
+  summary_options const options;
+  auto const copied = copy_subset();
+  bool const same = std::ranges::equal(
+    event_summary(subset, options, nthreads),
+    event_summary(std::span<soa_vector const>(copied), options, nthreads),
+    same_summary);
+  std::cout << "event_summary of the subset matches the copy: " << same
+            << '\n';
+
+  b.batch(selected.size() * per_channel).minEpochIterations(5);
+  std::vector<summary_t> result;
+  b.run("event_subset_copy", [&]() {
+    auto const c = copy_subset();
+    result = event_summary(std::span<soa_vector const>(c), options, nthreads);
+  });
+  b.run("event_subset_view",
+        [&]() { result = event_summary(subset, options, nthreads); });
+  ankerl::nanobench::doNotOptimizeAway(result.data());
+}
@@ -0,0 +1,107 @@
+// Compare the measurement files of several algorithm variants with a
+// reference, event by event, without loading them into memory.
+//
+// Usage: physics_validate [-j threads] [-o output-prefix] reference variant...
+//
+// Each file may be given as name=path; otherwise the name is the file name up
+// to the first '.'. Writes <prefix>summary.tsv, with one row per variant, and
+// <prefix>channels.tsv, with nmeas and nphots for each channel of each event
+// and each file; read them with read_validation_results in functions.R.
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+#include "validation.hh"
+
+namespace {
+  void
+  usage(char const* argv0)
+  {
+    std::cerr << "Usage: " << argv0
+              << " [-j threads] [-o output-prefix] reference variant...\n";
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  validation_options options;
+  std::string prefix;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (std::strcmp(argv[i], "-j") == 0)
+      options.nthreads = std::atol(argv[i + 1]);
+    else if (std::strcmp(argv[i], "-o") == 0)
+      prefix = argv[i + 1];
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - i < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<std::filesystem::path> files;
+  std::vector<std::string> names;
+  for (; i != argc; ++i) {
+    std::string const arg = argv[i];
+    auto const eq = arg.find('=');
+    if (eq != std::string::npos) {
+      names.push_back(arg.substr(0, eq));
+      files.emplace_back(arg.substr(eq + 1));
+    } else {
+      files.emplace_back(arg);
+      std::string const stem = files.back().filename().string();
+      names.push_back(stem.substr(0, stem.find('.')));
+    }
+  }
+  options.channels_output = prefix + "channels.tsv";
+
+  try {
+    auto const t0 = std::chrono::steady_clock::now();
+    auto const result = validate_measurements(files, names, options);
+    auto const t1 = std::chrono::steady_clock::now();
+    write_summary(result, prefix + "summary.tsv");
+
+    fmt::print("events: {}, channels: {}, reference: {}, time: {:.2f} s\n",
+               result.events,
+               result.channels,
+               names.front(),
+               std::chrono::duration<double>(t1 - t0).count());
+    fmt::print("| {:>10} | {:>10} | {:>10} | {:>10} | {:>10} | {:>10} | {}\n",
+               "differing",
+               "sd dnmeas",
+               "sd dnphots",
+               "matched",
+               "ref only",
+               "var only",
+               "variant");
+    fmt::print("|-----------:|-----------:|-----------:|-----------:|"
+               "-----------:|-----------:|:---\n");
+    for (auto const& v : result.variants) {
+      fmt::print(
+        "| {:>10} | {:>10.4f} | {:>10.4f} | {:>10} | {:>10} | {:>10} | `{}`\n",
+        v.channels_differing,
+        std::sqrt(v.dnmeas.variance()),
+        std::sqrt(v.dnphots.variance()),
+        v.matched,
+        v.reference_only,
+        v.variant_only,
+        v.name);
+    }
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bounded_queue.hh"
+
+// pipeline runs the processing of a stream of events as a chain of stages,
+// each with its own threads, connected by bounded queues, so that the
+// reading, decoding, simulation, accumulation and writing of different
+// events overlap:
+//
+//   source -> stage 1 -> stage 2 -> ... -> stage n
+//
+// The source fills one event at a time. At most 'events_in_flight' events
+// exist at once: the event objects are allocated once, and each goes back to
+// the source when the last stage is done with it, so the buffers inside
+// them are reused. With one event in flight the stages run strictly in
+// sequence.
+//
+// A stage with several threads processes several events at once, and may
+// pass them on out of order; an ordered stage has one thread, and sees the
+// events in the order of the source.
+//
+// If a stage throws, the pipeline is stopped: the events still queued are
+// dropped without being processed, and run rethrows the first exception.
+
+// What each stage did during a run. A stall is a wait of one of its threads
+// for an event: for the source, for an event to come back from the last
+// stage; for the others, for an event from the stage before.
+struct stage_stats {
+  std::string name;
+  std::size_t threads = 0;
+  std::size_t events = 0;
+  // Time spent in the stage's function, summed over its threads.
+  double busy_seconds = 0.0;
+  // busy_seconds / (threads * the duration of the run).
+  double occupancy = 0.0;
+  std::size_t stalls = 0;
+};
+
+struct pipeline_report {
+  double seconds = 0.0;
+  std::size_t events = 0;
+  std::vector<stage_stats> stages;
+};
+
+template <typename E>
+class pipeline {
+public:
+  explicit pipeline(std::size_t events_in_flight);
+
+  // The source fills the event it is given (which may hold the data of an
+  // earlier event), and returns false when there are no more events.
+  void source(std::string name, std::function<bool(E&)> produce);
+  void stage(std::string name,
+             std::size_t nthreads,
+             std::function<void(E&)> process);
+  void ordered_stage(std::string name, std::function<void(E&)> process);
+
+  pipeline_report run();
+
+private:
+  struct slot {
+    std::size_t index = 0;
+    E event;
+  };
+  using slot_ptr = std::unique_ptr<slot>;
+  using queue = bounded_queue<slot_ptr>;
+
+  struct stage_definition {
+    std::string name;
+    std::size_t nthreads;
+    bool ordered;
+    std::function<void(E&)> process;
+  };
+
+  // The busy time and number of events of one thread.
+  struct thread_stats {
+    double busy_seconds = 0.0;
+    std::size_t events = 0;
+  };
+
+  std::size_t events_in_flight_;
+  std::string source_name_;
+  std::function<bool(E&)> produce_;
+  std::vector<stage_definition> stages_;
+};
+
+////////////////////////////////////////////
+// Implementation
+
+template <typename E>
+pipeline<E>::pipeline(std::size_t events_in_flight)
+  : events_in_flight_(events_in_flight == 0 ? 1 : events_in_flight)
+{}
+
+template <typename E>
+void
+pipeline<E>::source(std::string name, std::function<bool(E&)> produce)
+{
+  source_name_ = std::move(name);
+  produce_ = std::move(produce);
+}
+
+template <typename E>
+void
+pipeline<E>::stage(std::string name,
+                   std::size_t nthreads,
+                   std::function<void(E&)> process)
+{
+  stages_.push_back(
+    {std::move(name), nthreads == 0 ? 1 : nthreads, false, std::move(process)});
+}
+
+template <typename E>
+void
+pipeline<E>::ordered_stage(std::string name, std::function<void(E&)> process)
+{
+  stages_.push_back({std::move(name), 1, true, std::move(process)});
+}
+
+// queues[0] holds the free events, and queues[i] the input of stage i. Each
+// queue can hold every event, so a push never waits, and the only stalls
+// are on pop.
+template <typename E>
+pipeline_report
+pipeline<E>::run()
+{
+  using clock = std::chrono::steady_clock;
+  std::size_t const nstages = stages_.size();
+  std::vector<std::unique_ptr<queue>> queues;
+  for (std::size_t i = 0; i != nstages + 1; ++i) {
+    queues.push_back(std::make_unique<queue>(events_in_flight_));
+  }
+  for (std::size_t i = 0; i != events_in_flight_; ++i) {
+    queues[0]->push(std::make_unique<slot>());
+  }
+  auto output_of = [&](std::size_t stage) -> queue& {
+    return stage + 1 == nstages ? *queues[0] : *queues[stage + 2];
+  };
+
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  // Set with error, for the threads to check without the lock.
+  std::atomic<bool> failed = false;
+  auto fail = [&](std::exception_ptr e) {
+    {
+      std::lock_guard lock(error_mutex);
+      if (!error)
+        error = e;
+    }
+    failed = true;
+    for (auto& q : queues) {
+      q->close();
+    }
+  };
+
+  // One entry per thread, the source's first.
+  std::vector<std::vector<thread_stats>> stats(nstages + 1);
+  stats[0].resize(1);
+  for (std::size_t s = 0; s != nstages; ++s) {
+    stats[s + 1].resize(stages_[s].nthreads);
+  }
+  // The number of running threads of each stage; the last one to finish
+  // closes the stage's output.
+  std::vector<std::atomic<std::size_t>> running(nstages);
+  for (std::size_t s = 0; s != nstages; ++s) {
+    running[s] = stages_[s].nthreads;
+  }
+
+  auto timed = [](thread_stats& st, auto&& f) {
+    auto const t0 = clock::now();
+    auto const result = f();
+    st.busy_seconds += std::chrono::duration<double>(clock::now() - t0).count();
+    return result;
+  };
+
+  auto const start = clock::now();
+  {
+    std::vector<std::jthread> threads;
+    threads.emplace_back([&]() {
+      queue& out = nstages == 0 ? *queues[0] : *queues[1];
+      thread_stats& st = stats[0][0];
+      try {
+        for (std::size_t index = 0;; ++index) {
+          auto s = queues[0]->pop();
+          if (!s || failed)
+            break;
+          (*s)->index = index;
+          if (!timed(st, [&]() { return produce_((*s)->event); }))
+            break;
+          ++st.events;
+          out.push(std::move(*s));
+        }
+      }
+      catch (...) {
+        fail(std::current_exception());
+      }
+      if (nstages != 0)
+        queues[1]->close();
+    });
+
+    for (std::size_t s = 0; s != nstages; ++s) {
+      for (std::size_t t = 0; t != stages_[s].nthreads; ++t) {
+        threads.emplace_back([&, s, t]() {
+          stage_definition const& def = stages_[s];
+          thread_stats& st = stats[s + 1][t];
+          auto process = [&](slot_ptr p) {
+            if (failed)
+              return;
+            timed(st, [&]() {
+              def.process(p->event);
+              return true;
+            });
+            ++st.events;
+            output_of(s).push(std::move(p));
+          };
+          // The events that arrived before their turn, for an ordered
+          // stage.
+          std::map<std::size_t, slot_ptr> early;
+          std::size_t next = 0;
+          try {
+            while (auto p = queues[s + 1]->pop()) {
+              if (!def.ordered) {
+                process(std::move(*p));
+                continue;
+              }
+              early.emplace((*p)->index, std::move(*p));
+              while (!early.empty() && early.begin()->first == next) {
+                process(std::move(early.begin()->second));
+                early.erase(early.begin());
+                ++next;
+              }
+            }
+          }
+          catch (...) {
+            fail(std::current_exception());
+          }
+          if (--running[s] == 0 && s + 1 != nstages)
+            queues[s + 2]->close();
+        });
+      }
+    }
+  }
+  double const seconds =
+    std::chrono::duration<double>(clock::now() - start).count();
+  if (error)
+    std::rethrow_exception(error);
+
+  pipeline_report report;
+  report.seconds = seconds;
+  report.events = stats[0][0].events;
+  for (std::size_t s = 0; s != nstages + 1; ++s) {
+    stage_stats r;
+    r.name = s == 0 ? source_name_ : stages_[s - 1].name;
+    r.threads = stats[s].size();
+    for (auto const& st : stats[s]) {
+      r.busy_seconds += st.busy_seconds;
+      r.events += st.events;
+    }
+    r.occupancy = seconds > 0.0 ? r.busy_seconds / (r.threads * seconds) : 0.0;
+    r.stalls = queues[s]->empty_waits();
+    report.stages.push_back(std::move(r));
+  }
+  return report;
+}
@@ -0,0 +1,220 @@
+#include "poisson.hh"
+#include "cpu_dispatch.hh"
+#include "philox.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <numbers>
+
+namespace {
+  constexpr std::size_t group = 32;
+  // The smallest mean sampled by PTRS, which needs at least 10.
+  constexpr double ptrs_mean = 10.0;
+  // Enough steps of the inversion for every mean below ptrs_mean: P(X >= 64)
+  // is below 1e-30.
+  constexpr int max_steps = 64;
+
+  // exp(-m) for 0 <= m < ptrs_mean, the means sampled by inversion, as
+  // exp(-m / 16)^16 with a Taylor polynomial for exp(-m / 16), which
+  // vectorizes, unlike std::exp. The relative error is below 1.1e-11 there,
+  // but grows quickly above: 1.2e-10 at 12, 6.5e-9 at 16.
+  double
+  exp_minus(double m) noexcept
+  {
+    double const y = -m / 16.0;
+    double q = 1.0;
+    for (int n = 12; n != 0; --n) {
+      q = 1.0 + q * y * (1.0 / n);
+    }
+    q *= q;
+    q *= q;
+    q *= q;
+    return q * q;
+  }
+
+  // log(k!), summed for small k and from Stirling's series for the others.
+  double
+  log_factorial(double k) noexcept
+  {
+    if (k < 16.0) {
+      double r = 0.0;
+      for (double i = 2.0; i <= k; ++i) {
+        r += std::log(i);
+      }
+      return r;
+    }
+    double const x = k + 1.0;
+    double const x2 = x * x;
+    return (x - 0.5) * std::log(x) - x +
+           0.5 * std::log(2.0 * std::numbers::pi) +
+           (1.0 / 12.0 - (1.0 / 360.0 - 1.0 / (1260.0 * x2)) / x2) / x;
+  }
+
+  // The constants of PTRS for one mean.
+  struct ptrs_constants {
+    double b;
+    double a;
+    double vr;
+
+    explicit ptrs_constants(double mean) noexcept
+      : b(0.931 + 2.53 * std::sqrt(mean))
+      , a(-0.059 + 0.02483 * b)
+      , vr(0.9277 - 3.6224 / (b - 2.0))
+    {}
+
+    // The candidate of one trial, from the uniforms u in (-0.5, 0.5) and
+    // us = 0.5 - |u|.
+    double
+    candidate(double mean, double u, double us) const noexcept
+    {
+      return std::floor((2.0 * a / us + b) * u + mean + 0.43);
+    }
+  };
+
+  // PTRS from its first trial, each trial taking two numbers of the
+  // element's engine.
+  double
+  ptrs_count(philox_engine engine, double mean) noexcept
+  {
+    ptrs_constants const c(mean);
+    double const log_mean = std::log(mean);
+    double const alpha = 1.1239 + 1.1328 / (c.b - 3.4);
+    for (;;) {
+      double const u = uniform_open01(engine()) - 0.5;
+      double const v = uniform_open01(engine());
+      double const us = 0.5 - std::abs(u);
+      double const k = c.candidate(mean, u, us);
+      if (us >= 0.07 && v <= c.vr)
+        return k;
+      if (k < 0.0 || (us < 0.013 && v > us))
+        continue;
+      if (std::log(v * alpha / (c.a / (us * us) + c.b)) <=
+          -mean + k * log_mean - log_factorial(k))
+        return k;
+    }
+  }
+
+  // PTRS for the elements at the given positions, all with means of at least
+  // ptrs_mean; those above poisson_max_mean are sampled with that mean.
+  // Their first trials are computed together, in groups (the last one
+  // padded with copies of its last element), and the elements not accepted
+  // by the quick test are finished one at a time.
+  MULTIVERSION void
+  ptrs_counts(std::uint64_t seed,
+              std::uint64_t stream,
+              std::uint32_t first,
+              std::span<float const> means,
+              std::span<int> counts,
+              std::span<std::uint32_t const> positions)
+  {
+    for (std::size_t g = 0; g < positions.size(); g += group) {
+      std::size_t const n = std::min(group, positions.size() - g);
+      std::array<double, group> mean;
+      std::array<std::uint32_t, group> substream;
+      for (std::size_t j = 0; j != group; ++j) {
+        std::uint32_t const i = positions[g + std::min(j, n - 1)];
+        mean[j] = std::min<double>(means[i], poisson_max_mean);
+        substream[j] = first + i + 1;
+      }
+      std::array<std::uint32_t, group> u_draw;
+      std::array<std::uint32_t, group> v_draw;
+      for (std::size_t j = 0; j != group; ++j) {
+        auto const block =
+          philox_engine(seed, stream, substream[j]).block_at(0);
+        u_draw[j] = block[0];
+        v_draw[j] = block[1];
+      }
+      // The max tells the compiler that the square root can not fail.
+      std::array<double, group> candidate;
+      std::array<bool, group> accepted;
+      for (std::size_t j = 0; j != group; ++j) {
+        double const m = std::max(mean[j], ptrs_mean);
+        ptrs_constants const c(m);
+        double const u = uniform_open01(u_draw[j]) - 0.5;
+        double const v = uniform_open01(v_draw[j]);
+        double const us = 0.5 - std::abs(u);
+        candidate[j] = c.candidate(m, u, us);
+        accepted[j] = us >= 0.07 && v <= c.vr;
+      }
+      for (std::size_t j = 0; j != n; ++j) {
+        counts[positions[g + j]] = static_cast<int>(
+          accepted[j] ?
+            candidate[j] :
+            ptrs_count(philox_engine(seed, stream, substream[j]), mean[j]));
+      }
+    }
+  }
+}
+
+// Element e draws number e of substream 0 for the inversion, and the
+// numbers of substream e + 1 for PTRS. The arrays of a group are padded
+// with zero means, so the loops over them have a constant trip count. The
+// elements with large means are collected, and handed to ptrs_counts
+// together, so that their groups are full whatever the spread of the
+// means.
+MULTIVERSION void
+poisson_counts(std::uint64_t seed,
+               std::uint64_t stream,
+               std::uint32_t first,
+               std::span<float const> means,
+               std::span<int> counts)
+{
+  philox_engine const uniforms(seed, stream, 0);
+  std::array<std::uint32_t, 8 * group> large;
+  std::size_t nlarge = 0;
+  for (std::size_t g = 0; g < means.size(); g += group) {
+    std::size_t const n = std::min(group, means.size() - g);
+    std::uint64_t const e0 = first + g;
+
+    // The blocks holding the uniforms of elements e0 to e0 + group - 1.
+    std::array<std::uint32_t, group + 4> draws;
+    for (std::size_t b = 0; b != group / 4 + 1; ++b) {
+      auto const block = uniforms.block_at((e0 >> 2) + b);
+      std::ranges::copy(block, draws.begin() + 4 * b);
+    }
+    std::uint32_t const* const draw = draws.data() + (e0 & 3);
+
+    std::array<double, group> mean{};
+    for (std::size_t j = 0; j != n; ++j) {
+      float const m = means[g + j];
+      mean[j] = m > 0.0f && m < ptrs_mean ? m : 0.0;
+    }
+
+    // Inversion; p is P(X = step) and cdf is P(X <= step).
+    std::array<double, group> u;
+    std::array<double, group> p;
+    std::array<double, group> cdf;
+    std::array<double, group> k;
+    for (std::size_t j = 0; j != group; ++j) {
+      u[j] = uniform_open01(draw[j]);
+      p[j] = exp_minus(mean[j]);
+      cdf[j] = p[j];
+      k[j] = 0.0;
+    }
+    for (int step = 1; step != max_steps; ++step) {
+      double const inverse = 1.0 / step;
+      int searching = 0;
+      for (std::size_t j = 0; j != group; ++j) {
+        bool const above = u[j] > cdf[j];
+        k[j] += above ? 1.0 : 0.0;
+        p[j] *= mean[j] * inverse;
+        cdf[j] += p[j];
+        searching += above;
+      }
+      if (searching == 0)
+        break;
+    }
+    for (std::size_t j = 0; j != n; ++j) {
+      counts[g + j] = static_cast<int>(k[j]);
+      if (means[g + j] >= ptrs_mean)
+        large[nlarge++] = static_cast<std::uint32_t>(g + j);
+    }
+    if (nlarge > large.size() - group) {
+      ptrs_counts(seed, stream, first, means, counts, {large.data(), nlarge});
+      nlarge = 0;
+    }
+  }
+  ptrs_counts(seed, stream, first, means, counts, {large.data(), nlarge});
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// Batched Poisson sampling, to turn the expected photon yields of many
+// (deposit, channel) pairs into integer counts at once.
+//
+// counts[i] is a Poisson count with mean means[i]; it is element first + i
+// of 'stream', and depends only on (seed, stream, first + i, means[i]), so
+// splitting an array into batches, or between threads, does not change the
+// counts. The stream should not be used for anything else, and the elements
+// must be numbered below 2^32 - 1. Negative and NaN means give 0, and means
+// above poisson_max_mean, including infinity, are taken as poisson_max_mean,
+// whose counts are well within the range of int.
+//
+// The elements are processed in groups of 32 with simple loops over the
+// group, which vectorize (MULTIVERSION):
+//
+//   - means below 10 by inversion: one uniform u per element, and the count
+//     is the smallest k with u <= P(X <= k). The groups step through k
+//     together, until u is reached in every element, so the cost is about
+//     that of the largest count of the group;
+//   - means of 10 and more by PTRS, the transformed rejection of Hoermann
+//     ("The transformed rejection method for generating Poisson random
+//     variables", 1993). The quick acceptance test of the first trial,
+//     which takes no logarithm, is vectorized; it accepts about a third of
+//     the elements at a mean of 10, and 80% at large means. The other
+//     elements are finished one at a time.
+void poisson_counts(std::uint64_t seed,
+                    std::uint64_t stream,
+                    std::uint32_t first,
+                    std::span<float const> means,
+                    std::span<int> counts);
+
+// The largest mean poisson_counts samples with.
+inline constexpr double poisson_max_mean = 1e9;
@@ -0,0 +1,214 @@
+// Benchmark poisson_counts against std::poisson_distribution, drawing one
+// count per element from arrays of means: the same mean everywhere, and the
+// spread of means of the photon yields of deposits weighted by visibility.
+// Also checks the distribution of the counts with a chi-square test for
+// several means (std::poisson_distribution is tested alongside, for
+// reference), and that splitting an array into batches does not change the
+// counts.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "philox.hh"
+#include "poisson.hh"
+
+struct chi_square {
+  double value = 0.0;
+  std::size_t dof = 0;
+
+  // The Wilson-Hilferty approximation of the normal deviate of 'value':
+  // small (|z| < 4, say) when the counts follow the distribution.
+  double
+  z() const
+  {
+    double const v = static_cast<double>(dof);
+    double const s = 2.0 / (9.0 * v);
+    return (std::cbrt(value / v) - (1.0 - s)) / std::sqrt(s);
+  }
+};
+
+// The chi-square of the counts against the Poisson distribution, in bins of
+// at least 20 expected counts; the tails are merged into the first and last
+// bins.
+chi_square
+test_poisson(std::span<int const> counts, double mean)
+{
+  auto const last = static_cast<int>(mean + 20 * std::sqrt(mean) + 30);
+  std::vector<double> observed(last + 1);
+  for (int k : counts) {
+    observed[std::clamp(k, 0, last)] += 1;
+  }
+  double const n = static_cast<double>(counts.size());
+  std::vector<double> expected(last + 1);
+  double remaining = n;
+  for (int k = 0; k != last; ++k) {
+    expected[k] =
+      n * std::exp(k * std::log(mean) - mean - std::lgamma(k + 1.0));
+    remaining -= expected[k];
+  }
+  expected[last] = std::max(remaining, 0.0);
+
+  chi_square result;
+  double o = 0.0;
+  double e = 0.0;
+  // The expected counts after k.
+  double tail = n;
+  std::size_t bins = 0;
+  for (int k = 0; k <= last; ++k) {
+    o += observed[k];
+    e += expected[k];
+    tail -= expected[k];
+    // Close the bin if it is large enough, and so is what is left.
+    if ((e >= 20.0 && tail >= 20.0) || k == last) {
+      result.value += (o - e) * (o - e) / e;
+      ++bins;
+      o = 0.0;
+      e = 0.0;
+    }
+  }
+  result.dof = bins - 1;
+  return result;
+}
+
+// Print the chi-squares of poisson_counts and std::poisson_distribution for
+// this mean; return whether the counts of poisson_counts pass (|z| < 4).
+bool
+report_distribution(double mean, std::size_t n)
+{
+  std::vector<float> const means(n, static_cast<float>(mean));
+  std::vector<int> counts(n);
+  poisson_counts(123, 7, 0, means, counts);
+  chi_square const batched = test_poisson(counts, means[0]);
+
+  philox_engine engine(123, 8);
+  std::poisson_distribution<int> dist(mean);
+  std::ranges::generate(counts, [&]() { return dist(engine); });
+  chi_square const standard = test_poisson(counts, mean);
+
+  fmt::print("| {:>8.2f} | {:>4} | {:>10.1f} | {:>6.2f} | {:>10.1f} | "
+             "{:>6.2f} |\n",
+             mean,
+             batched.dof,
+             batched.value,
+             batched.z(),
+             standard.value,
+             standard.z());
+  return std::abs(batched.z()) < 4.0;
+}
+
+// The means of the photon counts of deposits seen by one channel: the
+// yield of a deposit times the visibility, which falls with the square of
+// the distance, so most means are well below one and a few are large.
+std::vector<float>
+visibility_weighted_means(std::size_t n)
+{
+  std::mt19937_64 engine(123);
+  std::uniform_real_distribution<double> distance{1.0, 100.0};
+  std::vector<float> result(n);
+  for (auto& m : result) {
+    double const r = distance(engine);
+    m = static_cast<float>(500.0 / (r * r));
+  }
+  return result;
+}
+
+// The counts of the whole array in one call, and in batches of awkward
+// sizes.
+bool
+batches_match(std::span<float const> means)
+{
+  std::vector<int> whole(means.size());
+  std::vector<int> pieces(means.size());
+  poisson_counts(123, 9, 0, means, whole);
+  std::size_t const sizes[] = {1, 7, 33, 100, 3};
+  for (std::size_t i = 0, b = 0; i < means.size(); ++b) {
+    std::size_t const n = std::min(sizes[b % 5], means.size() - i);
+    poisson_counts(123,
+                   9,
+                   static_cast<std::uint32_t>(i),
+                   means.subspan(i, n),
+                   std::span(pieces).subspan(i, n));
+    i += n;
+  }
+  return whole == pieces;
+}
+
+// Means that would overflow an int, or make PTRS loop on NaNs, are
+// clamped to poisson_max_mean.
+bool
+huge_means_clamped()
+{
+  std::vector<float> const means = {
+    1e12f, std::numeric_limits<float>::infinity(), 1e9f, -1.0f};
+  std::vector<int> counts(means.size());
+  poisson_counts(123, 10, 0, means, counts);
+  double const spread = 10 * std::sqrt(poisson_max_mean);
+  return std::abs(counts[0] - poisson_max_mean) < spread &&
+         std::abs(counts[1] - poisson_max_mean) < spread &&
+         std::abs(counts[2] - poisson_max_mean) < spread && counts[3] == 0;
+}
+
+int
+main()
+{
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  fmt::print("\n| {:>8} | {:>4} | {:>10} | {:>6} | {:>10} | {:>6} |\n",
+             "mean",
+             "dof",
+             "chi2",
+             "z",
+             "std chi2",
+             "std z");
+  fmt::print("|---------:|-----:|-----------:|-------:|-----------:|"
+             "-------:|\n");
+  bool consistent = true;
+  for (double mean : {0.05, 0.7, 3.0, 9.9, 10.0, 25.0, 300.0, 1e4}) {
+    consistent = report_distribution(mean, 2'000'000) && consistent;
+  }
+  std::cout << "\ndistribution consistent with Poisson: " << consistent
+            << '\n';
+
+  std::size_t const n = 1 << 20;
+  std::vector<float> const weighted = visibility_weighted_means(n);
+  std::cout << "batches give identical counts: " << batches_match(weighted)
+            << '\n';
+  std::cout << "huge and infinite means clamped: " << huge_means_clamped()
+            << '\n';
+
+  ankerl::nanobench::Bench b;
+  b.title("poisson counts").unit("count").batch(n).minEpochIterations(3);
+  std::vector<int> counts(n);
+  auto run = [&](std::string const& name, std::vector<float> const& means) {
+    b.run(fmt::format("std_mt19937_{}", name), [&]() {
+      std::mt19937 engine(123);
+      std::poisson_distribution<int> dist;
+      using param = std::poisson_distribution<int>::param_type;
+      for (std::size_t i = 0; i != n; ++i) {
+        counts[i] = dist(engine, param(means[i]));
+      }
+    });
+    b.run(fmt::format("poisson_count_{}", name), [&]() {
+      for (std::size_t i = 0; i != n; ++i) {
+        counts[i] =
+          poisson_count(123, 7, static_cast<std::uint32_t>(i), means[i]);
+      }
+    });
+    b.run(fmt::format("poisson_counts_{}", name),
+          [&]() { poisson_counts(123, 7, 0, means, counts); });
+    ankerl::nanobench::doNotOptimizeAway(counts.data());
+  };
+  for (float mean : {0.1f, 1.0f, 5.0f, 50.0f}) {
+    run(fmt::format("{}", mean), std::vector<float>(n, mean));
+  }
+  run("weighted", weighted);
+}
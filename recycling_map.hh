@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// recycling_map wraps a std::map or std::unordered_map, and keeps the nodes of
+// erased elements for reuse by later insertions, so that a map that is
+// cleared and refilled event after event stops allocating once it has seen
+// its largest event. It is a keyed_layout, so the fill and operations
+// templates work with it.
+template <typename Map>
+class recycling_map {
+public:
+  using key_type = typename Map::key_type;
+  using mapped_type = typename Map::mapped_type;
+  using value_type = typename Map::value_type;
+  using iterator = typename Map::iterator;
+  using const_iterator = typename Map::const_iterator;
+
+  // Node handles can not be copied, so neither can a recycling_map.
+  recycling_map() = default;
+  recycling_map(recycling_map const&) = delete;
+  recycling_map(recycling_map&&) = default;
+  recycling_map& operator=(recycling_map const&) = delete;
+  recycling_map& operator=(recycling_map&&) = default;
+
+  iterator begin() noexcept { return map_.begin(); }
+  iterator end() noexcept { return map_.end(); }
+  const_iterator begin() const noexcept { return map_.begin(); }
+  const_iterator end() const noexcept { return map_.end(); }
+  std::size_t size() const noexcept { return map_.size(); }
+  bool empty() const noexcept { return map_.empty(); }
+  const_iterator find(key_type const& k) const { return map_.find(k); }
+
+  std::pair<iterator, bool> insert(value_type const& v);
+
+  // Move all nodes to the spare list.
+  void clear() noexcept;
+  // Number of nodes owned, in use or spare.
+  std::size_t capacity() const noexcept;
+  // Release spare nodes until at most n nodes are owned.
+  void trim(std::size_t n) noexcept;
+
+private:
+  Map map_;
+  std::vector<typename Map::node_type> spare_;
+};
+
+template <typename Map>
+std::pair<typename recycling_map<Map>::iterator, bool>
+recycling_map<Map>::insert(value_type const& v)
+{
+  if (spare_.empty())
+    return map_.insert(v);
+  auto node = std::move(spare_.back());
+  spare_.pop_back();
+  node.key() = v.first;
+  node.mapped() = v.second;
+  auto result = map_.insert(std::move(node));
+  if (!result.inserted)
+    spare_.push_back(std::move(result.node));
+  return {result.position, result.inserted};
+}
+
+template <typename Map>
+void
+recycling_map<Map>::clear() noexcept
+{
+  try {
+    spare_.reserve(spare_.size() + map_.size());
+  }
+  catch (std::bad_alloc const&) {
+    map_.clear();
+    return;
+  }
+  while (!map_.empty()) {
+    spare_.push_back(map_.extract(map_.begin()));
+  }
+}
+
+template <typename Map>
+std::size_t
+recycling_map<Map>::capacity() const noexcept
+{
+  return map_.size() + spare_.size();
+}
+
+template <typename Map>
+void
+recycling_map<Map>::trim(std::size_t n) noexcept
+{
+  while (!spare_.empty() && capacity() > n) {
+    spare_.pop_back();
+  }
+}
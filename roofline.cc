@@ -0,0 +1,218 @@
+#include "roofline.hh"
+#include "cpu_dispatch.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "fmt/format.h"
+
+namespace {
+
+  using clock = std::chrono::steady_clock;
+
+  // Repeat f until at least min_seconds have passed; return the seconds per
+  // call of the fastest of a few such batches.
+  template <typename F>
+  double
+  time_per_call(F&& f, double min_seconds = 0.02)
+  {
+    double best = 1e300;
+    for (int batch = 0; batch != 3; ++batch) {
+      std::size_t calls = 0;
+      auto const t0 = clock::now();
+      double elapsed = 0.0;
+      do {
+        f();
+        ++calls;
+        elapsed = std::chrono::duration<double>(clock::now() - t0).count();
+      } while (elapsed < min_seconds);
+      best = std::min(best, elapsed / calls);
+    }
+    return best;
+  }
+
+  // Several independent accumulators, so the loop is limited by loads
+  // rather than by the latency of the adds. 32-bit, like the kernels' sums.
+  MULTIVERSION std::uint32_t
+  read_sum(std::uint32_t const* data, std::size_t n)
+  {
+    std::uint32_t acc[16] = {};
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      for (int j = 0; j != 16; ++j) {
+        acc[j] += data[i + j];
+      }
+    }
+    std::uint32_t total = 0;
+    for (; i != n; ++i) {
+      total += data[i];
+    }
+    for (auto a : acc) {
+      total += a;
+    }
+    return total;
+  }
+
+  MULTIVERSION void
+  triad(double* a, double const* b, double const* c, double s, std::size_t n)
+  {
+    for (std::size_t i = 0; i != n; ++i) {
+      a[i] = b[i] + s * c[i];
+    }
+  }
+
+  // 64 independent chains, enough to cover the latency of the multiply-add
+  // units with the widest vectors. Contraction into fused multiply-adds is
+  // allowed here (the build is ISO C++, which disables it by default), so
+  // the clones for ISAs with FMA reach the FMA peak.
+  constexpr int fp_chains = 64;
+
+  MULTIVERSION __attribute__((optimize("fp-contract=fast"))) double
+  fma_chains(std::size_t iterations, double a, double b)
+  {
+    double acc[fp_chains];
+    for (int j = 0; j != fp_chains; ++j) {
+      acc[j] = 1.0 + j * 1e-3;
+    }
+    for (std::size_t it = 0; it != iterations; ++it) {
+      for (int j = 0; j != fp_chains; ++j) {
+        acc[j] = acc[j] * a + b;
+      }
+    }
+    double total = 0.0;
+    for (auto x : acc) {
+      total += x;
+    }
+    return total;
+  }
+
+  // Two integer operations per element and iteration; the xor keeps the
+  // compiler from replacing the repeated adds with a multiplication.
+  constexpr int int_chains = 128;
+
+  MULTIVERSION std::uint32_t
+  int_chains_run(std::size_t iterations, std::uint32_t a, std::uint32_t b)
+  {
+    std::uint32_t acc[int_chains];
+    for (int j = 0; j != int_chains; ++j) {
+      acc[j] = static_cast<std::uint32_t>(j);
+    }
+    for (std::size_t it = 0; it != iterations; ++it) {
+      for (int j = 0; j != int_chains; ++j) {
+        acc[j] = (acc[j] + a) ^ b;
+      }
+    }
+    std::uint32_t total = 0;
+    for (auto x : acc) {
+      total += x;
+    }
+    return total;
+  }
+
+  volatile double fp_sink;
+  volatile std::uint32_t int_sink;
+}
+
+double
+machine_peaks::bandwidth_for(std::size_t working_set) const noexcept
+{
+  for (auto const& p : bandwidth) {
+    if (p.working_set >= working_set)
+      return p.bytes_per_second;
+  }
+  return bandwidth.empty() ? 0.0 : bandwidth.back().bytes_per_second;
+}
+
+machine_peaks
+measure_machine()
+{
+  machine_peaks peaks;
+
+  // 16 KiB to 256 MiB: L1, L2, L3 and main memory on current x86 servers.
+  std::size_t const largest = std::size_t{256} << 20;
+  std::vector<std::uint32_t> data(largest / sizeof(std::uint32_t), 1);
+  for (std::size_t bytes = std::size_t{16} << 10; bytes <= largest;
+       bytes *= 4) {
+    std::size_t const n = bytes / sizeof(std::uint32_t);
+    double const t =
+      time_per_call([&]() { int_sink = read_sum(data.data(), n); });
+    peaks.bandwidth.push_back({bytes, bytes / t});
+  }
+  data = {};
+
+  std::size_t const nd = largest / 3 / sizeof(double);
+  std::vector<double> a(nd, 0.0), b(nd, 1.0), c(nd, 2.0);
+  double const t_triad =
+    time_per_call([&]() { triad(a.data(), b.data(), c.data(), 3.0, nd); });
+  peaks.triad_bytes_per_second = 3.0 * nd * sizeof(double) / t_triad;
+
+  std::size_t const iterations = 100000;
+  double const t_fp = time_per_call(
+    [&]() { fp_sink = fma_chains(iterations, 0.999999, 1e-7); });
+  peaks.flops_per_second = 2.0 * fp_chains * iterations / t_fp;
+  double const t_int =
+    time_per_call([&]() { int_sink = int_chains_run(iterations, 3, 5); });
+  peaks.int_ops_per_second = 2.0 * int_chains * iterations / t_int;
+  return peaks;
+}
+
+std::string
+describe(machine_peaks const& peaks)
+{
+  std::string text;
+  auto out = std::back_inserter(text);
+  for (auto const& p : peaks.bandwidth) {
+    fmt::format_to(out,
+                   "read bandwidth, {:>7} KiB working set: {:8.2f} GB/s\n",
+                   p.working_set >> 10,
+                   p.bytes_per_second / 1e9);
+  }
+  fmt::format_to(out,
+                 "STREAM triad: {:.2f} GB/s\n"
+                 "peak double multiply-add: {:.2f} Gflop/s\n"
+                 "peak int32 add: {:.2f} Gop/s\n",
+                 peaks.triad_bytes_per_second / 1e9,
+                 peaks.flops_per_second / 1e9,
+                 peaks.int_ops_per_second / 1e9);
+  return text;
+}
+
+roofline_point
+place_on_roofline(machine_peaks const& peaks,
+                  kernel_cost const& cost,
+                  double seconds_per_call)
+{
+  roofline_point p{};
+  p.intensity = cost.ops / cost.bytes;
+  double const peak =
+    cost.integer ? peaks.int_ops_per_second : peaks.flops_per_second;
+  double const slope = peaks.bandwidth_for(cost.working_set) * p.intensity;
+  p.memory_bound = slope < peak;
+  p.attainable = std::min(slope, peak);
+  p.achieved = cost.ops / seconds_per_call;
+  p.fraction = p.achieved / p.attainable;
+  p.bytes_per_second = cost.bytes / seconds_per_call;
+  return p;
+}
+
+std::string
+describe(machine_peaks const& peaks, std::span<costed_run const> runs)
+{
+  std::string text;
+  auto out = std::back_inserter(text);
+  for (auto const& r : runs) {
+    auto const p = place_on_roofline(peaks, r.cost, r.seconds_per_call);
+    fmt::format_to(out,
+                   "{}: {:.3f} op/B, {:.2f} GB/s, {:.2f} Gop/s, {} bound, "
+                   "{:.1f}% of roofline\n",
+                   r.name,
+                   p.intensity,
+                   p.bytes_per_second / 1e9,
+                   p.achieved / 1e9,
+                   p.memory_bound ? "memory" : "compute",
+                   100.0 * p.fraction);
+  }
+  return text;
+}
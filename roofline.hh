@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ranges>
+#include <span>
+#include <string>
+#include <vector>
+
+// A roofline model (Williams, Waterman and Patterson, CACM 2009) of one core,
+// to tell whether a kernel is limited by memory bandwidth or by arithmetic.
+//
+// measure_machine() probes the sustained read bandwidth for working sets
+// that fit in each cache level and in main memory (a STREAM-style sum), and
+// the peak rates of double-precision multiply-add and 32-bit integer add
+// (independent vector accumulator chains, MULTIVERSION so they use the
+// widest vectors of the running CPU). A kernel described by its bytes and
+// operations per call is then placed against the roof for its working set.
+
+struct bandwidth_point {
+  std::size_t working_set;  // bytes
+  double bytes_per_second;
+};
+
+struct machine_peaks {
+  // Sustained read bandwidth, by increasing working set.
+  std::vector<bandwidth_point> bandwidth;
+  // STREAM triad (a = b + s * c) bandwidth over the largest working set,
+  // counting the three streams.
+  double triad_bytes_per_second = 0.0;
+  double flops_per_second = 0.0;
+  double int_ops_per_second = 0.0;
+
+  // The bandwidth ceiling for a kernel with the given working set: that of
+  // the smallest probe at least as large, or of the largest probe.
+  double bandwidth_for(std::size_t working_set) const noexcept;
+};
+
+// Takes about half a second.
+machine_peaks measure_machine();
+
+// Print the measured peaks, one per line.
+std::string describe(machine_peaks const& peaks);
+
+struct kernel_cost {
+  double bytes = 0.0;  // bytes read or written per call
+  double ops = 0.0;    // arithmetic operations per call
+  bool integer = true; // ops are integer (else floating point)
+  std::size_t working_set = 0;
+};
+
+struct roofline_point {
+  double intensity;      // ops per byte
+  double attainable;     // ops per second the roof allows
+  double achieved;       // ops per second measured
+  double fraction;       // achieved / attainable
+  bool memory_bound;     // the roof is the bandwidth slope, not the peak
+  double bytes_per_second;
+};
+
+roofline_point place_on_roofline(machine_peaks const& peaks,
+                                 kernel_cost const& cost,
+                                 double seconds_per_call);
+
+// A benchmarked kernel, with its cost and median time per call.
+struct costed_run {
+  std::string name;
+  kernel_cost cost;
+  double seconds_per_call;
+};
+
+// Place each run on the roofline, one per line.
+std::string describe(machine_peaks const& peaks,
+                     std::span<costed_run const> runs);
+
+// The number of bytes in distinct cache lines holding the objects the
+// pointers address: the memory traffic of a pass over them, whatever the
+// container layout.
+template <std::ranges::input_range R>
+double
+cache_line_bytes(R&& addresses)
+{
+  std::vector<std::uintptr_t> lines;
+  for (auto const* p : addresses) {
+    lines.push_back(reinterpret_cast<std::uintptr_t>(p) / 64);
+  }
+  std::ranges::sort(lines);
+  auto const end = std::ranges::unique(lines).begin();
+  return 64.0 * static_cast<double>(end - lines.begin());
+}
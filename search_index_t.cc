@@ -0,0 +1,95 @@
+// Benchmark point lookups of ticks: eytzinger_index (single and batched)
+// against std::map::find, std::lower_bound on the sorted ticks and
+// std::unordered_map::find, for random and ordered query streams.
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "data_structures.hh"
+#include "eytzinger_index.hh"
+#include "fill_functions.hh"
+
+int
+main()
+{
+  ankerl::nanobench::Bench b;
+  b.title("tick search").performanceCounters(true).minEpochIterations(100);
+
+  std::size_t const n_queries = 10000;
+  std::array<std::size_t, 2> NM = {3000ULL, 10000ULL};
+  for (auto n : NM) {
+    soa_vector soa_v;
+    fill(soa_v, n);
+    std::map<int, int> sp_orig;
+    fill(sp_orig, n);
+    std::unordered_map<int, int> hashmap;
+    fill(hashmap, n);
+    eytzinger_index const index(soa_v.ticks);
+
+    // Query ticks span twice the range of the filled ticks, so about half of
+    // them are misses.
+    std::minstd_rand0 engine(456);
+    std::uniform_int_distribution<int> dist{0, static_cast<int>(2 * n) - 1};
+    std::vector<int> random_queries(n_queries);
+    for (auto& q : random_queries) {
+      q = dist(engine);
+    }
+    std::vector<int> ordered_queries(random_queries);
+    std::ranges::sort(ordered_queries);
+
+    for (auto const* queries : {&random_queries, &ordered_queries}) {
+      std::string const suffix = fmt::format(
+        "{}_{}", queries == &random_queries ? "random" : "ordered", n);
+      b.batch(queries->size());
+      int s = 0;
+
+      b.run("map_" + suffix, [&]() {
+        for (int q : *queries) {
+          auto it = sp_orig.find(q);
+          s += it == sp_orig.end() ? 0 : it->second;
+        }
+      });
+
+      b.run("hashmap_" + suffix, [&]() {
+        for (int q : *queries) {
+          auto it = hashmap.find(q);
+          s += it == hashmap.end() ? 0 : it->second;
+        }
+      });
+
+      b.run("lower_bound_" + suffix, [&]() {
+        for (int q : *queries) {
+          auto it = std::lower_bound(soa_v.ticks.begin(), soa_v.ticks.end(), q);
+          if (it != soa_v.ticks.end() && *it == q)
+            s += soa_v.nphots[it - soa_v.ticks.begin()];
+        }
+      });
+
+      b.run("eytzinger_" + suffix, [&]() {
+        for (int q : *queries) {
+          auto const pos = index.find(q);
+          if (pos != eytzinger_index::npos)
+            s += soa_v.nphots[pos];
+        }
+      });
+
+      std::vector<std::size_t> positions(queries->size());
+      b.run("eytzinger_batch_" + suffix, [&]() {
+        index.find_batch(*queries, positions);
+        for (auto pos : positions) {
+          if (pos != eytzinger_index::npos)
+            s += soa_v.nphots[pos];
+        }
+      });
+      ankerl::nanobench::doNotOptimizeAway(s);
+    }
+  }
+}
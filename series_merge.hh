@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "data_structures.hh"
+
+// merge_accumulate combines several sorted (tick, nphots) series of the same
+// channel, such as per-thread partial results or overlaid signal and
+// background, into one sorted series, summing the photons of equal ticks.
+//
+// It works on the flat layouts, whose measurements are in contiguous memory:
+// the vector-based SOA types and aos_vector. Each input must be sorted by
+// tick, without duplicates. The output is resized to the total size of the
+// inputs, written in one pass, and then shrunk to the merged size, so a
+// reused output container does not allocate.
+//
+// Two methods are used:
+//
+//   pairwise:   a balanced tree of two-way merges, through scratch buffers.
+//               The two-way merge is branchless: each step compares the two
+//               heads and advances either or both, so that it runs without
+//               mispredictions on interleaved ticks.
+//   tournament: a loser tree over all the inputs (Knuth, TAOCP vol. 3,
+//               5.4.1), which takes log2(k) branchless comparisons per
+//               measurement, on the path of the input that just advanced,
+//               and needs no scratch space.
+//
+// Pairwise touches every measurement log2(k) times, but each touch is cheap
+// and independent of the others, while each step of the tournament depends
+// on the one before. Pairwise was 2-3 times faster for every k up to 64 in
+// series_merge_t, even with inputs larger than the caches, but its scratch
+// space grows as (log2(k) - 1) times the total size, so the tournament is
+// used beyond that.
+
+template <typename S>
+concept flat_layout =
+  (soa_layout<S> && std::ranges::contiguous_range<decltype(S::ticks)> &&
+   std::ranges::contiguous_range<decltype(S::nphots)>) ||
+  (sequence_layout<S> && std::ranges::contiguous_range<S>);
+
+enum class merge_method { automatic, pairwise, tournament };
+
+template <flat_layout S>
+void merge_accumulate(std::span<S const* const> inputs,
+                      S& out,
+                      merge_method method = merge_method::automatic);
+
+////////////////////////////////////////////
+// Implementation
+
+namespace merge_detail {
+  // The largest number of inputs for which merge_method::automatic chooses
+  // the pairwise merge.
+  constexpr std::size_t pairwise_max_inputs = 64;
+
+  // The inputs and outputs, as seen by the merges: a SOA series is a pair of
+  // parallel arrays, an AOS series an array of records.
+  struct soa_series {
+    int const* ticks;
+    int const* nphots;
+    std::size_t size;
+
+    int
+    tick(std::size_t i) const noexcept
+    {
+      return ticks[i];
+    }
+    int
+    nphot(std::size_t i) const noexcept
+    {
+      return nphots[i];
+    }
+  };
+
+  struct aos_series {
+    record const* records;
+    std::size_t size;
+
+    int
+    tick(std::size_t i) const noexcept
+    {
+      return records[i].first;
+    }
+    int
+    nphot(std::size_t i) const noexcept
+    {
+      return records[i].second;
+    }
+  };
+
+  struct soa_output {
+    int* ticks;
+    int* nphots;
+
+    int
+    tick(std::size_t i) const noexcept
+    {
+      return ticks[i];
+    }
+    int
+    nphot(std::size_t i) const noexcept
+    {
+      return nphots[i];
+    }
+    void
+    set(std::size_t i, int tick, int nphot) const noexcept
+    {
+      ticks[i] = tick;
+      nphots[i] = nphot;
+    }
+  };
+
+  struct aos_output {
+    record* records;
+
+    int
+    tick(std::size_t i) const noexcept
+    {
+      return records[i].first;
+    }
+    int
+    nphot(std::size_t i) const noexcept
+    {
+      return records[i].second;
+    }
+    void
+    set(std::size_t i, int tick, int nphot) const noexcept
+    {
+      records[i] = {tick, nphot};
+    }
+  };
+
+  template <typename A, typename B, typename O>
+  std::size_t
+  merge_two(A a, B b, O out) noexcept
+  {
+    std::size_t i = 0, j = 0, o = 0;
+    while (i != a.size && j != b.size) {
+      // Both heads are loaded unconditionally and selected with masks; with
+      // conditional expressions the compiler brings the branches back.
+      int const ta = a.tick(i);
+      int const tb = b.tick(j);
+      bool const take_a = ta <= tb;
+      bool const take_b = tb <= ta;
+      out.set(o,
+              std::min(ta, tb),
+              (a.nphot(i) & -int{take_a}) + (b.nphot(j) & -int{take_b}));
+      i += take_a;
+      j += take_b;
+      ++o;
+    }
+    for (; i != a.size; ++i, ++o) {
+      out.set(o, a.tick(i), a.nphot(i));
+    }
+    for (; j != b.size; ++j, ++o) {
+      out.set(o, b.tick(j), b.nphot(j));
+    }
+    return o;
+  }
+
+  template <typename A, typename O>
+  std::size_t
+  copy_series(A a, O out) noexcept
+  {
+    for (std::size_t i = 0; i != a.size; ++i) {
+      out.set(i, a.tick(i), a.nphot(i));
+    }
+    return a.size;
+  }
+
+  // Scratch space for the intermediate levels of the pairwise merge, kept
+  // per thread so that repeated merges do not allocate.
+  struct scratch_buffers {
+    std::vector<int> ticks;
+    std::vector<int> nphots;
+  };
+
+  inline scratch_buffers&
+  scratch(std::size_t n)
+  {
+    thread_local scratch_buffers buffers;
+    if (buffers.ticks.size() < n) {
+      buffers.ticks.resize(n);
+      buffers.nphots.resize(n);
+    }
+    return buffers;
+  }
+
+  // Level l of the tree writes into its own region of the scratch buffers,
+  // so that a series carried up from an earlier level (when a level has an
+  // odd number of series) is never overwritten.
+  template <typename Series, typename O>
+  std::size_t
+  merge_pairwise(std::span<Series const> inputs, std::size_t total, O out)
+  {
+    if (inputs.size() == 1)
+      return copy_series(inputs[0], out);
+    if (inputs.size() == 2)
+      return merge_two(inputs[0], inputs[1], out);
+
+    std::size_t levels = 0;
+    for (std::size_t k = inputs.size(); k > 2; k = (k + 1) / 2) {
+      ++levels;
+    }
+    auto& buffers = scratch(levels * total);
+
+    // The first level reads the inputs, the later ones the scratch buffers.
+    std::vector<soa_series> current;
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < inputs.size(); i += 2) {
+      soa_output const dest{buffers.ticks.data() + offset,
+                            buffers.nphots.data() + offset};
+      std::size_t const n = i + 1 == inputs.size()
+                              ? copy_series(inputs[i], dest)
+                              : merge_two(inputs[i], inputs[i + 1], dest);
+      current.push_back({dest.ticks, dest.nphots, n});
+      offset += n;
+    }
+    for (std::size_t level = 1; current.size() > 2; ++level) {
+      std::vector<soa_series> next;
+      offset = level * total;
+      for (std::size_t i = 0; i < current.size(); i += 2) {
+        if (i + 1 == current.size()) {
+          next.push_back(current[i]);
+          continue;
+        }
+        soa_output const dest{buffers.ticks.data() + offset,
+                              buffers.nphots.data() + offset};
+        std::size_t const n = merge_two(current[i], current[i + 1], dest);
+        next.push_back({dest.ticks, dest.nphots, n});
+        offset += n;
+      }
+      current = std::move(next);
+    }
+    return merge_two(current[0], current[1], out);
+  }
+
+  // The loser tree has one leaf per input, numbered k to 2k - 1 like the
+  // nodes of a binary heap; internal node n (1 <= n < k) holds the entry
+  // that lost the match played there, and the winner is kept apart.
+  //
+  // An entry packs an input's head tick and the input's index into one
+  // 64-bit key, ordered by tick: the top bit marks an exhausted input, the
+  // next 32 the tick (with its sign bit flipped, so that unsigned order is
+  // tick order) and the low 31 the index. Each match is then a min and a
+  // max of two integers, without branches.
+  template <typename Series, typename O>
+  std::size_t
+  merge_tournament(std::span<Series const> inputs, O out)
+  {
+    std::size_t const k = inputs.size();
+    constexpr std::uint64_t exhausted = std::uint64_t{1} << 63;
+    constexpr std::uint64_t index_mask = (std::uint64_t{1} << 31) - 1;
+    auto const entry = [&](std::size_t i, std::size_t p) {
+      if (p == inputs[i].size)
+        return exhausted | i;
+      auto const biased =
+        static_cast<std::uint32_t>(inputs[i].tick(p)) ^ 0x80000000u;
+      return (std::uint64_t{biased} << 31) | i;
+    };
+
+    std::vector<std::size_t> position(k, 0);
+    std::vector<std::uint64_t> tree(2 * k);
+    for (std::size_t i = 0; i != k; ++i) {
+      tree[k + i] = entry(i, 0);
+    }
+    // Build bottom-up: tree[n] temporarily holds the winner below n, and is
+    // replaced by the loser once its parent has read the winner.
+    std::vector<std::uint64_t> winner(tree);
+    for (std::size_t n = k - 1; n >= 1; --n) {
+      winner[n] = std::min(winner[2 * n], winner[2 * n + 1]);
+      tree[n] = std::max(winner[2 * n], winner[2 * n + 1]);
+    }
+    std::uint64_t w = winner[1];
+
+    std::size_t o = 0;
+    while ((w & exhausted) == 0) {
+      std::size_t const i = w & index_mask;
+      int const tick = inputs[i].tick(position[i]);
+      int const nphot = inputs[i].nphot(position[i]);
+      // Add to the previous output if it has the same tick; written without
+      // a branch, since that happens unpredictably.
+      bool const same = o != 0 && out.tick(o - 1) == tick;
+      std::size_t const at = o - same;
+      out.set(at, tick, (out.nphot(at) & -int{same}) + nphot);
+      o += !same;
+
+      // The masks keep the compiler from turning the matches back into
+      // conditional stores.
+      w = entry(i, ++position[i]);
+      for (std::size_t n = (k + i) / 2; n >= 1; n /= 2) {
+        std::uint64_t const l = tree[n];
+        std::uint64_t const swap = -std::uint64_t{l < w};
+        std::uint64_t const diff = (l ^ w) & swap;
+        tree[n] = l ^ diff;
+        w ^= diff;
+      }
+    }
+    return o;
+  }
+
+  template <typename Series, typename O>
+  std::size_t
+  merge_series(std::span<Series const> inputs,
+               std::size_t total,
+               O out,
+               merge_method method)
+  {
+    if (inputs.empty())
+      return 0;
+    if (method == merge_method::automatic)
+      method = inputs.size() <= pairwise_max_inputs ? merge_method::pairwise
+                                                    : merge_method::tournament;
+    if (method == merge_method::pairwise || inputs.size() == 1)
+      return merge_pairwise(inputs, total, out);
+    return merge_tournament(inputs, out);
+  }
+}
+
+template <flat_layout S>
+void
+merge_accumulate(std::span<S const* const> inputs, S& out, merge_method method)
+{
+  using namespace merge_detail;
+  std::size_t total = 0;
+  if constexpr (soa_layout<S>) {
+    std::vector<soa_series> in;
+    in.reserve(inputs.size());
+    for (S const* s : inputs) {
+      in.push_back({s->ticks.data(), s->nphots.data(), s->nphots.size()});
+      total += s->nphots.size();
+    }
+    out.ticks.resize(total);
+    out.nphots.resize(total);
+    std::size_t const n =
+      merge_series(std::span<soa_series const>(in),
+                   total,
+                   soa_output{out.ticks.data(), out.nphots.data()},
+                   method);
+    out.ticks.resize(n);
+    out.nphots.resize(n);
+  } else {
+    std::vector<aos_series> in;
+    in.reserve(inputs.size());
+    for (S const* s : inputs) {
+      in.push_back({std::ranges::data(*s), std::ranges::size(*s)});
+      total += std::ranges::size(*s);
+    }
+    out.resize(total);
+    std::size_t const n = merge_series(std::span<aos_series const>(in),
+                                       total,
+                                       aos_output{std::ranges::data(out)},
+                                       method);
+    out.resize(n);
+  }
+}
@@ -0,0 +1,128 @@
+// Benchmark merge_accumulate, for k = 2 to 64 series of the same channel,
+// against accumulating them one measurement at a time into a std::map. Both
+// merge methods are run for every k, to compare them (see series_merge.hh for
+// the automatic choice). Also checks that every method gives the map's
+// result.
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "data_structures.hh"
+#include "series_merge.hh"
+
+// n sorted ticks, each present with probability 'density', and their photon
+// counts; series made with different seeds overlap on about 'density' of
+// their ticks.
+soa_vector
+make_series(std::size_t n, double density, unsigned long long seed)
+{
+  std::minstd_rand0 engine(seed);
+  std::bernoulli_distribution keep{density};
+  std::uniform_int_distribution<int> dist{0, 10000};
+  soa_vector result;
+  int tick = 0;
+  while (result.ticks.size() != n) {
+    if (keep(engine)) {
+      result.ticks.push_back(tick);
+      result.nphots.push_back(dist(engine));
+    }
+    ++tick;
+  }
+  return result;
+}
+
+aos_vector
+to_aos(soa_vector const& s)
+{
+  aos_vector result;
+  for (std::size_t i = 0; i != s.ticks.size(); ++i) {
+    result.push_back({s.ticks[i], s.nphots[i]});
+  }
+  return result;
+}
+
+void
+accumulate_map(std::span<soa_vector const> inputs, std::map<int, int>& m)
+{
+  m.clear();
+  for (auto const& s : inputs) {
+    for (std::size_t i = 0; i != s.ticks.size(); ++i) {
+      m[s.ticks[i]] += s.nphots[i];
+    }
+  }
+}
+
+template <typename S>
+bool
+same_as_map(S const& s, std::map<int, int> const& m)
+{
+  std::vector<std::pair<int, int>> merged;
+  if constexpr (soa_layout<S>) {
+    for (std::size_t i = 0; i != s.ticks.size(); ++i) {
+      merged.emplace_back(s.ticks[i], s.nphots[i]);
+    }
+  } else {
+    for (auto const& r : s) {
+      merged.emplace_back(r.first, r.second);
+    }
+  }
+  return merged == std::vector<std::pair<int, int>>(m.begin(), m.end());
+}
+
+template <typename S>
+void
+run_merges(ankerl::nanobench::Bench* bench,
+           std::vector<S> const& inputs,
+           std::map<int, int> const& expected,
+           std::string const& suffix)
+{
+  std::vector<S const*> pointers;
+  for (auto const& s : inputs) {
+    pointers.push_back(&s);
+  }
+  std::span<S const* const> const in(pointers);
+  S out;
+  for (auto method : {merge_method::pairwise, merge_method::tournament}) {
+    std::string const name =
+      method == merge_method::pairwise ? "pairwise" : "tournament";
+    merge_accumulate(in, out, method);
+    std::cout << name << '_' << suffix
+              << " matches map: " << same_as_map(out, expected) << '\n';
+    bench->run(fmt::format("{}_{}", name, suffix),
+               [&]() { merge_accumulate(in, out, method); });
+  }
+}
+
+int
+main()
+{
+  // A busy channel in one deposit batch.
+  std::size_t const n = 2000;
+  double const density = 0.25;
+
+  ankerl::nanobench::Bench b;
+  b.title("k-way merge").unit("measurement").minEpochIterations(20);
+  for (std::size_t k : {2, 3, 4, 8, 16, 32, 64}) {
+    std::vector<soa_vector> soa_inputs;
+    std::vector<aos_vector> aos_inputs;
+    for (std::size_t i = 0; i != k; ++i) {
+      soa_inputs.push_back(make_series(n, density, 123 + i));
+      aos_inputs.push_back(to_aos(soa_inputs.back()));
+    }
+    std::map<int, int> m;
+    accumulate_map(soa_inputs, m);
+
+    b.batch(k * n);
+    b.run(fmt::format("map_k{}", k), [&]() { accumulate_map(soa_inputs, m); });
+    ankerl::nanobench::doNotOptimizeAway(m.size());
+    run_merges(&b, soa_inputs, m, fmt::format("soav_k{}", k));
+    run_merges(&b, aos_inputs, m, fmt::format("aosv_k{}", k));
+  }
+}
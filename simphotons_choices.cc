@@ -1,18 +1,53 @@
 // Test program to benchmark different choices for SimPhotons implementation.
 //
+// Every selected type in registered_layouts (see layout_registry.hh) is
+// filled and benchmarked for each selected size and operation.
+//
+// Usage: simphotons_choices [options]
+//   -s names   structures, comma-separated registry names (default: all)
+//   -o names   operations: sum, scan, find (default: all)
+//   -n sizes   comma-separated measurement counts (default: 10000 ... 10)
+//   -r trials  repeat every benchmark this many times, interleaved, and
+//              report the median and spread across trials (default: 1)
+//   -e epochs  nanobench epochs per trial (default: nanobench's)
+//   -m iters   minimum iterations per epoch (default: 1e9 / size, capped)
+//   -w iters   nanobench warmup iterations before each trial (default: 0)
+//   -c cpu     pin the benchmark to this CPU
+//   -q         print only the summary, not the nanobench tables
+//   -R         roofline report: measure the machine's bandwidth and peak
+//              operation rates (see roofline.hh), and place sum and scan
+//              against them; find is latency-bound and not reported
+//   -b file    compare ns/op, instructions/op and branch misses/op with a
+//              stored nanobench table, such as gcc-12-skylake.txt (see
+//              baseline.hh), and exit with status 2 on a regression, or 1
+//              if no benchmark of the run is in the table
+//   -t percent the smallest change in time the comparison flags
+//              (default: 5)
 #include <algorithm>
 #include <array>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <exception>
 #include <map>
-#include <unordered_map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include "fmt/core.h"
 #include "nanobench.h"
 
+#include "baseline.hh"
+#include "cpu_dispatch.hh"
 #include "data_structures.hh"
 #include "fill_functions.hh"
+#include "layout_registry.hh"
 #include "operations.hh"
+#include "parallel.hh"
+#include "roofline.hh"
 
 template <typename S>
 void
@@ -33,117 +68,409 @@ run_scan(ankerl::nanobench::Bench* bench,
          std::size_t n,
          std::string const& name)
 {
+  result_t r;
+  bench->run(name, [&]() { r = find_largest(m); });
+  ankerl::nanobench::doNotOptimizeAway(r);
+}
+
+template <typename S>
+void
+run_lookup(ankerl::nanobench::Bench* bench,
+           S const& m,
+           std::size_t n,
+           std::string const& name)
+{
+  // Look up a tick in the middle of the channel.
+  int const tick = static_cast<int>(n / 2);
   int s = 0;
-  bench->run(name, [&]() { auto [idx, val] = find_largest(m); });
+  bench->run(name, [&]() { s = lookup(m, tick); });
   ankerl::nanobench::doNotOptimizeAway(s);
 }
 
-int
-main()
+// Run the named operation (sum, scan or find) on m.
+template <typename S>
+void
+run_operation(ankerl::nanobench::Bench* bench,
+              std::string const& operation,
+              S const& m,
+              std::size_t n,
+              std::string const& name)
 {
-  ankerl::nanobench::Bench b;
-  b.title("simphotons choices").performanceCounters(true);
-
-  std::array<std::size_t, 7> NM = {
-    10ULL, 30ULL, 100ULL, 300ULL, 1000ULL, 3000ULL, 10000ULL};
-  std::ranges::reverse(NM);
-  unsigned long long ITERATIONS_NUMER = 1000 * 1000 * 1000;
-
-  std::map<int, int> sp_orig;
-  std::unordered_map<int, int> hashmap;
-
-  aos_vector aos_v;
-  aos_deq aos_d;
-  aos_slist aos_l;
-
-  soa_vector soa_v;
-  soa_deq soa_d;
-  soa_slist soa_l;
-
-  for (auto n : NM) {
-    std::string suffix = std::to_string(n);
+  if (operation == "sum")
+    run_sum(bench, m, n, name);
+  else if (operation == "scan")
+    run_scan(bench, m, n, name);
+  else
+    run_lookup(bench, m, n, name);
+}
 
-    // Node-based types
-    sp_orig = std::map<int, int>();
-    hashmap = std::unordered_map<int, int>();
+struct driver_options {
+  std::vector<std::string> structures;
+  std::vector<std::string> operations = {"sum", "scan", "find"};
+  std::vector<std::size_t> sizes = {10000, 3000, 1000, 300, 100, 30, 10};
+  int trials = 1;
+  std::size_t epochs = 0;
+  std::size_t min_epoch_iterations = 0;
+  std::size_t warmup = 0;
+  int cpu = -1;
+  bool quiet = false;
+  bool roofline = false;
+  std::string baseline;
+  double threshold = 5.0;
+};
 
-    // Record-oriented types
-    aos_v = aos_vector();
-    aos_d = aos_deq();
-    aos_l = aos_slist();
+// The memory traffic and operations of one call of 'operation' on m, for
+// the roofline report. The traffic is that of the cache lines holding the
+// photon counts (and, for flat_int_map's scan, the keys it checks), so node
+// layouts are charged for the lines their scattered nodes occupy.
+template <typename S>
+std::optional<kernel_cost>
+operation_cost(S const& m, std::string const& operation)
+{
+  if (operation == "find")
+    return std::nullopt;
+  std::vector<int const*> addresses;
+  if constexpr (is_summarized_channel<S>) {
+    // A cached summary answers sum and scan without touching the channel.
+    return std::nullopt;
+  } else if constexpr (soa_layout<S>) {
+    for (auto const& x : m.nphots) {
+      addresses.push_back(&x);
+    }
+  } else if constexpr (record_layout<S>) {
+    for (auto const& r : m) {
+      addresses.push_back(&r.second);
+    }
+  } else if constexpr (std::is_same_v<S, hybrid_channel>) {
+    for (auto const& x : m.nphots()) {
+      addresses.push_back(&x);
+    }
+  } else {
+    for (auto const& x : m.values()) {
+      addresses.push_back(&x);
+    }
+    if (operation == "scan") {
+      for (auto const& x : m.keys()) {
+        addresses.push_back(&x);
+      }
+    }
+  }
+  kernel_cost cost;
+  cost.bytes = cache_line_bytes(addresses);
+  cost.working_set = static_cast<std::size_t>(cost.bytes);
+  // sum: one add per element (or slot); scan: a compare and a select.
+  std::size_t elements = addresses.size();
+  if constexpr (std::is_same_v<S, flat_int_map>)
+    elements = m.values().size();
+  cost.ops = (operation == "sum" ? 1.0 : 2.0) * elements;
+  return cost;
+}
 
-    // Array-oriented types
-    soa_v = soa_vector();
-    soa_d = soa_deq();
-    soa_l = soa_slist();
+// Per-trial ns/op of each benchmark, in the order first run.
+struct trial_results {
+  std::vector<std::string> order;
+  std::map<std::string, std::vector<double>> ns_per_op;
+  std::map<std::string, kernel_cost> costs;
+  // Every run, for the comparison with a baseline.
+  std::vector<benchmark_entry> entries;
 
-    fill(sp_orig, n);
-    fill(hashmap, n);
+  void
+  add(std::string const& name, ankerl::nanobench::Result const& r)
+  {
+    auto& v = ns_per_op[name];
+    if (v.empty())
+      order.push_back(name);
+    entries.push_back(entry_of(r));
+    entries.back().name = name;
+    v.push_back(entries.back().ns_per_op);
+  }
+};
 
-    fill(aos_v, n);
-    fill(aos_d, n);
-    fill(aos_l, n);
+// Fill a fresh instance of every selected type with n measurements, and run
+// the operation on it.
+void
+run_all_layouts(ankerl::nanobench::Bench* bench,
+                driver_options const& options,
+                std::size_t n,
+                std::string const& operation,
+                trial_results& results)
+{
+  for_each_layout([&](auto const& reg) {
+    using S = typename std::remove_cvref_t<decltype(reg)>::type;
+    if (!options.structures.empty() &&
+        std::ranges::find(options.structures, reg.name) ==
+          options.structures.end())
+      return;
+    S m;
+    fill(m, n);
+    auto const name = fmt::format("{}_{}_{}", operation, reg.name, n);
+    run_operation(bench, operation, m, n, name);
+    results.add(name, bench->results().back());
+    if (options.roofline && !results.costs.contains(name)) {
+      if (auto const cost = operation_cost(m, operation))
+        results.costs[name] = *cost;
+    }
+  });
+}
 
-    fill(soa_v, n);
-    fill(soa_d, n);
-    fill(soa_l, n);
+std::vector<std::string>
+split_list(std::string_view list)
+{
+  std::vector<std::string> result;
+  while (!list.empty()) {
+    auto const comma = list.find(',');
+    result.emplace_back(list.substr(0, comma));
+    if (comma == std::string_view::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+  return result;
+}
 
-    unsigned long long n_iterations =
-      std::min(ITERATIONS_NUMER / n, 20 * 1000 * 1000ULL);
-    b.minEpochIterations(n_iterations);
-    run_sum(&b, sp_orig, n, fmt::format("sum_map_{}", suffix));
-    run_sum(&b, hashmap, n, fmt::format("sum_hashmap_{}", suffix));
+void
+usage(char const* argv0)
+{
+  std::cerr << "Usage: " << argv0
+            << " [-s structures] [-o operations] [-n sizes] [-r trials]"
+               " [-e epochs] [-m iterations] [-w iterations] [-c cpu] [-q]"
+               " [-R] [-b baseline] [-t percent]\n";
+}
 
-    run_sum(&b, aos_v, n, fmt::format("sum_aosv_{}", suffix));
-    run_sum(&b, aos_d, n, fmt::format("sum_aosd_{}", suffix));
-    run_sum(&b, aos_l, n, fmt::format("sum_aosl_{}", suffix));
+// Parse the command line; print a message and return false on errors.
+bool
+parse_options(int argc, char** argv, driver_options& options)
+{
+  std::vector<std::string> known;
+  for_each_layout([&](auto const& reg) { known.emplace_back(reg.name); });
 
-    run_sum(&b, soa_v, n, fmt::format("sum_soav_{}", suffix));
-    run_sum(&b, soa_v, n, fmt::format("sum_soad_{}", suffix));
-    run_sum(&b, soa_v, n, fmt::format("sum_soal_{}", suffix));
+  auto number = [](char const* text, auto& value) {
+    auto const end = text + std::strlen(text);
+    auto const [p, ec] = std::from_chars(text, end, value);
+    return ec == std::errc() && p == end;
+  };
+  for (int i = 1; i < argc; ++i) {
+    std::string_view const flag = argv[i];
+    if (flag == "-q") {
+      options.quiet = true;
+      continue;
+    }
+    if (flag == "-R") {
+      options.roofline = true;
+      continue;
+    }
+    if (i + 1 == argc || flag.size() != 2 || flag[0] != '-') {
+      usage(argv[0]);
+      return false;
+    }
+    char const* const value = argv[++i];
+    bool ok = true;
+    switch (flag[1]) {
+      case 's':
+        options.structures = split_list(value);
+        for (auto const& s : options.structures) {
+          if (std::ranges::find(known, s) == known.end()) {
+            std::cerr << "unknown structure " << s << "; known:";
+            for (auto const& k : known) {
+              std::cerr << ' ' << k;
+            }
+            std::cerr << '\n';
+            return false;
+          }
+        }
+        break;
+      case 'o':
+        options.operations = split_list(value);
+        for (auto const& o : options.operations) {
+          if (o != "sum" && o != "scan" && o != "find") {
+            std::cerr << "unknown operation " << o << "\n";
+            return false;
+          }
+        }
+        break;
+      case 'n':
+        options.sizes.clear();
+        for (auto const& n : split_list(value)) {
+          std::size_t size = 0;
+          ok = ok && number(n.c_str(), size) && size != 0;
+          options.sizes.push_back(size);
+        }
+        break;
+      case 'r':
+        ok = number(value, options.trials) && options.trials > 0;
+        break;
+      case 'e':
+        ok = number(value, options.epochs);
+        break;
+      case 'm':
+        ok = number(value, options.min_epoch_iterations);
+        break;
+      case 'w':
+        ok = number(value, options.warmup);
+        break;
+      case 'c':
+        ok = number(value, options.cpu);
+        break;
+      case 'b':
+        options.baseline = value;
+        break;
+      case 't':
+        ok = number(value, options.threshold) && options.threshold >= 0.0;
+        break;
+      default:
+        ok = false;
+    }
+    if (!ok) {
+      usage(argv[0]);
+      return false;
+    }
   }
+  return true;
+}
 
-  for (auto n : NM) {
-    std::string suffix = std::to_string(n);
-
-    // Node-based types
-    sp_orig = std::map<int, int>();
-    hashmap = std::unordered_map<int, int>();
+double
+median_of(std::vector<double>& v)
+{
+  std::ranges::sort(v);
+  return v.size() % 2 == 1 ? v[v.size() / 2] :
+                             (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+}
 
-    // Record-oriented types
-    aos_v = aos_vector();
-    aos_d = aos_deq();
-    aos_l = aos_slist();
+// Median, extremes and relative spread ((max - min) / median) of each
+// benchmark across the trials.
+void
+print_summary(trial_results& results)
+{
+  fmt::print("\n| {:>12} | {:>12} | {:>12} | {:>8} | {}\n",
+             "median ns/op",
+             "min ns/op",
+             "max ns/op",
+             "spread%",
+             "benchmark");
+  fmt::print("|-------------:|-------------:|-------------:|---------:|:---\n");
+  for (auto const& name : results.order) {
+    auto& v = results.ns_per_op[name];
+    double const median = median_of(v);
+    fmt::print("| {:>12.3f} | {:>12.3f} | {:>12.3f} | {:>8.2f} | `{}`\n",
+               median,
+               v.front(),
+               v.back(),
+               100.0 * (v.back() - v.front()) / median,
+               name);
+  }
+}
 
-    // Array-oriented types
-    soa_v = soa_vector();
-    soa_d = soa_deq();
-    soa_l = soa_slist();
+// Place each benchmark with a cost on the roofline, using its median time.
+void
+print_roofline(trial_results& results, machine_peaks const& peaks)
+{
+  fmt::print("\n| {:>10} | {:>9} | {:>7} | {:>8} | {:>8} | {:>6} | {:>6} "
+             "| {}\n",
+             "ns/op",
+             "bytes/op",
+             "ops/B",
+             "GB/s",
+             "Gop/s",
+             "bound",
+             "%roof",
+             "benchmark");
+  fmt::print("|-----------:|----------:|--------:|---------:|---------:|"
+             "-------:|-------:|:---\n");
+  for (auto const& name : results.order) {
+    auto const it = results.costs.find(name);
+    if (it == results.costs.end())
+      continue;
+    auto const& cost = it->second;
+    double const seconds = median_of(results.ns_per_op[name]) * 1e-9;
+    auto const p = place_on_roofline(peaks, cost, seconds);
+    fmt::print(
+      "| {:>10.2f} | {:>9.0f} | {:>7.3f} | {:>8.2f} | {:>8.2f} | {:>6} | "
+      "{:>6.1f} | `{}`\n",
+      seconds * 1e9,
+      cost.bytes,
+      p.intensity,
+      p.bytes_per_second / 1e9,
+      p.achieved / 1e9,
+      p.memory_bound ? "memory" : "ops",
+      100.0 * p.fraction,
+      name);
+  }
+}
 
-    fill(sp_orig, n);
-    fill(hashmap, n);
+int
+main(int argc, char** argv)
+{
+  driver_options options;
+  if (!parse_options(argc, argv, options))
+    return 1;
 
-    fill(aos_v, n);
-    fill(aos_d, n);
-    fill(aos_l, n);
+  // Read the baseline first, so that a bad file does not waste a run.
+  std::vector<benchmark_entry> baseline;
+  if (!options.baseline.empty()) {
+    try {
+      baseline = read_benchmark_table(options.baseline);
+    }
+    catch (std::exception const& e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    }
+  }
 
-    fill(soa_v, n);
-    fill(soa_d, n);
-    fill(soa_l, n);
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  if (options.cpu >= 0) {
+    if (pin_to_cpu(static_cast<unsigned>(options.cpu)))
+      std::cout << "pinned to cpu " << options.cpu << '\n';
+    else
+      std::cout << "could not pin to cpu " << options.cpu << '\n';
+  }
 
-    unsigned long long n_iterations =
-      std::min(ITERATIONS_NUMER / n, 20 * 1000 * 1000ULL);
-    b.minEpochIterations(n_iterations);
+  machine_peaks peaks;
+  if (options.roofline) {
+    peaks = measure_machine();
+    std::cout << describe(peaks);
+  }
 
-    run_scan(&b, sp_orig, n, fmt::format("scan_map_{}", suffix));
-    run_scan(&b, hashmap, n, fmt::format("scan_hashmap_{}", suffix));
+  ankerl::nanobench::Bench b;
+  b.title("simphotons choices").performanceCounters(true);
+  if (options.quiet)
+    b.output(nullptr);
+  if (options.epochs != 0)
+    b.epochs(options.epochs);
+  if (options.warmup != 0)
+    b.warmup(options.warmup);
 
-    run_scan(&b, aos_v, n, fmt::format("scan_aosv_{}", suffix));
-    run_scan(&b, aos_d, n, fmt::format("scan_aosd_{}", suffix));
-    run_scan(&b, aos_l, n, fmt::format("scan_aosl_{}", suffix));
+  unsigned long long ITERATIONS_NUMER = 1000 * 1000 * 1000;
 
-    run_scan(&b, soa_v, n, fmt::format("scan_soav_{}", suffix));
-    run_scan(&b, soa_v, n, fmt::format("scan_soad_{}", suffix));
-    run_scan(&b, soa_v, n, fmt::format("scan_soal_{}", suffix));
+  // Each trial runs every benchmark once, so slow drifts (such as thermal
+  // throttling) spread over all benchmarks instead of biasing the last ones.
+  trial_results results;
+  for (int trial = 0; trial != options.trials; ++trial) {
+    for (auto const& operation : options.operations) {
+      for (auto n : options.sizes) {
+        unsigned long long n_iterations =
+          options.min_epoch_iterations != 0 ?
+            options.min_epoch_iterations :
+            std::min(ITERATIONS_NUMER / n, 20 * 1000 * 1000ULL);
+        b.minEpochIterations(n_iterations);
+        run_all_layouts(&b, options, n, operation, results);
+      }
+    }
+  }
+  if (options.trials > 1 || options.quiet)
+    print_summary(results);
+  if (options.roofline)
+    print_roofline(results, peaks);
+  if (!options.baseline.empty()) {
+    auto const comparisons = compare(baseline,
+                                     combine_repeats(results.entries),
+                                     {.threshold = options.threshold / 100.0});
+    if (comparisons.empty()) {
+      std::cerr << "no benchmark of this run is in " << options.baseline
+                << '\n';
+      return 1;
+    }
+    fmt::print("\ncompared with {}:\n{}", options.baseline,
+               describe(comparisons));
+    if (count_regressions(comparisons) != 0)
+      return 2;
   }
 }
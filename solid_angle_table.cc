@@ -0,0 +1,237 @@
+#include "solid_angle_table.hh"
+#include "cpu_dispatch.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace {
+  constexpr std::size_t tile = 4;
+
+  double
+  omega_of(double alpha, double beta) noexcept
+  {
+    return 4.0 * std::atan(alpha * beta /
+                           std::sqrt(1.0 + alpha * alpha + beta * beta));
+  }
+
+  // False for NaN, from a = d = 0, and for the negative coordinates of
+  // d < 0; such points are evaluated exactly, like those beyond the table.
+  bool
+  in_table(double alpha, double beta, double max_alpha, double max_beta)
+  {
+    return (alpha >= 0.0) & (alpha <= max_alpha) & (beta >= 0.0) &
+           (beta <= max_beta);
+  }
+
+  // Clamp a coordinate to [0, max], with NaN to 0.
+  double
+  clamp_coordinate(double x, double max)
+  {
+    return std::min(!(x >= 0.0) ? 0.0 : x, max);
+  }
+}
+
+double
+solid_angle(double a, double b, double d) noexcept
+{
+  return omega_of(std::abs(a) / (2.0 * d), std::abs(b) / (2.0 * d));
+}
+
+solid_angle_table::solid_angle_table(double max_alpha,
+                                     double max_beta,
+                                     std::size_t cells_alpha,
+                                     std::size_t cells_beta)
+  : max_alpha_(max_alpha)
+  , max_beta_(max_beta)
+  , cells_alpha_(cells_alpha)
+  , cells_beta_(cells_beta)
+  , scale_alpha_(cells_alpha / max_alpha)
+  , scale_beta_(cells_beta / max_beta)
+  , tiles_alpha_((cells_alpha + tile - 1) / tile)
+{
+  if (!(max_alpha > 0.0 && max_beta > 0.0) || cells_alpha == 0 ||
+      cells_beta == 0)
+    throw std::invalid_argument("solid_angle_table: empty range");
+
+  // omega at the grid nodes.
+  std::size_t const na = cells_alpha + 1;
+  std::size_t const nb = cells_beta + 1;
+  std::vector<double> f(na * nb);
+  for (std::size_t j = 0; j != nb; ++j) {
+    for (std::size_t i = 0; i != na; ++i) {
+      f[j * na + i] = omega_of(i / scale_alpha_, j / scale_beta_);
+    }
+  }
+
+  std::size_t const tiles_beta = (cells_beta + tile - 1) / tile;
+  cells_.resize(tiles_alpha_ * tiles_beta * tile * tile);
+  for (std::size_t j = 0; j != cells_beta; ++j) {
+    for (std::size_t i = 0; i != cells_alpha; ++i) {
+      double const f00 = f[j * na + i];
+      double const f10 = f[j * na + i + 1];
+      double const f01 = f[(j + 1) * na + i];
+      double const f11 = f[(j + 1) * na + i + 1];
+      cells_[cell_index(i, j)] = {static_cast<float>(f00),
+                                  static_cast<float>(f10 - f00),
+                                  static_cast<float>(f01 - f00),
+                                  static_cast<float>(f11 - f10 - f01 + f00)};
+    }
+  }
+
+  // Second differences, in grid units, are h^2 times the second derivatives.
+  double d2_alpha = 0.0;
+  double d2_beta = 0.0;
+  double largest = 0.0;
+  for (std::size_t j = 0; j != nb; ++j) {
+    for (std::size_t i = 0; i != na; ++i) {
+      double const fij = f[j * na + i];
+      largest = std::max(largest, std::abs(fij));
+      if (i != 0 && i + 1 != na)
+        d2_alpha = std::max(
+          d2_alpha, std::abs(f[j * na + i - 1] - 2 * fij + f[j * na + i + 1]));
+      if (j != 0 && j + 1 != nb)
+        d2_beta = std::max(
+          d2_beta,
+          std::abs(f[(j - 1) * na + i] - 2 * fij + f[(j + 1) * na + i]));
+    }
+  }
+  // Four float coefficients, each rounded to within half an ulp.
+  double const rounding =
+    4 * largest * std::numeric_limits<float>::epsilon();
+  error_bound_ = (d2_alpha + d2_beta) / 8 + rounding;
+}
+
+std::size_t
+solid_angle_table::cell_index(std::size_t i, std::size_t j) const noexcept
+{
+  return ((j / tile) * tiles_alpha_ + i / tile) * (tile * tile) +
+         (j % tile) * tile + i % tile;
+}
+
+// (x, y) are grid coordinates, inside the table.
+inline double
+solid_angle_table::interpolate(double x, double y) const noexcept
+{
+  std::size_t const i = std::min(static_cast<std::size_t>(x), cells_alpha_ - 1);
+  std::size_t const j = std::min(static_cast<std::size_t>(y), cells_beta_ - 1);
+  double const u = x - i;
+  double const v = y - j;
+  cell const& c = cells_[cell_index(i, j)];
+  return c.c0 + c.c1 * u + v * (c.c2 + c.c3 * u);
+}
+
+double
+solid_angle_table::operator()(double a, double b, double d) const noexcept
+{
+  double const alpha = std::abs(a) / (2.0 * d);
+  double const beta = std::abs(b) / (2.0 * d);
+  if (!in_table(alpha, beta, max_alpha_, max_beta_))
+    return omega_of(alpha, beta);
+  return interpolate(alpha * scale_alpha_, beta * scale_beta_);
+}
+
+// Points outside the table are clamped to it in the vectorized loop, and
+// redone exactly afterwards, so the loop has no branch. The members are
+// copied to locals, since the compiler cannot tell that the stores to
+// 'omega' do not change them, the indices are 32-bit, which every ISA level
+// can convert to and gather with, and the points outside are counted rather
+// than or-ed into a bool, which GCC does not vectorize.
+MULTIVERSION void
+solid_angle_table::lookup(std::span<double const> a,
+                          std::span<double const> b,
+                          std::span<double const> d,
+                          std::span<double> omega) const noexcept
+{
+  std::size_t const n = omega.size();
+  double const max_alpha = max_alpha_;
+  double const max_beta = max_beta_;
+  double const scale_alpha = scale_alpha_;
+  double const scale_beta = scale_beta_;
+  int const last_i = static_cast<int>(cells_alpha_) - 1;
+  int const last_j = static_cast<int>(cells_beta_) - 1;
+  int const tiles_alpha = static_cast<int>(tiles_alpha_);
+  float const* coefficients = &cells_.data()->c0;
+  double const* pa = a.data();
+  double const* pb = b.data();
+  double const* pd = d.data();
+  double* out = omega.data();
+  std::size_t outside = 0;
+  for (std::size_t k = 0; k != n; ++k) {
+    double const half_inverse = 0.5 / pd[k];
+    double const alpha = std::abs(pa[k]) * half_inverse;
+    double const beta = std::abs(pb[k]) * half_inverse;
+    outside += !in_table(alpha, beta, max_alpha, max_beta);
+    double const x = clamp_coordinate(alpha, max_alpha) * scale_alpha;
+    double const y = clamp_coordinate(beta, max_beta) * scale_beta;
+    int const i = std::min(static_cast<int>(x), last_i);
+    int const j = std::min(static_cast<int>(y), last_j);
+    double const u = x - i;
+    double const v = y - j;
+    int const c = (((j >> 2) * tiles_alpha + (i >> 2)) * 16 + (j & 3) * 4 +
+                   (i & 3)) *
+                  4;
+    out[k] = coefficients[c] + coefficients[c + 1] * u +
+             v * (coefficients[c + 2] + coefficients[c + 3] * u);
+  }
+  if (outside == 0)
+    return;
+  for (std::size_t k = 0; k != n; ++k) {
+    double const alpha = std::abs(pa[k]) / (2.0 * pd[k]);
+    double const beta = std::abs(pb[k]) / (2.0 * pd[k]);
+    if (!in_table(alpha, beta, max_alpha, max_beta))
+      out[k] = omega_of(alpha, beta);
+  }
+}
+
+double
+solid_angle_table::error_bound() const noexcept
+{
+  return error_bound_;
+}
+
+std::size_t
+solid_angle_table::bytes() const noexcept
+{
+  return cells_.size() * sizeof(cell);
+}
+
+double
+solid_angle_table::max_alpha() const noexcept
+{
+  return max_alpha_;
+}
+
+double
+solid_angle_table::max_beta() const noexcept
+{
+  return max_beta_;
+}
+
+table_error
+measure_error(solid_angle_table const& table,
+              std::size_t samples,
+              unsigned long long seed)
+{
+  std::mt19937_64 engine(seed);
+  std::uniform_real_distribution<double> alpha_dist{0.0, table.max_alpha()};
+  std::uniform_real_distribution<double> beta_dist{0.0, table.max_beta()};
+  table_error result;
+  double sum2 = 0.0;
+  for (std::size_t k = 0; k != samples; ++k) {
+    // With d = 0.5, a and b are alpha and beta.
+    double const alpha = alpha_dist(engine);
+    double const beta = beta_dist(engine);
+    double const exact = omega_of(alpha, beta);
+    double const error = std::abs(table(alpha, beta, 0.5) - exact);
+    result.max_abs = std::max(result.max_abs, error);
+    sum2 += error * error;
+    if (exact >= 1e-3)
+      result.max_rel = std::max(result.max_rel, error / exact);
+  }
+  result.rms = samples == 0 ? 0.0 : std::sqrt(sum2 / samples);
+  result.bound = table.error_bound();
+  return result;
+}
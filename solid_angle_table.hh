@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// The solid angle subtended by an a x b rectangular aperture, seen from a
+// point at distance d on the normal through its centre:
+//
+//   omega = 4 atan(alpha beta / sqrt(1 + alpha^2 + beta^2)),
+//
+// with alpha = a / 2d and beta = b / 2d (the omega_1 and omega_2 of omega_t
+// are approximations of it). It depends on |alpha| and |beta| only.
+double solid_angle(double a, double b, double d) noexcept;
+
+// solid_angle_table tabulates omega over 0 <= |alpha| <= max_alpha,
+// 0 <= |beta| <= max_beta, once, so that each evaluation is a division, a
+// table load and a bilinear interpolation instead of a square root and an
+// arctangent. Points outside the table are evaluated exactly, and so are
+// those with d <= 0, whose alpha and beta may be negative or NaN.
+//
+// Each cell stores the four coefficients of its bilinear interpolant as
+// floats, so a lookup reads 16 aligned bytes, never split across cache
+// lines. The cells are grouped in 4 x 4 tiles of 256 bytes, so that nearby
+// (alpha, beta) share cache lines in both directions. A table of 128 x 128
+// cells takes 256 KiB, and stays in L2.
+class solid_angle_table {
+public:
+  solid_angle_table(double max_alpha,
+                    double max_beta,
+                    std::size_t cells_alpha,
+                    std::size_t cells_beta);
+
+  double operator()(double a, double b, double d) const noexcept;
+
+  // omega[i] = (*this)(a[i], b[i], d[i]). The spans must all have the same
+  // size. MULTIVERSION, so that the loads become vector gathers.
+  void lookup(std::span<double const> a,
+              std::span<double const> b,
+              std::span<double const> d,
+              std::span<double> omega) const noexcept;
+
+  // An upper bound on the interpolation error inside the table, from the
+  // largest second derivatives of omega on the grid (the bilinear error is
+  // at most (h_alpha^2 max|omega_alpha,alpha| + h_beta^2
+  // max|omega_beta,beta|) / 8), plus the rounding of the coefficients.
+  double error_bound() const noexcept;
+
+  std::size_t bytes() const noexcept;
+  double max_alpha() const noexcept;
+  double max_beta() const noexcept;
+
+private:
+  // omega(alpha, beta) = c0 + c1 u + c2 v + c3 u v in the cell, where u and
+  // v are the fractional coordinates.
+  struct alignas(16) cell {
+    float c0, c1, c2, c3;
+  };
+
+  std::size_t cell_index(std::size_t i, std::size_t j) const noexcept;
+  double interpolate(double x, double y) const noexcept;
+
+  double max_alpha_;
+  double max_beta_;
+  std::size_t cells_alpha_;
+  std::size_t cells_beta_;
+  // Grid coordinate per unit of alpha and beta.
+  double scale_alpha_;
+  double scale_beta_;
+  std::size_t tiles_alpha_;
+  double error_bound_ = 0.0;
+  std::vector<cell> cells_;
+};
+
+// The measured error of a table against solid_angle, at 'samples' points
+// uniformly distributed over its range.
+struct table_error {
+  double max_abs = 0.0;
+  double rms = 0.0;
+  // Largest relative error where omega is at least 1e-3 sr.
+  double max_rel = 0.0;
+  double bound = 0.0; // error_bound() of the table
+};
+
+table_error measure_error(solid_angle_table const& table,
+                          std::size_t samples,
+                          unsigned long long seed = 123);
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+#include "fill_functions.hh"
+#include "operations.hh"
+
+// summarized_channel wraps a channel container and caches its channel_summary
+// (the total, the peak, the tick range, ...). A SimPhotons data product is
+// written once and then only read, often many times; through the wrapper,
+// sum and find_largest scan it once, on the first query, and are O(1)
+// afterwards.
+//
+// The summary is computed lazily, and discarded whenever the channel is
+// obtained for modification. Computing it lazily is not thread-safe: call
+// seal() when the channel is complete, before it is shared between threads.
+template <typename S>
+class summarized_channel {
+public:
+  S const& channel() const noexcept { return channel_; }
+
+  // Access for modification; this invalidates the cached summary.
+  S& modify() noexcept;
+
+  // Compute the summary now, if it is not cached.
+  void seal() const;
+  bool sealed() const noexcept { return summary_.has_value(); }
+
+  // The summary with all fields, and the default threshold of 0.
+  summary_t const& summary() const;
+
+  void clear() noexcept;
+
+private:
+  S channel_;
+  mutable std::optional<summary_t> summary_;
+};
+
+template <typename S>
+inline constexpr bool is_summarized_channel = false;
+template <typename S>
+inline constexpr bool is_summarized_channel<summarized_channel<S>> = true;
+
+// The fill functions and operations of the wrapped container, through the
+// cache where it helps.
+template <typename S>
+void fill(summarized_channel<S>& m, std::size_t n_measurements);
+template <typename S>
+int sum(summarized_channel<S> const& m);
+template <typename S>
+result_t find_largest(summarized_channel<S> const& m);
+template <typename S>
+int lookup(summarized_channel<S> const& m, int tick);
+// Served from the cache unless a threshold other than 0 is requested.
+template <typename S>
+summary_t channel_summary(summarized_channel<S> const& m,
+                          summary_options const& options = {});
+
+////////////////////////////////////////////
+// Implementation
+
+template <typename S>
+S&
+summarized_channel<S>::modify() noexcept
+{
+  summary_.reset();
+  return channel_;
+}
+
+template <typename S>
+void
+summarized_channel<S>::seal() const
+{
+  if (!summary_)
+    summary_ = channel_summary(channel_);
+}
+
+template <typename S>
+summary_t const&
+summarized_channel<S>::summary() const
+{
+  seal();
+  return *summary_;
+}
+
+template <typename S>
+void
+summarized_channel<S>::clear() noexcept
+{
+  modify().clear();
+}
+
+template <typename S>
+void
+fill(summarized_channel<S>& m, std::size_t n_measurements)
+{
+  fill(m.modify(), n_measurements);
+}
+
+template <typename S>
+int
+sum(summarized_channel<S> const& m)
+{
+  return static_cast<int>(m.summary().total);
+}
+
+template <typename S>
+result_t
+find_largest(summarized_channel<S> const& m)
+{
+  return m.summary().peak;
+}
+
+template <typename S>
+int
+lookup(summarized_channel<S> const& m, int tick)
+{
+  return lookup(m.channel(), tick);
+}
+
+// The fields that were not requested keep their initial values, as from the
+// other overloads.
+template <typename S>
+summary_t
+channel_summary(summarized_channel<S> const& m, summary_options const& options)
+{
+  if ((options.fields & summary_above) && options.threshold != 0)
+    return channel_summary(m.channel(), options);
+  summary_t const& cached = m.summary();
+  summary_t r;
+  r.measurements = cached.measurements;
+  if (options.fields & summary_total)
+    r.total = cached.total;
+  if (options.fields & summary_peak)
+    r.peak = cached.peak;
+  if (options.fields & summary_above)
+    r.above = cached.above;
+  if (options.fields & summary_range) {
+    r.first_tick = cached.first_tick;
+    r.last_tick = cached.last_tick;
+  }
+  if (options.fields & summary_mean_time)
+    r.mean_time = cached.mean_time;
+  return r;
+}
@@ -0,0 +1,72 @@
+// Convert a measurement or channel file (optionally xz-compressed TSV) to the
+// binary columnar format that read_columnar_data in functions.R loads.
+//
+// Usage: tsv_convert [-j threads] [-c chunk-megabytes] input output.col
+//
+// The time taken to load the input and the parsing rate are printed, so the
+// program doubles as a benchmark of read_tsv.
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "fmt/core.h"
+
+#include "columnar_io.hh"
+
+namespace {
+  void
+  usage(char const* argv0)
+  {
+    std::cerr << "Usage: " << argv0
+              << " [-j threads] [-c chunk-megabytes] input output.col\n";
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  tsv_options options;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (std::strcmp(argv[i], "-j") == 0)
+      options.nthreads = std::atol(argv[i + 1]);
+    else if (std::strcmp(argv[i], "-c") == 0)
+      options.chunk_bytes = std::size_t(std::atol(argv[i + 1])) << 20;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - i != 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::filesystem::path const input = argv[i];
+  std::filesystem::path const output = argv[i + 1];
+
+  try {
+    auto const t0 = std::chrono::steady_clock::now();
+    int_table const table = read_table(input, {}, options);
+    auto const t1 = std::chrono::steady_clock::now();
+    write_columnar(table, output);
+    auto const t2 = std::chrono::steady_clock::now();
+
+    double const load = std::chrono::duration<double>(t1 - t0).count();
+    double const write = std::chrono::duration<double>(t2 - t1).count();
+    double const bytes = static_cast<double>(std::filesystem::file_size(input));
+    fmt::print("rows: {}, columns: {}\n", table.rows(), table.names.size());
+    fmt::print("load: {:.3f} s ({:.1f} MB/s of input, {:.1f} Mrows/s)\n",
+               load,
+               bytes / load / 1e6,
+               table.rows() / load / 1e6);
+    fmt::print("write: {:.3f} s\n", write);
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
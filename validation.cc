@@ -0,0 +1,450 @@
+#include "validation.hh"
+#include "bounded_queue.hh"
+#include "columnar_io.hh"
+
+#include <array>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "fmt/format.h"
+
+void
+deviation_stats::add(double x) noexcept
+{
+  ++count;
+  double const delta = x - mean;
+  mean += delta / count;
+  m2 += delta * (x - mean);
+  max_abs = std::max(max_abs, std::abs(x));
+}
+
+void
+deviation_stats::merge(deviation_stats const& other) noexcept
+{
+  if (other.count == 0)
+    return;
+  if (count == 0) {
+    *this = other;
+    return;
+  }
+  double const n = static_cast<double>(count + other.count);
+  double const delta = other.mean - mean;
+  mean += delta * other.count / n;
+  m2 += other.m2 + delta * delta * count * other.count / n;
+  count += other.count;
+  max_abs = std::max(max_abs, other.max_abs);
+}
+
+double
+deviation_stats::variance() const noexcept
+{
+  return count > 1 ? m2 / (count - 1) : 0.0;
+}
+
+void
+variant_summary::merge(variant_summary const& other) noexcept
+{
+  dnmeas.merge(other.dnmeas);
+  dnphots.merge(other.dnphots);
+  channels_differing += other.channels_differing;
+  dnphot.merge(other.dnphot);
+  matched += other.matched;
+  reference_only += other.reference_only;
+  variant_only += other.variant_only;
+}
+
+namespace {
+
+  struct measurement {
+    int channel;
+    int time;
+    int nphot;
+  };
+
+  // (run, subrun, event)
+  using event_key = std::array<int, 3>;
+
+  // All the measurements of one event in one file.
+  struct file_event {
+    event_key key;
+    std::vector<measurement> rows;
+  };
+
+  // All the measurements of one event, for each file; the vector for a file
+  // without that event is empty.
+  struct event_block {
+    std::size_t index;
+    event_key key;
+    std::vector<std::vector<measurement>> rows;
+  };
+
+  [[noreturn]] void
+  not_sorted(std::string const& name, event_key const& key)
+  {
+    throw std::runtime_error(
+      fmt::format("measurements of {} are not sorted, at event {}/{}/{}",
+                  name,
+                  key[0],
+                  key[1],
+                  key[2]));
+  }
+
+  ////////////////////////////////////////////
+  // Part 1: Reading: one thread per file groups the rows into events.
+
+  void
+  read_events(tsv_row_reader& reader,
+              std::string const& name,
+              bounded_queue<file_event>& out)
+  {
+    std::array<int, 6> row;
+    file_event current;
+    bool have_event = false;
+    while (reader.next(row)) {
+      event_key const key{row[0], row[1], row[2]};
+      if (have_event && key != current.key) {
+        if (key < current.key)
+          not_sorted(name, key);
+        if (!out.push(std::move(current)))
+          return;
+        current = {};
+      }
+      current.key = key;
+      have_event = true;
+      current.rows.push_back({row[3], row[4], row[5]});
+    }
+    if (have_event)
+      out.push(std::move(current));
+  }
+
+  ////////////////////////////////////////////
+  // Part 2: Comparing one event.
+
+  // Join the measurements of one channel on time; both are sorted by time.
+  void
+  join_on_time(std::span<measurement const> ref,
+               std::span<measurement const> var,
+               variant_summary& summary)
+  {
+    std::size_t i = 0;
+    std::size_t j = 0;
+    while (i != ref.size() && j != var.size()) {
+      if (ref[i].time == var[j].time) {
+        ++summary.matched;
+        summary.dnphot.add(var[j].nphot - ref[i].nphot);
+        ++i;
+        ++j;
+      } else if (ref[i].time < var[j].time) {
+        ++summary.reference_only;
+        ++i;
+      } else {
+        ++summary.variant_only;
+        ++j;
+      }
+    }
+    summary.reference_only += ref.size() - i;
+    summary.variant_only += var.size() - j;
+  }
+
+  struct worker_result {
+    std::uint64_t events = 0;
+    std::uint64_t channels = 0;
+    std::vector<variant_summary> variants;
+  };
+
+  // Merge the files' measurements of the event on channel, and compare each
+  // variant's channels with the reference's. If 'out' is not null, the
+  // per-channel rows are appended to it.
+  void
+  compare_event(event_block const& block,
+                std::vector<std::string> const& names,
+                worker_result& result,
+                std::string* out)
+  {
+    std::size_t const nfiles = block.rows.size();
+    std::vector<std::size_t> pos(nfiles, 0);
+    std::vector<std::size_t> stop(nfiles, 0);
+    std::vector<int> nmeas(nfiles);
+    std::vector<int> nphots(nfiles);
+    ++result.events;
+    while (true) {
+      int channel = INT_MAX;
+      bool any = false;
+      for (std::size_t f = 0; f != nfiles; ++f) {
+        if (pos[f] != block.rows[f].size()) {
+          channel = std::min(channel, block.rows[f][pos[f]].channel);
+          any = true;
+        }
+      }
+      if (!any)
+        break;
+
+      for (std::size_t f = 0; f != nfiles; ++f) {
+        auto const& rows = block.rows[f];
+        std::size_t e = pos[f];
+        int photons = 0;
+        for (; e != rows.size() && rows[e].channel == channel; ++e) {
+          if (e != pos[f] && rows[e].time < rows[e - 1].time)
+            not_sorted(names[f], block.key);
+          photons += rows[e].nphot;
+        }
+        if (e != rows.size() && rows[e].channel < channel)
+          not_sorted(names[f], block.key);
+        stop[f] = e;
+        nmeas[f] = static_cast<int>(e - pos[f]);
+        nphots[f] = photons;
+      }
+
+      ++result.channels;
+      std::span<measurement const> const ref(block.rows[0].data() + pos[0],
+                                             stop[0] - pos[0]);
+      for (std::size_t f = 1; f != nfiles; ++f) {
+        auto& summary = result.variants[f - 1];
+        int const dm = nmeas[f] - nmeas[0];
+        int const dp = nphots[f] - nphots[0];
+        summary.dnmeas.add(dm);
+        summary.dnphots.add(dp);
+        if (dm != 0 || dp != 0)
+          ++summary.channels_differing;
+        join_on_time(
+          ref, {block.rows[f].data() + pos[f], stop[f] - pos[f]}, summary);
+      }
+
+      if (out != nullptr) {
+        auto it = std::back_inserter(*out);
+        fmt::format_to(it,
+                       "{}\t{}\t{}\t{}",
+                       block.key[0],
+                       block.key[1],
+                       block.key[2],
+                       channel);
+        for (int n : nmeas) {
+          fmt::format_to(it, "\t{}", n);
+        }
+        for (int n : nphots) {
+          fmt::format_to(it, "\t{}", n);
+        }
+        out->push_back('\n');
+      }
+      pos.swap(stop);
+    }
+  }
+}
+
+////////////////////////////////////////////
+// Part 3: The public interface.
+
+validation_result
+validate_measurements(std::vector<std::filesystem::path> const& files,
+                      std::vector<std::string> const& names,
+                      validation_options const& options)
+{
+  if (files.size() < 2 || names.size() != files.size())
+    throw std::invalid_argument(
+      "validate_measurements needs at least two files, and a name for each");
+  std::size_t const nfiles = files.size();
+  std::size_t const nthreads = std::max<std::size_t>(1, options.nthreads);
+  std::size_t const in_flight =
+    std::max<std::size_t>(1, options.events_in_flight);
+
+  // Open everything first, so that those errors are reported directly.
+  std::vector<tsv_row_reader> readers;
+  for (auto const& f : files) {
+    readers.emplace_back(f, measurement_columns);
+    if (readers.back().names() != measurement_columns)
+      throw std::runtime_error(f.string() +
+                               " does not have the expected columns");
+  }
+  std::ofstream channels_out;
+  if (!options.channels_output.empty()) {
+    channels_out.open(options.channels_output);
+    if (!channels_out)
+      throw std::runtime_error("can not create " +
+                               options.channels_output.string());
+    channels_out << "run\tsubrun\tevent\tchannel";
+    for (char const* column : {"nmeas", "nphots"}) {
+      for (auto const& name : names) {
+        channels_out << '\t' << column << '_' << name;
+      }
+    }
+    channels_out << '\n';
+  }
+
+  std::vector<std::unique_ptr<bounded_queue<file_event>>> file_queues;
+  for (std::size_t f = 0; f != nfiles; ++f) {
+    file_queues.push_back(
+      std::make_unique<bounded_queue<file_event>>(in_flight / nfiles + 2));
+  }
+  bounded_queue<event_block> work(in_flight);
+
+  // The comparisons finish out of order; the channel rows are written in
+  // event order through this reorder buffer. A worker whose event is
+  // in_flight or more events ahead of the output waits for it to catch up,
+  // so the buffer holds fewer than in_flight events; after a failure, the
+  // rows are dropped instead.
+  std::mutex output_mutex;
+  std::condition_variable output_advanced;
+  std::map<std::size_t, std::string> pending;
+  std::size_t next_output = 0;
+  bool output_failed = false;
+  auto write_ordered = [&](std::size_t index, std::string text) {
+    std::unique_lock lock(output_mutex);
+    output_advanced.wait(lock, [&]() {
+      return output_failed || index < next_output + in_flight;
+    });
+    if (output_failed)
+      return;
+    pending.emplace(index, std::move(text));
+    std::size_t const first = next_output;
+    while (!pending.empty() && pending.begin()->first == next_output) {
+      channels_out << pending.begin()->second;
+      pending.erase(pending.begin());
+      ++next_output;
+    }
+    if (next_output != first)
+      output_advanced.notify_all();
+  };
+
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto fail = [&](std::exception_ptr e) {
+    {
+      std::lock_guard lock(error_mutex);
+      if (!error)
+        error = e;
+    }
+    for (auto& q : file_queues) {
+      q->close();
+    }
+    work.close();
+    {
+      std::lock_guard lock(output_mutex);
+      output_failed = true;
+    }
+    output_advanced.notify_all();
+  };
+
+  std::vector<worker_result> results(nthreads);
+  for (auto& r : results) {
+    r.variants.resize(nfiles - 1);
+  }
+
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t f = 0; f != nfiles; ++f) {
+      threads.emplace_back([&, f]() {
+        try {
+          read_events(readers[f], names[f], *file_queues[f]);
+        }
+        catch (...) {
+          fail(std::current_exception());
+        }
+        file_queues[f]->close();
+      });
+    }
+    for (std::size_t t = 0; t != nthreads; ++t) {
+      threads.emplace_back([&, t]() {
+        bool const write = channels_out.is_open();
+        while (auto block = work.pop()) {
+          try {
+            std::string text;
+            compare_event(*block, names, results[t], write ? &text : nullptr);
+            if (write)
+              write_ordered(block->index, std::move(text));
+          }
+          catch (...) {
+            fail(std::current_exception());
+          }
+        }
+      });
+    }
+
+    // Merge the files' events, in key order, into blocks for the workers.
+    std::vector<std::optional<file_event>> heads(nfiles);
+    for (std::size_t f = 0; f != nfiles; ++f) {
+      heads[f] = file_queues[f]->pop();
+    }
+    for (std::size_t index = 0;; ++index) {
+      std::optional<event_key> key;
+      for (auto const& h : heads) {
+        if (h && (!key || h->key < *key))
+          key = h->key;
+      }
+      if (!key)
+        break;
+      event_block block{index, *key, {}};
+      block.rows.resize(nfiles);
+      for (std::size_t f = 0; f != nfiles; ++f) {
+        if (heads[f] && heads[f]->key == *key) {
+          block.rows[f] = std::move(heads[f]->rows);
+          heads[f] = file_queues[f]->pop();
+        }
+      }
+      if (!work.push(std::move(block)))
+        break;
+    }
+    work.close();
+  }
+  if (error)
+    std::rethrow_exception(error);
+  if (channels_out.is_open()) {
+    channels_out.close();
+    if (!channels_out)
+      throw std::runtime_error("error writing " +
+                               options.channels_output.string());
+  }
+
+  validation_result total;
+  total.variants.resize(nfiles - 1);
+  for (std::size_t f = 1; f != nfiles; ++f) {
+    total.variants[f - 1].name = names[f];
+  }
+  for (auto const& r : results) {
+    total.events += r.events;
+    total.channels += r.channels;
+    for (std::size_t v = 0; v != r.variants.size(); ++v) {
+      total.variants[v].merge(r.variants[v]);
+    }
+  }
+  return total;
+}
+
+void
+write_summary(validation_result const& result,
+              std::filesystem::path const& filename)
+{
+  std::ofstream out(filename);
+  if (!out)
+    throw std::runtime_error("can not create " + filename.string());
+  out << "variant\tevents\tchannels\tchannels_differing";
+  for (char const* stat : {"dnmeas", "dnphots", "dnphot"}) {
+    out << '\t' << stat << "_mean\t" << stat << "_sd\t" << stat << "_max";
+  }
+  out << "\tmatched\treference_only\tvariant_only\n";
+  auto print = [&](deviation_stats const& s) {
+    out << fmt::format(
+      "\t{:.6g}\t{:.6g}\t{:.6g}", s.mean, std::sqrt(s.variance()), s.max_abs);
+  };
+  for (auto const& v : result.variants) {
+    out << v.name << '\t' << result.events << '\t' << result.channels << '\t'
+        << v.channels_differing;
+    print(v.dnmeas);
+    print(v.dnphots);
+    print(v.dnphot);
+    out << '\t' << v.matched << '\t' << v.reference_only << '\t'
+        << v.variant_only << '\n';
+  }
+  if (!out)
+    throw std::runtime_error("error writing " + filename.string());
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streaming comparison of the measurement files written by different
+// algorithm variants (e.g. acosd, acos4, acos5, orig) for the same events.
+// This replaces the bind_rows/pivot_wider step of read_dataframes in
+// functions.R, which needs all the variants in memory at once.
+//
+// Every file must be sorted by (run, subrun, event, channel, time), which is
+// the order in which the physics validation jobs write them. The files are
+// merged event by event, and each event is compared on a worker thread: for
+// each channel, the number of measurements (nmeas) and the total number of
+// photons (nphots) of each variant are compared with those of the reference
+// (the first file), and the measurements themselves are joined on time.
+// Only the events in flight are held in memory.
+
+// Count, mean, variance (Welford) and largest magnitude of a series of
+// differences. Partial statistics from different threads can be merged.
+struct deviation_stats {
+  std::uint64_t count = 0;
+  double mean = 0.0;
+  double m2 = 0.0;
+  double max_abs = 0.0;
+
+  void add(double x) noexcept;
+  void merge(deviation_stats const& other) noexcept;
+  double variance() const noexcept;
+};
+
+// The comparison of one variant with the reference.
+struct variant_summary {
+  std::string name;
+  // Per channel present in either, differences variant - reference.
+  deviation_stats dnmeas;
+  deviation_stats dnphots;
+  std::uint64_t channels_differing = 0;
+  // Per measurement, joined on (event, channel, time).
+  deviation_stats dnphot;
+  std::uint64_t matched = 0;
+  std::uint64_t reference_only = 0;
+  std::uint64_t variant_only = 0;
+
+  void merge(variant_summary const& other) noexcept;
+};
+
+struct validation_options {
+  // Number of comparing threads; each input file also has a reading thread.
+  std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+  // Number of events buffered between the reading and comparing threads.
+  std::size_t events_in_flight = 64;
+  // If not empty, the per-channel table (run, subrun, event, channel, then
+  // nmeas_<name> and nphots_<name> for each file) is written here, in event
+  // order.
+  std::filesystem::path channels_output;
+};
+
+struct validation_result {
+  std::uint64_t events = 0;
+  std::uint64_t channels = 0;
+  // One per file other than the reference.
+  std::vector<variant_summary> variants;
+};
+
+// Compare the measurement files (see columnar_io.hh; plain or xz-compressed
+// TSV) with the first of them. 'names' gives a name to each file. Throws
+// std::runtime_error on I/O or format errors, or if a file is not sorted.
+validation_result validate_measurements(
+  std::vector<std::filesystem::path> const& files,
+  std::vector<std::string> const& names,
+  validation_options const& options = {});
+
+// Write the summary as a TSV file with one row per variant, for R.
+void write_summary(validation_result const& result,
+                   std::filesystem::path const& filename);
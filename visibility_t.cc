@@ -0,0 +1,254 @@
+// Benchmark visibility_table::gather for streams of deposits along tracks,
+// taken in random order, in track order, sorted by voxel and in Morton
+// order, for both voxel layouts, against the same rows read from a table of
+// floats in voxel order. Also checks the quantization error against its
+// bound, reports the relative error by magnitude of the visibility, and
+// checks that gather gives the values of the table's operator().
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "nanobench.h"
+
+#include "cpu_dispatch.hh"
+#include "visibility_table.hh"
+
+// Optical channels on the plane x = -1, in a 16 x 8 array covering the
+// y-z face of the grid. The visibility is the fraction of the photons from
+// the centre of a voxel that reach a channel of area 'area': the solid angle
+// over 4 pi, attenuated with the distance.
+struct detector {
+  voxel_grid grid;
+  std::size_t channels_y = 16;
+  std::size_t channels_z = 8;
+  double area = 4.0;
+  double attenuation = 40.0;
+
+  std::size_t nchannels() const { return channels_y * channels_z; }
+
+  float
+  operator()(std::uint32_t voxel, std::size_t channel) const
+  {
+    double const x = voxel % grid.nx + 0.5;
+    double const y = voxel / grid.nx % grid.ny + 0.5;
+    double const z = voxel / grid.nx / grid.ny + 0.5;
+    double const cy = (channel % channels_y + 0.5) * grid.ny / channels_y;
+    double const cz = (channel / channels_y + 0.5) * grid.nz / channels_z;
+    double const dx = x + 1.0;
+    double const r2 = dx * dx + (y - cy) * (y - cy) + (z - cz) * (z - cz);
+    double const r = std::sqrt(r2);
+    double const cos_theta = dx / r;
+    return static_cast<float>(area * cos_theta / (4 * M_PI * r2) *
+                              std::exp(-r / attenuation));
+  }
+};
+
+// The voxels of deposits along straight tracks, in half-voxel steps, as
+// they come out of the simulation of the tracks.
+std::vector<std::uint32_t>
+make_tracks(voxel_grid const& grid, std::size_t ntracks, std::size_t steps)
+{
+  std::mt19937_64 engine(123);
+  std::uniform_real_distribution<double> unit{0.0, 1.0};
+  std::normal_distribution<double> normal;
+  std::vector<std::uint32_t> result;
+  for (std::size_t t = 0; t != ntracks; ++t) {
+    double p[3] = {unit(engine) * grid.nx,
+                   unit(engine) * grid.ny,
+                   unit(engine) * grid.nz};
+    double d[3] = {normal(engine), normal(engine), normal(engine)};
+    double const norm = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    for (std::size_t s = 0; s != steps; ++s) {
+      for (std::size_t i = 0; i != 3; ++i) {
+        p[i] += 0.5 * d[i] / norm;
+      }
+      if (p[0] < 0 || p[1] < 0 || p[2] < 0 || p[0] >= grid.nx ||
+          p[1] >= grid.ny || p[2] >= grid.nz)
+        break;
+      result.push_back(grid.id(static_cast<std::size_t>(p[0]),
+                               static_cast<std::size_t>(p[1]),
+                               static_cast<std::size_t>(p[2])));
+    }
+  }
+  return result;
+}
+
+std::vector<std::uint32_t>
+permuted(std::span<std::uint32_t const> voxels,
+         std::span<std::uint32_t const> order)
+{
+  std::vector<std::uint32_t> result;
+  for (std::uint32_t i : order) {
+    result.push_back(voxels[i]);
+  }
+  return result;
+}
+
+// Check the largest error of the table's values against max_error(), and
+// report the relative error of the visibilities in each decade below the
+// largest: with one scale per block, the small values of a block that also
+// holds large ones are quantized in steps close to their own magnitude.
+void
+report_quantization(char const* name,
+                    visibility_table const& table,
+                    std::span<float const> dense)
+{
+  std::size_t const nchannels = table.nchannels();
+  float const largest = std::ranges::max(dense);
+  constexpr int decades = 6;
+  // The last decade also holds all the smaller values.
+  std::size_t count[decades] = {};
+  double max_rel[decades] = {};
+  double sum_rel2[decades] = {};
+  double max_abs = 0.0;
+  for (std::size_t i = 0; i != dense.size(); ++i) {
+    double const exact = dense[i];
+    auto const v = static_cast<std::uint32_t>(i / nchannels);
+    double const error = std::abs(table(v, i % nchannels) - exact);
+    max_abs = std::max(max_abs, error);
+    int const d = std::min(
+      decades - 1, static_cast<int>(std::floor(std::log10(largest / exact))));
+    double const rel = error / exact;
+    ++count[d];
+    max_rel[d] = std::max(max_rel[d], rel);
+    sum_rel2[d] += rel * rel;
+  }
+  // The dequantized value is a float, rounded once more.
+  bool const within =
+    max_abs <= table.max_error() + std::numeric_limits<float>::epsilon() *
+                                     static_cast<double>(largest);
+  fmt::print("{}: max error {:.2e} (bound {:.2e}), largest visibility "
+             "{:.2e}\n",
+             name,
+             max_abs,
+             table.max_error(),
+             largest);
+  std::cout << name << ": quantization error within bound: " << within
+            << '\n';
+  fmt::print("{:>22} {:>10} {:>14} {:>14}\n",
+             "visibility",
+             "values",
+             "max relative",
+             "rms relative");
+  for (int d = 0; d != decades; ++d) {
+    double const high = largest * std::pow(10.0, -d);
+    std::string const range =
+      d == decades - 1 ? fmt::format("< {:.1e}", high) :
+                         fmt::format("{:.1e} - {:.1e}", high / 10, high);
+    fmt::print("{:>22} {:>10} {:>14.2e} {:>14.2e}\n",
+               range,
+               count[d],
+               max_rel[d],
+               count[d] == 0 ? 0.0 : std::sqrt(sum_rel2[d] / count[d]));
+  }
+}
+
+// The rows of the deposits are used in batches, as by the photon simulation.
+constexpr std::size_t batch = 256;
+
+template <typename F>
+void
+run_stream(ankerl::nanobench::Bench* bench,
+           std::vector<std::uint32_t> const& voxels,
+           std::size_t nchannels,
+           F gather,
+           std::string const& name)
+{
+  std::vector<float> out(batch * nchannels);
+  bench->run(name, [&]() {
+    for (std::size_t k = 0; k < voxels.size(); k += batch) {
+      std::size_t const n = std::min(batch, voxels.size() - k);
+      gather(std::span(voxels).subspan(k, n), std::span(out));
+      ankerl::nanobench::doNotOptimizeAway(out.data());
+    }
+  });
+}
+
+int
+main()
+{
+  std::cout << "cpu dispatch: " << selected_isa() << '\n';
+  detector const det{voxel_grid{64, 64, 64}};
+  voxel_grid const& grid = det.grid;
+  std::size_t const nchannels = det.nchannels();
+
+  visibility_table const linear(grid, nchannels, voxel_layout::linear, det);
+  visibility_table const bricks(grid, nchannels, voxel_layout::bricks, det);
+  std::vector<float> dense(grid.size() * nchannels);
+  for (std::uint32_t v = 0; v != grid.size(); ++v) {
+    for (std::size_t c = 0; c != nchannels; ++c) {
+      dense[v * nchannels + c] = det(v, c);
+    }
+  }
+  fmt::print("table: {} MiB (floats: {} MiB)\n",
+             bricks.bytes() >> 20,
+             (dense.size() * sizeof(float)) >> 20);
+  report_quantization("linear", linear, dense);
+  report_quantization("bricks", bricks, dense);
+
+  std::vector<std::uint32_t> const tracks = make_tracks(grid, 4000, 400);
+  std::vector<std::uint32_t> random_order = tracks;
+  std::ranges::shuffle(random_order, std::mt19937_64(456));
+  std::vector<std::uint32_t> const by_voxel =
+    permuted(tracks, voxel_order(tracks));
+  std::vector<std::uint32_t> const by_morton =
+    permuted(tracks, morton_order(grid, tracks));
+
+  bool same = true;
+  std::vector<float> rows(batch * nchannels);
+  for (auto const* table : {&linear, &bricks}) {
+    table->gather(std::span(random_order).first(batch), rows);
+    for (std::size_t k = 0; k != batch; ++k) {
+      for (std::size_t c = 0; c != nchannels; ++c) {
+        same &= rows[k * nchannels + c] == (*table)(random_order[k], c);
+      }
+    }
+  }
+  std::cout << "gather matches operator(): " << same << '\n';
+
+  ankerl::nanobench::Bench b;
+  b.title("visibility gather").unit("deposit").batch(tracks.size());
+  b.minEpochIterations(5);
+  std::vector<std::uint32_t> order;
+  b.run("sort_voxel", [&]() { order = voxel_order(tracks); });
+  b.run("sort_morton", [&]() { order = morton_order(grid, tracks); });
+  ankerl::nanobench::doNotOptimizeAway(order.data());
+
+  auto const float_rows = [&](std::span<std::uint32_t const> voxels,
+                              std::span<float> out) {
+    for (std::size_t k = 0; k != voxels.size(); ++k) {
+      std::copy_n(dense.data() + voxels[k] * nchannels,
+                  nchannels,
+                  out.data() + k * nchannels);
+    }
+  };
+  struct stream {
+    char const* name;
+    std::vector<std::uint32_t> const* voxels;
+  };
+  for (auto const& s : {stream{"random", &random_order},
+                        stream{"tracks", &tracks},
+                        stream{"voxel", &by_voxel},
+                        stream{"morton", &by_morton}}) {
+    run_stream(
+      &b, *s.voxels, nchannels, float_rows, fmt::format("floats_{}", s.name));
+    run_stream(
+      &b,
+      *s.voxels,
+      nchannels,
+      [&](auto voxels, auto out) { linear.gather(voxels, out); },
+      fmt::format("linear_{}", s.name));
+    run_stream(
+      &b,
+      *s.voxels,
+      nchannels,
+      [&](auto voxels, auto out) { bricks.gather(voxels, out); },
+      fmt::format("bricks_{}", s.name));
+  }
+}
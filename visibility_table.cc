@@ -0,0 +1,181 @@
+#include "visibility_table.hh"
+#include "cpu_dispatch.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+  constexpr std::size_t brick = 4;
+  // Deposits ahead whose rows gather prefetches.
+  constexpr std::size_t prefetch_distance = 8;
+
+  // Spread the lowest 10 bits of x so that there are two zero bits between
+  // each of them.
+  constexpr std::uint32_t
+  part1by2(std::uint32_t x) noexcept
+  {
+    x &= 0x3ffu;
+    x = (x | (x << 16)) & 0x030000ffu;
+    x = (x | (x << 8)) & 0x0300f00fu;
+    x = (x | (x << 4)) & 0x030c30c3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+  }
+
+  std::size_t
+  brick_slot(voxel_grid const& grid, std::uint32_t voxel) noexcept
+  {
+    std::size_t const x = voxel % grid.nx;
+    std::size_t const y = voxel / grid.nx % grid.ny;
+    std::size_t const z = voxel / grid.nx / grid.ny;
+    std::size_t const bricks_x = (grid.nx + brick - 1) / brick;
+    std::size_t const bricks_y = (grid.ny + brick - 1) / brick;
+    std::size_t const b =
+      x / brick + bricks_x * (y / brick + bricks_y * (z / brick));
+    return b * visibility_table::block_voxels +
+           morton_code(x % brick, y % brick, z % brick);
+  }
+}
+
+std::uint32_t
+morton_code(std::uint32_t x, std::uint32_t y, std::uint32_t z) noexcept
+{
+  return part1by2(x) | (part1by2(y) << 1) | (part1by2(z) << 2);
+}
+
+// Until the constructor has filled slots_, the bricks are computed.
+std::size_t
+visibility_table::slot(std::uint32_t voxel) const noexcept
+{
+  if (layout_ == voxel_layout::linear)
+    return voxel;
+  return slots_.empty() ? brick_slot(grid_, voxel) : slots_[voxel];
+}
+
+void
+visibility_table::store_block(std::size_t block,
+                              std::span<float const> values)
+{
+  float const largest = std::ranges::max(values);
+  float const scale = largest > 0.0f ? largest / 65535.0f : 0.0f;
+  scales_[block] = scale;
+  std::uint16_t* q = values_.data() + block * block_voxels * block_channels;
+  for (std::size_t i = 0; i != values.size(); ++i) {
+    float const steps = scale == 0.0f ? 0.0f : values[i] / scale;
+    q[i] = static_cast<std::uint16_t>(
+      std::clamp(std::lround(steps), 0l, 65535l));
+  }
+}
+
+float
+visibility_table::operator()(std::uint32_t voxel,
+                             std::size_t channel) const noexcept
+{
+  std::size_t const s = slot(voxel);
+  std::size_t const block = s / block_voxels * channel_blocks_ +
+                            channel / block_channels;
+  std::size_t const i = block * block_voxels * block_channels +
+                        s % block_voxels * block_channels +
+                        channel % block_channels;
+  return values_[i] * scales_[block];
+}
+
+// Each row is read in 128-byte segments, one per channel block; the
+// conversion of a segment is a simple loop, which vectorizes. The segments
+// of a deposit a few places ahead are prefetched, so that, in random order,
+// the misses of several deposits overlap.
+MULTIVERSION void
+visibility_table::gather(std::span<std::uint32_t const> voxels,
+                         std::span<float> out) const noexcept
+{
+  std::size_t const nchannels = nchannels_;
+  std::size_t const channel_blocks = channel_blocks_;
+  std::size_t const block_size = block_voxels * block_channels;
+  std::uint16_t const* values = values_.data();
+  float const* scales = scales_.data();
+  std::uint32_t const* slots = slots_.empty() ? nullptr : slots_.data();
+  auto const slot = [slots](std::uint32_t voxel) -> std::size_t {
+    return slots == nullptr ? voxel : slots[voxel];
+  };
+  for (std::size_t k = 0; k != voxels.size(); ++k) {
+    if (k + prefetch_distance < voxels.size()) {
+      std::size_t const s = slot(voxels[k + prefetch_distance]);
+      std::uint16_t const* ahead =
+        values + s / block_voxels * channel_blocks * block_size +
+        s % block_voxels * block_channels;
+      for (std::size_t cb = 0; cb != channel_blocks; ++cb) {
+        __builtin_prefetch(ahead + cb * block_size);
+        __builtin_prefetch(ahead + cb * block_size + block_channels / 2);
+      }
+    }
+    std::size_t const s = slot(voxels[k]);
+    std::size_t const first_block = s / block_voxels * channel_blocks;
+    std::uint16_t const* row =
+      values + first_block * block_size + s % block_voxels * block_channels;
+    float* dst = out.data() + k * nchannels;
+    for (std::size_t cb = 0; cb != channel_blocks; ++cb) {
+      float const scale = scales[first_block + cb];
+      std::uint16_t const* src = row + cb * block_size;
+      std::size_t const c0 = cb * block_channels;
+      std::size_t const n = std::min(block_channels, nchannels - c0);
+      for (std::size_t c = 0; c != n; ++c) {
+        dst[c0 + c] = src[c] * scale;
+      }
+    }
+  }
+}
+
+double
+visibility_table::max_error() const noexcept
+{
+  return scales_.empty() ? 0.0 : std::ranges::max(scales_) / 2.0;
+}
+
+std::size_t
+visibility_table::nchannels() const noexcept
+{
+  return nchannels_;
+}
+
+voxel_grid const&
+visibility_table::grid() const noexcept
+{
+  return grid_;
+}
+
+std::size_t
+visibility_table::bytes() const noexcept
+{
+  return values_.size() * sizeof(std::uint16_t) +
+         scales_.size() * sizeof(float) +
+         slots_.size() * sizeof(std::uint32_t);
+}
+
+std::vector<std::uint32_t>
+voxel_order(std::span<std::uint32_t const> voxels)
+{
+  std::vector<std::uint32_t> order(voxels.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::ranges::stable_sort(order, {}, [voxels](std::uint32_t i) {
+    return voxels[i];
+  });
+  return order;
+}
+
+std::vector<std::uint32_t>
+morton_order(voxel_grid const& grid, std::span<std::uint32_t const> voxels)
+{
+  std::vector<std::uint32_t> codes(voxels.size());
+  for (std::size_t i = 0; i != voxels.size(); ++i) {
+    std::uint32_t const v = voxels[i];
+    codes[i] = morton_code(v % grid.nx, v / grid.nx % grid.ny,
+                           v / grid.nx / grid.ny);
+  }
+  std::vector<std::uint32_t> order(voxels.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::ranges::stable_sort(order, {}, [&codes](std::uint32_t i) {
+    return codes[i];
+  });
+  return order;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "data_structures.hh"
+
+// The optical voxels of the TPC, nx x ny x nz of them. The id of the voxel
+// at (x, y, z) is x + nx (y + ny z).
+struct voxel_grid {
+  std::size_t nx;
+  std::size_t ny;
+  std::size_t nz;
+
+  std::size_t size() const noexcept { return nx * ny * nz; }
+  std::uint32_t id(std::size_t x, std::size_t y, std::size_t z) const noexcept;
+};
+
+// The order in which the rows of the voxels are stored.
+//
+//   linear: by voxel id, so a block holds 64 voxels along x.
+//   bricks: in 4 x 4 x 4 bricks, so a block holds a cube of neighbouring
+//           voxels, in Morton order inside it.
+enum class voxel_layout { linear, bricks };
+
+// visibility_table holds the visibility of every optical channel from every
+// voxel, for the semi-analytical model. It is much larger than the caches,
+// and each deposit needs the row of its voxel, so it is stored:
+//
+//   - quantized to 16 bits, with one scale per block: a value v is stored as
+//     round(v / scale), where scale is the largest value in the block divided
+//     by 65535. This halves the table compared to floats. The error is
+//     relative to the largest value of the block, so the smallest values of
+//     a block keep few significant bits (see visibility_t).
+//   - in blocks of 64 voxels x 64 channels (8 KiB), each a contiguous array
+//     of 128-byte row segments. Deposits in the same block share it while it
+//     is in L1, which is why deposits should be sorted, by voxel id for the
+//     linear layout and in Morton order for bricks (see the functions below).
+class visibility_table {
+public:
+  static constexpr std::size_t block_voxels = 64;
+  static constexpr std::size_t block_channels = 64;
+
+  // visibility(voxel, channel) is called once for every voxel id and
+  // channel.
+  template <typename F>
+  visibility_table(voxel_grid const& grid,
+                   std::size_t nchannels,
+                   voxel_layout layout,
+                   F visibility);
+
+  float operator()(std::uint32_t voxel, std::size_t channel) const noexcept;
+
+  // out[k * nchannels() + c] is the visibility of channel c from voxels[k];
+  // out must have room for voxels.size() rows. MULTIVERSION, so that the
+  // conversion from 16 bits is vectorized.
+  void gather(std::span<std::uint32_t const> voxels,
+              std::span<float> out) const noexcept;
+
+  // The largest quantization error, half of the largest scale.
+  double max_error() const noexcept;
+
+  std::size_t nchannels() const noexcept;
+  voxel_grid const& grid() const noexcept;
+  std::size_t bytes() const noexcept;
+
+private:
+  // Where the row of a voxel is stored.
+  std::size_t slot(std::uint32_t voxel) const noexcept;
+  // Quantize the values of one block, block_voxels rows of block_channels.
+  void store_block(std::size_t block, std::span<float const> values);
+
+  voxel_grid grid_;
+  std::size_t nchannels_;
+  voxel_layout layout_;
+  std::size_t channel_blocks_;
+  // slot(voxel) for the bricks layout, which would otherwise take three
+  // divisions per voxel.
+  std::vector<std::uint32_t> slots_;
+  std::vector<float> scales_;
+  aligned_vector<std::uint16_t> values_;
+};
+
+// Permutations of the deposits, given the voxel of each, that improve the
+// reuse of the table's blocks: deposits[order[0]], deposits[order[1]], ...
+// are in increasing voxel id, or in the Morton order of their voxels.
+std::vector<std::uint32_t> voxel_order(std::span<std::uint32_t const> voxels);
+std::vector<std::uint32_t> morton_order(voxel_grid const& grid,
+                                        std::span<std::uint32_t const> voxels);
+
+// The Morton code of (x, y, z), interleaving the lowest 10 bits of each.
+std::uint32_t morton_code(std::uint32_t x,
+                          std::uint32_t y,
+                          std::uint32_t z) noexcept;
+
+////////////////////////////////////////////
+// Implementation
+
+inline std::uint32_t
+voxel_grid::id(std::size_t x, std::size_t y, std::size_t z) const noexcept
+{
+  return static_cast<std::uint32_t>(x + nx * (y + ny * z));
+}
+
+// The voxels of each block are collected in voxel_rows, and the slots past
+// the end of the grid (or of the channels) hold 0.
+template <typename F>
+visibility_table::visibility_table(voxel_grid const& grid,
+                                   std::size_t nchannels,
+                                   voxel_layout layout,
+                                   F visibility)
+  : grid_(grid)
+  , nchannels_(nchannels)
+  , layout_(layout)
+  , channel_blocks_((nchannels + block_channels - 1) / block_channels)
+{
+  std::size_t slots = 0;
+  std::vector<std::uint32_t> slot_of(grid.size());
+  for (std::uint32_t v = 0; v != grid.size(); ++v) {
+    slot_of[v] = static_cast<std::uint32_t>(slot(v));
+    slots = std::max<std::size_t>(slots, slot_of[v] + 1);
+  }
+  if (layout == voxel_layout::bricks)
+    slots_ = slot_of;
+  std::size_t const voxel_blocks = (slots + block_voxels - 1) / block_voxels;
+  scales_.resize(voxel_blocks * channel_blocks_);
+  values_.resize(scales_.size() * block_voxels * block_channels);
+
+  std::vector<std::vector<std::uint32_t>> voxel_rows(voxel_blocks);
+  for (std::uint32_t v = 0; v != grid.size(); ++v) {
+    voxel_rows[slot_of[v] / block_voxels].push_back(v);
+  }
+  std::vector<float> block(block_voxels * block_channels);
+  for (std::size_t vb = 0; vb != voxel_blocks; ++vb) {
+    for (std::size_t cb = 0; cb != channel_blocks_; ++cb) {
+      std::ranges::fill(block, 0.0f);
+      std::size_t const c0 = cb * block_channels;
+      std::size_t const nc = std::min(block_channels, nchannels - c0);
+      for (std::uint32_t v : voxel_rows[vb]) {
+        float* row =
+          block.data() + slot_of[v] % block_voxels * block_channels;
+        for (std::size_t c = 0; c != nc; ++c) {
+          row[c] = static_cast<float>(visibility(v, c0 + c));
+        }
+      }
+      store_block(vb * channel_blocks_ + cb, block);
+    }
+  }
+}